@@ -0,0 +1,10 @@
+# 把运行时库的 bitcode 转换成 C++ 字节数组，编译进 luac
+# 用法: cmake -DINPUT=<luaruntime.bc> -DOUTPUT=<RuntimeBitcode.cpp> -P EmbedBitcode.cmake
+
+file(READ ${INPUT} content HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${content}")
+
+file(WRITE ${OUTPUT}
+    "#include <cstddef>\n\n"
+    "extern const unsigned char luaRuntimeBitcode[] = {${bytes}};\n"
+    "extern const size_t luaRuntimeBitcodeSize = sizeof(luaRuntimeBitcode);\n")
@@ -17,10 +17,31 @@ enum class UnaryOp {
     NEG, NOT_OP, LEN
 };
 
-// AST 基类
+// 名字的解析结果（由 ClosureAnalysis 写入）：全局变量、本函数的本地变量槽、
+// 或者本函数隐藏参数 upvals 中的下标
+enum class Binding {
+    GLOBAL, LOCAL, UPVALUE
+};
+
+class BoundName {
+    Binding binding = Binding::GLOBAL;
+    int slot = -1;
+public:
+    void bind(Binding b, int s) { binding = b; slot = s; }
+    Binding getBinding() const { return binding; }
+    int getSlot() const { return slot; }
+};
+
+// AST 基类。节点的 getXxxRef() 返回持有子节点的指针，供 AST 优化器替换子树
 class Node {
+    int line = 0;       // 源码位置，0 表示未知
+    int column = 0;
 public:
     virtual ~Node() = default;
+    
+    void setLocation(int l, int c) { line = l; column = c; }
+    int getLine() const { return line; }
+    int getColumn() const { return column; }
 };
 
 // 表达式基类
@@ -45,6 +66,7 @@ public:
         : statements(std::move(stmts)) {}
     
     const std::vector<std::unique_ptr<Stmt>>& getStatements() const { return statements; }
+    std::vector<std::unique_ptr<Stmt>>& getStatementsRef() { return statements; }
     void accept(Visitor& visitor) override { visitor.visit(this); }
 };
 
@@ -59,6 +81,8 @@ public:
     
     Expr* getLeft() { return left.get(); }
     Expr* getRight() { return right.get(); }
+    std::unique_ptr<Expr>& getLeftRef() { return left; }
+    std::unique_ptr<Expr>& getRightRef() { return right; }
     BinaryOp getOp() const { return op; }
     void accept(Visitor& visitor) override {
         visitor.visit(this);
@@ -83,6 +107,7 @@ class PrintExpr : public Stmt {
 public:
     PrintExpr(std::unique_ptr<Expr> e) : expr(std::move(e)) {}
     Expr* getExpr() { return expr.get(); }
+    std::unique_ptr<Expr>& getExprRef() { return expr; }
     void accept(Visitor& visitor) override {
         visitor.visit(this);
     }
@@ -102,6 +127,9 @@ public:
     Expr* getCondition() { return condition.get(); }
     Stmt* getThenBranch() { return thenBranch.get(); }
     Stmt* getElseBranch() { return elseBranch.get(); }
+    std::unique_ptr<Expr>& getConditionRef() { return condition; }
+    std::unique_ptr<Stmt>& getThenBranchRef() { return thenBranch; }
+    std::unique_ptr<Stmt>& getElseBranchRef() { return elseBranch; }
     void accept(Visitor& visitor) override {
         visitor.visit(this);
     }
@@ -117,6 +145,8 @@ public:
     
     Expr* getCondition() const { return condition.get(); }
     Stmt* getBody() const { return body.get(); }
+    std::unique_ptr<Expr>& getConditionRef() { return condition; }
+    std::unique_ptr<Stmt>& getBodyRef() { return body; }
     void accept(Visitor& visitor) override;
 };
 
@@ -130,6 +160,8 @@ public:
     
     Expr* getCondition() const { return condition.get(); }
     Stmt* getBody() const { return body.get(); }
+    std::unique_ptr<Expr>& getConditionRef() { return condition; }
+    std::unique_ptr<Stmt>& getBodyRef() { return body; }
     void accept(Visitor& visitor) override;
 };
 
@@ -147,6 +179,7 @@ public:
     const std::string& getName() const { return name; }
     const std::vector<std::string>& getParams() const { return params; }
     const std::vector<std::unique_ptr<Stmt>>& getBody() const { return body; }
+    std::vector<std::unique_ptr<Stmt>>& getBodyRef() { return body; }
     void accept(Visitor& visitor) override;
 };
 
@@ -156,11 +189,12 @@ class ReturnStmt : public Stmt {
 public:
     ReturnStmt(std::vector<std::unique_ptr<Expr>> v) : values(std::move(v)) {}
     const std::vector<std::unique_ptr<Expr>>& getValues() const { return values; }
+    std::vector<std::unique_ptr<Expr>>& getValuesRef() { return values; }
     void accept(Visitor& visitor) override;
 };
 
 // 局部变量声明
-class LocalVarDecl : public Stmt {
+class LocalVarDecl : public Stmt, public BoundName {
     std::string name;
     std::unique_ptr<Expr> initializer;
 public:
@@ -169,6 +203,21 @@ public:
     
     const std::string& getName() const { return name; }
     Expr* getInitializer() const { return initializer.get(); }
+    std::unique_ptr<Expr>& getInitializerRef() { return initializer; }
+    void accept(Visitor& visitor) override;
+};
+
+// 赋值语句
+class AssignStmt : public Stmt, public BoundName {
+    std::string name;
+    std::unique_ptr<Expr> value;
+public:
+    AssignStmt(const std::string& n, std::unique_ptr<Expr> v)
+        : name(n), value(std::move(v)) {}
+    
+    const std::string& getName() const { return name; }
+    Expr* getValue() const { return value.get(); }
+    std::unique_ptr<Expr>& getValueRef() { return value; }
     void accept(Visitor& visitor) override;
 };
 
@@ -202,6 +251,7 @@ public:
     
     UnaryOp getOp() const { return op; }
     Expr* getExpr() const { return expr.get(); }
+    std::unique_ptr<Expr>& getExprRef() { return expr; }
     void accept(Visitor& visitor) override {
         visitor.visit(this);
     }
@@ -213,6 +263,7 @@ class ExprStmt : public Stmt {
 public:
     ExprStmt(std::unique_ptr<Expr> e) : expr(std::move(e)) {}
     Expr* getExpr() { return expr.get(); }
+    std::unique_ptr<Expr>& getExprRef() { return expr; }
     void accept(Visitor& visitor) override;
 };
 
@@ -225,12 +276,13 @@ public:
     
     const std::string& getCallee() const { return callee; }
     const std::vector<std::unique_ptr<Expr>>& getArguments() const { return arguments; }
+    std::vector<std::unique_ptr<Expr>>& getArgumentsRef() { return arguments; }
     void accept(Visitor& visitor) override {
         visitor.visit(this);
     }
 };
 
-class VarExpr : public Expr {
+class VarExpr : public Expr, public BoundName {
     std::string name;
 public:
     VarExpr(const std::string& name) : name(name) {}
@@ -240,4 +292,62 @@ public:
     void accept(Visitor& visitor) override {
         visitor.visit(this);
     }
-}; 
\ No newline at end of file
+}; 
+// 索引表达式 t[k]，t.name 的键是字符串 "name"
+class IndexExpr : public Expr {
+    std::unique_ptr<Expr> object;
+    std::unique_ptr<Expr> key;
+public:
+    IndexExpr(std::unique_ptr<Expr> o, std::unique_ptr<Expr> k)
+        : object(std::move(o)), key(std::move(k)) {}
+
+    Expr* getObject() const { return object.get(); }
+    Expr* getKey() const { return key.get(); }
+    std::unique_ptr<Expr>& getObjectRef() { return object; }
+    std::unique_ptr<Expr>& getKeyRef() { return key; }
+    void accept(Visitor& visitor) override {
+        visitor.visit(this);
+    }
+};
+
+// 表构造器：@() 或 @(n) 创建空表，@[a, b] 的元素从 1 开始编号，@{k = v} 是记录；
+// @name{...} 构造完成后以表为参数调用函数 name，表达式的值仍然是表
+class TableExpr : public Expr {
+public:
+    struct Field {
+        std::unique_ptr<Expr> key;
+        std::unique_ptr<Expr> value;
+    };
+
+    TableExpr(std::vector<Field> f, std::unique_ptr<Expr> size = nullptr)
+        : fields(std::move(f)), size(std::move(size)) {}
+
+    const std::vector<Field>& getFields() const { return fields; }
+    Expr* getSize() const { return size.get(); }
+    std::vector<Field>& getFieldsRef() { return fields; }
+    std::unique_ptr<Expr>& getSizeRef() { return size; }
+    const std::string& getConstructor() const { return constructor; }
+    void setConstructor(const std::string& name) { constructor = name; }
+    void accept(Visitor& visitor) override {
+        visitor.visit(this);
+    }
+
+private:
+    std::vector<Field> fields;
+    std::unique_ptr<Expr> size;
+    std::string constructor;
+};
+
+// 索引赋值语句 t[k] = v
+class IndexAssignStmt : public Stmt {
+    std::unique_ptr<IndexExpr> target;
+    std::unique_ptr<Expr> value;
+public:
+    IndexAssignStmt(std::unique_ptr<IndexExpr> t, std::unique_ptr<Expr> v)
+        : target(std::move(t)), value(std::move(v)) {}
+
+    IndexExpr* getTarget() const { return target.get(); }
+    Expr* getValue() const { return value.get(); }
+    std::unique_ptr<Expr>& getValueRef() { return value; }
+    void accept(Visitor& visitor) override;
+};
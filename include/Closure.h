@@ -0,0 +1,104 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "AST.h"
+
+// 函数的闭包信息
+struct FunctionInfo {
+    FunctionDecl* decl = nullptr;
+    FunctionInfo* parent = nullptr;     // 直接外层函数：顶层函数为 nullptr，捕获了顶层局部变量的为顶层代码
+
+    // 捕获的外层变量（所属函数, 槽号），顺序即隐藏参数 upvals 中的下标。
+    // 按槽号区分，同名的遮蔽变量各有自己的单元
+    std::vector<std::pair<FunctionInfo*, int>> upvalues;
+
+    std::vector<std::string> slots;     // 本地变量槽的名字，参数占前面的槽
+    std::set<int> captured;             // 被内层函数捕获的本地变量槽
+    std::set<int> boxed;                // 被逃逸闭包捕获、必须分配在堆上的本地变量槽
+    bool escapes = false;               // 闭包是否可能在外层函数返回后被调用
+    bool coroutine = false;             // 被 coroutine.create 用作协程体
+
+    bool isClosure() const { return parent != nullptr; }
+    bool hasUpvalues() const { return !upvalues.empty(); }
+    int upvalueIndex(FunctionInfo* owner, int slot) const;
+    const std::string& upvalueName(size_t index) const { return upvalues[index].first->slots[upvalues[index].second]; }
+    bool isInside(const FunctionInfo* ancestor) const;
+};
+
+// 名字解析、闭包与逃逸分析
+//
+// 每个本地变量声明（包括参数）在所属函数中分配一个槽号，VarExpr、AssignStmt 和
+// LocalVarDecl 记录解析结果，代码生成不再按名字查找作用域。
+//
+// 嵌套函数通过隐藏的第一个参数 upvals（指向变量单元指针数组）访问外层变量。
+// 只在外层函数内部被直接调用的闭包不会逃逸，其捕获变量留在外层栈帧中，
+// 调用点在栈上构造 upvals；可能在外层函数返回后被调用的闭包才把捕获变量
+// 装箱到堆上，并在声明语句执行时把 upvals 保存到全局的 <name>.env 中。
+//
+// 顶层代码也有一个 FunctionInfo（getMainInfo，decl 为空）。捕获了顶层局部变量的
+// 顶层函数以它为外层函数，按闭包处理：只在本 chunk 中可见，不导出给宿主。
+class ClosureAnalysis : public Visitor {
+public:
+    void run(BlockStmt* root);
+
+    FunctionInfo* getInfo(FunctionDecl* decl);
+    FunctionInfo* getMainInfo() { return &mainInfo; }
+    FunctionInfo* lookup(const std::string& name);
+    const std::vector<FunctionDecl*>& getFunctions() const { return functions; }
+    const std::vector<std::string>& getMainSlots() const { return mainInfo.slots; }
+    std::vector<std::string>& getMainSlotsRef() { return mainInfo.slots; }
+
+private:
+    struct CallSite {
+        FunctionInfo* caller;           // 调用所在函数，顶层代码为 &mainInfo
+        std::string callee;
+    };
+
+    // 词法作用域：每层函数一帧，每帧按块嵌套保存已声明的本地变量及其槽号
+    struct Frame {
+        FunctionInfo* info;
+        std::vector<std::string>* slots;
+        std::vector<std::map<std::string, int>> scopes;
+    };
+
+    std::map<FunctionDecl*, FunctionInfo> infos;
+    std::map<std::string, std::vector<FunctionInfo*>> byName;
+    std::vector<FunctionDecl*> functions;
+    std::vector<CallSite> calls;
+    std::set<std::string> valueUses;    // 作为值使用或被重新赋值的名字
+    std::set<std::string> coroutineBodies;
+    std::vector<Frame> frames;
+    FunctionInfo mainInfo;
+
+    int declareLocal(const std::string& name);
+    void reference(const std::string& name, BoundName* node);
+    void addUpvalue(FunctionInfo* from, FunctionInfo* owner, int slot);
+    void checkClosureNames();
+    void computeEscapes();
+    void forwardUpvalues();
+
+    void visit(BlockStmt* node) override;
+    void visit(FunctionDecl* node) override;
+    void visit(ReturnStmt* node) override;
+    void visit(IfStmt* node) override;
+    void visit(WhileStmt* node) override;
+    void visit(RepeatStmt* node) override;
+    void visit(ExprStmt* node) override;
+    void visit(BinaryExpr* node) override;
+    void visit(UnaryExpr* node) override;
+    void visit(NumberExpr* node) override;
+    void visit(StringExpr* node) override;
+    void visit(NilExpr* node) override;
+    void visit(VarExpr* node) override;
+    void visit(CallExpr* node) override;
+    void visit(PrintExpr* node) override;
+    void visit(LocalVarDecl* node) override;
+    void visit(AssignStmt* node) override;
+    void visit(IndexExpr* node) override;
+    void visit(TableExpr* node) override;
+    void visit(IndexAssignStmt* node) override;
+};
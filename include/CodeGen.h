@@ -2,16 +2,68 @@
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Target/TargetMachine.h>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include "AST.h"
+#include "Closure.h"
+#include "Escape.h"
+#include "Optimizer.h"
+
+// 增量编译时在 chunk 之间共享的符号：顶层函数的签名和全局变量
+struct ChunkSymbols {
+    struct Signature {
+        size_t params;
+        bool multipleReturns;
+    };
+    std::map<std::string, Signature> functions;
+    std::set<std::string> globals;
+};
 
 class CodeGenerator : public Visitor {
 public:
     CodeGenerator();
     ~CodeGenerator();
 
+    // 入口函数名，默认 main；增量编译时每个 chunk 使用不同的名字
+    void setEntryName(const std::string& name) { entryName = name; }
+
+    // 之前的 chunk 已经定义的符号只生成外部声明，本 chunk 定义的符号由 exportSymbols 登记
+    void importSymbols(const ChunkSymbols& symbols) { imports = &symbols; }
+    void exportSymbols(ChunkSymbols& symbols);
+
+    // 交出模块及其上下文（例如交给 ORC JIT），之后不能再使用生成器
+    std::pair<std::unique_ptr<llvm::LLVMContext>, std::unique_ptr<llvm::Module>> releaseModule();
+
+    // 优化级别 0-3，0 表示不优化（默认），必须在 generateCode 之前设置
+    void setOptimizationLevel(unsigned level) { optLevel = level; }
+
+    // 可重入模式：全局变量和逃逸闭包的环境不放在模块的全局变量中，而是放在当前线程
+    // 正在执行的 LuaState 的槽数组中，同一份代码可以同时为多个 LuaState 执行
+    void setReentrant(bool enabled) { reentrant = enabled; }
+    // 可重入模式下的槽布局：global.<name>、<function>.env 和 function.<name> 到槽下标
+    const std::map<std::string, unsigned>& getStateSlots() const { return stateSlots; }
+
+    // 抢占模式：函数入口和循环回边消耗当前线程的预算，耗尽时调用 lua_preempt
+    void setPreemption(bool enabled) { preemption = enabled; }
+
+    // 生成 DWARF 调试信息（行号表和函数作用域），source 是写入调试信息的源文件路径
+    void enableDebugInfo(const std::string& source) { debugSource = source; }
+
+    // 分配分析：每个分配点登记所在的源码行（见 Runtime.h 的 LuaAllocSite），
+    // 入口函数启动运行时的分析器，退出时输出报告；source 是报告中的源文件名
+    void enableAllocationProfiling(const std::string& source) { profileSource = source; }
+
+    // 共享库输出：为宿主 CPU 生成位置无关代码，只导出 LuaModule.h 中的 lua_module，
+    // 必须在 generateCode 之前设置，之后用 emitSharedLibrary 输出
+    void setSharedLibrary(bool enabled) { sharedLibrary = enabled; }
+
     void generateCode(Stmt* root);
     void saveModuleToFile(const std::string& filename);
+    void emitSharedLibrary(const std::string& filename);
     void executeCode();
 
 private:
@@ -19,18 +71,195 @@ private:
     std::unique_ptr<llvm::Module> module;
     std::unique_ptr<llvm::IRBuilder<>> builder;
     llvm::Value* lastValue;
-    std::map<std::string, llvm::AllocaInst*> namedValues;
     llvm::Function* currentFunction;
-    llvm::Function* printfFunc;
+    FunctionInfo* currentInfo = nullptr;
+    ASTOptimizer optimizer;
+    ClosureAnalysis closures;
+    TableEscapeAnalysis scalarTables;
+    // 当前函数中可被闭包捕获的变量单元（所属函数, 槽号）
+    std::map<std::pair<FunctionInfo*, int>, llvm::Value*> upvalueCells;
+    
+    // 本地变量直接构造 SSA（Braun et al. 2013）：每个基本块记录各个槽的当前定义，
+    // 前驱未确定（未封闭）的块中读取变量时先放一个不完整的 phi，封闭时补齐操作数。
+    // 被闭包捕获的槽仍然放在变量单元中（slotCells），upvalue 的单元在 upvalueSlots 中
+    struct BlockDefs {
+        std::map<int, llvm::WeakTrackingVH> defs;
+        std::vector<std::pair<llvm::PHINode*, int>> incompletePhis;
+        bool sealed = false;
+    };
+    std::unordered_map<llvm::BasicBlock*, BlockDefs> blockDefs;
+    std::map<int, llvm::Value*> slotCells;
+    std::vector<llvm::Value*> upvalueSlots;
+    const std::vector<std::string>* slotNames = nullptr;
+    
+    // 正在生成的协程体，生成普通函数时 coroState 为 nullptr
+    llvm::Value* coroState = nullptr;
+    llvm::BasicBlock* coroCleanupBB = nullptr;
+    llvm::BasicBlock* coroSuspendBB = nullptr;
+    llvm::BasicBlock* coroFinalBB = nullptr;
+    llvm::StructType* coroutineType = nullptr;
+    bool hasCoroutines = false;
+    unsigned optLevel = 0;
+    std::string entryName = "main";
+    const ChunkSymbols* imports = nullptr;
+    
+    // 可重入模式下的槽布局，以及本函数入口取得的槽数组（协程体中为 nullptr）
+    bool reentrant = false;
+    std::map<std::string, unsigned> stateSlots;
+    llvm::Value* stateSlotBase = nullptr;
+    
+    // 抢占模式下本函数的预算副本（入口块中的 alloca），协程体中为 nullptr（每次检查重新获取计数器）
+    bool preemption = false;
+    llvm::Value* budgetLocal = nullptr;
+    
+    // 多次定义的顶层函数：每个定义生成一个函数（第一个定义使用原名，之后为 <name>.2 ...），
+    // 当前定义保存在 function.<name> 中。调用点预测执行到这里时的定义，
+    // 比较相同就直接调用（可以内联），否则通过函数指针调用
+    std::map<std::string, std::vector<FunctionDecl*>> redefinitions;
+    std::map<FunctionDecl*, llvm::Function*> definitions;
+    int statementLine = 0;
+    
+    // 作为值使用的函数，它们的包装函数 <name>.value 在所有函数生成之后生成
+    std::vector<std::string> functionValues;
+    
+    // pcall 保护的调用点上 Lua 函数调用生成 invoke，错误展开到这个 landingpad
+    llvm::BasicBlock* landingPad = nullptr;
+    
+    // 共享库输出
+    bool sharedLibrary = false;
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+    
+    // 分配分析，未启用时 profileSource 为空
+    std::string profileSource;
+    std::map<std::pair<int, int32_t>, llvm::GlobalVariable*> allocationSites;
+    
+    // 调试信息，未启用时 debugBuilder 为空
+    std::string debugSource;
+    std::unique_ptr<llvm::DIBuilder> debugBuilder;
+    llvm::DICompileUnit* debugUnit = nullptr;
 
     // 私有辅助方法
-    void declarePrintf();
     void collectFunctionDeclarations(Stmt* node);
+    void declareImports();
+    llvm::Type* createReturnType(const std::string& name, bool multipleReturns);
     bool hasMultipleReturns(FunctionDecl* node);
-    llvm::AllocaInst* createEntryBlockAlloca(llvm::Function* function, const std::string& name);
+    llvm::AllocaInst* createEntryBlockAlloca(llvm::Function* function, const std::string& name,
+                                             llvm::Type* type = nullptr);
+    void generateFunction(FunctionDecl* node);
+    void collectRedefinitions();
+    llvm::Function* getDefinition(FunctionDecl* node);
+    llvm::Value* getFunctionSlot(const std::string& name);
+    llvm::Value* emitFunctionCall(llvm::Function* callee, const std::vector<llvm::Value*>& args,
+                                  const std::string& name);
+    llvm::CallBase* createCall(llvm::FunctionType* type, llvm::Value* callee,
+                               llvm::ArrayRef<llvm::Value*> args, const std::string& name);
+    std::vector<llvm::Value*> generateArguments(const std::string& calleeName, llvm::Function* callee,
+        const std::vector<std::unique_ptr<Expr>>& arguments, size_t first);
+    llvm::Value* createLocalStorage(int slot);
+    llvm::Value* createUpvalueArray(FunctionInfo* info, bool onHeap);
+    void emitClosureEnvCheck(FunctionInfo* info, llvm::Value* upvals);
+    llvm::Value* getClosureEnv(FunctionInfo* info);
+    llvm::Value* getOrCreateGlobal(const std::string& name);
+    llvm::Value* getStateSlot(const std::string& name);
+    void bindUpvalues(llvm::Value* upvals);
+    llvm::Value* generateValue(Expr* expr);
+    void generateStatement(Stmt* stmt);
+    
+    // 变量读写与 SSA 构造
+    void beginLocals(const std::vector<std::string>& names);
+    void declareLocal(int slot, llvm::Value* value);
+    llvm::Value* readVariable(const BoundName& ref, const std::string& name);
+    void writeVariable(const BoundName& ref, const std::string& name, llvm::Value* value);
+    llvm::Value* readLocal(int slot, llvm::BasicBlock* block);
+    llvm::Value* readLocalRecursive(int slot, llvm::BasicBlock* block);
+    void writeLocal(int slot, llvm::Value* value);
+    llvm::PHINode* createPhi(int slot, llvm::BasicBlock* block);
+    llvm::Value* addPhiOperands(int slot, llvm::PHINode* phi);
+    llvm::Value* tryRemoveTrivialPhi(llvm::PHINode* phi);
+    void sealBlock(llvm::BasicBlock* block);
+    void sealAllBlocks();
+    
+    // 抢占检查点
+    void emitEntryBudgetCheck(bool cacheCounter);
+    void emitBudgetCheck();
+    void emitBudgetSave();
+    void emitBudgetReload();
+    
+    // 分配分析
+    void emitAllocationSite(int32_t kind);
+    void endAllocationSite();
+    llvm::Value* createHeapAllocation(uint64_t size, const std::string& name);
+    
+    // 调试信息
+    void initDebugInfo();
+    void beginDebugFunction(llvm::Function* function, const std::string& name, int line);
+    
+    // 字符串与表
+    struct ConstantField {
+        uint64_t hash;
+        llvm::Constant* key;
+        llvm::Constant* value;
+    };
+    std::map<std::string, llvm::Constant*> strings;
+    llvm::Constant* getStringConstant(const std::string& value);
+    llvm::Constant* getConstantKey(Expr* expr, std::string& identity, uint64_t& hash);
+    llvm::Constant* getConstantValue(Expr* expr);
+    llvm::Value* emitConstantTable(const std::vector<ConstantField>& fields);
+    
+    // 参数和返回值都是装箱的值的内置函数（table.*、setmetatable 等）
+    void emitBuiltinCall(CallExpr* node, const std::string& runtimeName);
+    void emitParallelCall(CallExpr* node);
+    
+    // 算术运算的慢速路径（字符串转换和元方法）
+    llvm::Value* emitArith(int32_t event, llvm::Value* left, llvm::Value* right, llvm::Value* result);
+    
+    // 条件：比较运算和 and/or/not 作为条件时直接生成条件跳转，只有作为值使用时才物化
+    void emitBranch(Expr* condition, llvm::BasicBlock* trueBB, llvm::BasicBlock* falseBB);
+    void emitCompareBranch(BinaryOp op, llvm::Value* left, llvm::Value* right,
+                           llvm::BasicBlock* trueBB, llvm::BasicBlock* falseBB);
+    llvm::Value* emitTruth(llvm::Value* value);
+    bool isComparison(BinaryOp op) const;
+    bool isCondition(Expr* expr) const;
+    llvm::Value* emitCondition(Expr* condition);
+    llvm::Value* emitLogical(BinaryExpr* node);
+    
+    // 函数作为值
+    llvm::Value* getFunctionValue(const std::string& name);
+    void emitFunctionValue(const std::string& name);
+    
+    // 错误处理：pcall 用 invoke/landingpad（Itanium ABI 的表驱动展开），正常路径没有额外开销
+    void emitProtectedCall(CallExpr* node);
+    void emitEntry(llvm::Function* chunk);
+    llvm::BasicBlock* createUncaughtHandler();
+    llvm::Function* getPersonality();
+    llvm::Constant* getErrorTypeInfo();
+    
+    // 协程
+    void generateCoroutine(FunctionDecl* node);
+    void emitCoroutineCall(CallExpr* node);
+    void emitCoroutineSuspend(bool final, llvm::BasicBlock* resumeBB);
+    void emitCoroutineReturn(llvm::Value* value);
+    llvm::StructType* getCoroutineType();
+    llvm::Value* getCoroutineField(llvm::Value* co, unsigned field, unsigned index = 0);
+    void lowerCoroutines();
+
+    // 共享库的目标机器和导出表
+    void initTargetMachine();
+    void emitModuleInfo();
+    llvm::Function* createExportWrapper(FunctionDecl* decl);
+    
+    // 运行时 bitcode 链接与优化
+    void linkRuntime();
+    void optimizeModule();
+    
+    // NaN-boxing 辅助
+    llvm::Value* boxPointer(llvm::Value* ptr, uint64_t tag);
+    llvm::Value* unboxPointer(llvm::Value* value);
+    llvm::Value* hasTag(llvm::Value* value, uint64_t tag);
 
     // 添加辅助方法声明
     void initBuiltins();
+    void emitPrint(const std::vector<llvm::Value*>& args);
 
     // 实现所有 Visitor 接口方法
     void visit(BlockStmt* node) override;
@@ -49,4 +278,8 @@ private:
     void visit(CallExpr* node) override;
     void visit(PrintExpr* node) override;
     void visit(LocalVarDecl* node) override;
+    void visit(AssignStmt* node) override;
+    void visit(IndexExpr* node) override;
+    void visit(TableExpr* node) override;
+    void visit(IndexAssignStmt* node) override;
 }; 
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "AST.h"
+#include "Closure.h"
+
+// 表的逃逸分析与标量替换：在闭包分析之后、生成代码之前执行
+//
+// 以表构造器初始化的本地变量 local t = @{...}，如果构造器的键都是字面量、没有 @name，
+// 而 t 只以字面量键读写字段（t.x、t[1]、t.x = v），没有作为值使用、重新赋值或被闭包捕获，
+// 这个表就不会逃出声明它的函数。它的每个字段替换为一个本地变量槽（追加在所属函数的槽之后，
+// 名字是 t.x、t[1]），生成代码时和其他本地变量一样直接构造 SSA，不分配表。
+// 没有元表（setmetatable 需要把 t 作为值传出），所以字段读写就是原始读写，没写过的字段为 nil。
+class TableEscapeAnalysis : public Visitor {
+public:
+    void run(BlockStmt* root, ClosureAnalysis& closures);
+
+    // 标量替换的表的全部字段槽，其他声明返回 nullptr
+    const std::vector<int>* getFields(LocalVarDecl* decl) const;
+    // 字段读写（IndexExpr）或构造器字段的键对应的槽，不是标量替换的返回 -1
+    int getFieldSlot(Expr* node) const;
+
+private:
+    // 以字面量键访问本地表变量的位置
+    struct Access {
+        int table;
+        std::string key;
+        std::string label;
+        Expr* node;
+    };
+
+    std::map<int, LocalVarDecl*> candidates;
+    std::set<int> escaped;
+    std::vector<Access> accesses;
+
+    std::map<LocalVarDecl*, std::vector<int>> tables;
+    std::map<Expr*, int> fieldSlots;
+
+    void analyze(const std::vector<std::unique_ptr<Stmt>>& statements,
+                 std::vector<std::string>& functionSlots, const FunctionInfo* info);
+    static bool getKey(Expr* expr, std::string& identity, std::string& label);
+    static bool isCandidate(LocalVarDecl* decl);
+
+    void visit(BlockStmt* node) override;
+    void visit(FunctionDecl* node) override;
+    void visit(ReturnStmt* node) override;
+    void visit(IfStmt* node) override;
+    void visit(WhileStmt* node) override;
+    void visit(RepeatStmt* node) override;
+    void visit(ExprStmt* node) override;
+    void visit(BinaryExpr* node) override;
+    void visit(UnaryExpr* node) override;
+    void visit(NumberExpr* node) override;
+    void visit(StringExpr* node) override;
+    void visit(NilExpr* node) override;
+    void visit(VarExpr* node) override;
+    void visit(CallExpr* node) override;
+    void visit(PrintExpr* node) override;
+    void visit(LocalVarDecl* node) override;
+    void visit(AssignStmt* node) override;
+    void visit(IndexExpr* node) override;
+    void visit(TableExpr* node) override;
+    void visit(IndexAssignStmt* node) override;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "AST.h"
+#include "CodeGen.h"
+
+// 创建执行 Lua 代码的 LLJIT：宿主进程导出的运行时函数可见，生成的代码总是登记到
+// GDB 的 JIT 接口，perfEvents 为 true 时还向 perf 登记
+std::unique_ptr<llvm::orc::LLJIT> createLuaJIT(bool perfEvents);
+
+// 长期存在的 JIT 会话，用于 REPL 和运行中加载补丁
+//
+// 每个 chunk 编译成独立的模块，放进自己的 JITDylib；查找顺序是本 chunk、
+// 从新到旧的之前各 chunk、最后是宿主进程（运行时库）。之前 chunk 定义的
+// 函数和全局变量按符号解析而不重新编译；重新定义的函数只对之后的 chunk 可见。
+class JITSession {
+public:
+    // debugInfo 为 true 时生成 DWARF 调试信息并向 perf 登记 JIT 代码，
+    // 生成的代码总是登记到 GDB 的 JIT 接口
+    explicit JITSession(unsigned optLevel = 0, bool debugInfo = false);
+    ~JITSession();
+
+    // 之后编译的 chunk 是否以抢占模式生成（见 CodeGenerator::setPreemption）
+    void setPreemption(bool enabled) { preemption = enabled; }
+    // 之后编译的 chunk 是否登记分配点（见 CodeGenerator::enableAllocationProfiling）
+    void setAllocationProfiling(bool enabled) { allocationProfiling = enabled; }
+
+    // 编译并执行一个 chunk，返回 chunk 入口函数的返回值；sourceName 写入调试信息
+    int runChunk(BlockStmt* root, const std::string& sourceName = "stdin");
+    int runFile(const std::string& path);
+    int runString(const std::string& source);
+
+private:
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    std::vector<llvm::orc::JITDylib*> chunks;
+    ChunkSymbols symbols;
+    unsigned optLevel;
+    bool debugInfo;
+    bool preemption = false;
+    bool allocationProfiling = false;
+
+    int runSource(std::string_view source, const std::string& sourceName);
+};
@@ -1,36 +1,57 @@
 #pragma once
 #include "Token.h"
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <map>
 
+// 只读映射到内存的源文件，Token 中的切片直接指向这块内存
+class SourceFile {
+public:
+    explicit SourceFile(const std::string& path);
+    ~SourceFile();
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    std::string_view text() const { return std::string_view(data, size); }
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+// 手写的零拷贝词法分析器：token 是源码的 string_view 切片，
+// 关键字用完美哈希查找，空白、注释和字符串内容用 SIMD 扫描
 class Lexer {
 private:
-    std::string source;
-    size_t currentPos = 0;
-    size_t startPos = 0;
-    size_t line = 1;
-    size_t column = 1;
-    char current = '\0';
-    
-    static std::map<std::string, TokenType> keywords;
-    void initKeywords();
-    void skipComment();
-    
-    bool isAtEnd() const;
-    char advance();
-    char peek() const;
-    bool match(char expected);
+    const char* end;            // 源码结尾（不要求以 '\0' 结尾）
+    const char* current;        // 当前扫描位置
+    const char* lineStart;      // 当前行的起始位置，用于计算列号
+    uint32_t line = 1;
+
     void skipWhitespace();
-    Token number();
-    Token identifier();
-    Token string();
-    Token makeToken(TokenType type) const;
-    Token makeToken(TokenType type, const std::string& value) const;
-    Token errorToken(const std::string& message) const;
+    void skipComment();
+
+    bool isAtEnd() const { return current >= end; }
+    char peek(size_t offset = 0) const;
+    Token number(const char* tokenStart);
+    Token identifier(const char* tokenStart);
+    Token string(const char* tokenStart);
+    Token makeToken(TokenType type, const char* tokenStart, size_t length, double value = 0) const;
+    Token errorToken(const char* tokenStart, const char* message) const;
 
 public:
-    explicit Lexer(const std::string& source);
+    explicit Lexer(std::string_view source);
     std::vector<Token> scanTokens();
     Token getNextToken();
-}; 
\ No newline at end of file
+};
+
+// 供 bison 生成的 yyparse 使用：设置要分析的源码，源码必须在 yyparse 返回前保持有效
+void setParserInput(std::string_view source);
+
+class BlockStmt;
+
+// 解析一段源码，失败时抛出 std::runtime_error。yyparse 使用全局状态，
+// 所有解析都经过这里并持有同一个互斥锁；AST 中的切片指向 source
+std::unique_ptr<BlockStmt> parseSource(std::string_view source);
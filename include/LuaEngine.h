@@ -0,0 +1,82 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include "Runtime.h"
+
+// 嵌入 API：LuaEngine 把脚本编译一次，得到不可变的 LuaScript；每个 LuaState 持有
+// 一次执行的全局变量和堆，多个 LuaState 可以在不同线程上同时执行同一个 LuaScript，
+// 执行过程中不加锁。
+//
+//     LuaEngine engine;
+//     std::shared_ptr<const LuaScript> script = engine.compileFile("handler.lua");
+//     // 每个请求（可以在任意线程上）：
+//     LuaState state(script);
+//     state.setGlobal("n", 42);
+//     if (state.run() == LUA_STATE_ERROR) { /* state.error() 是错误值 */ }
+//     double result = state.getGlobal("result");
+
+// LuaState::run 的返回值：脚本抛出了没有被捕获的错误
+constexpr int LUA_STATE_ERROR = -1;
+
+// 编译后的脚本：代码以可重入模式生成，全局变量按下标存放在 LuaState 的槽数组中
+class LuaScript {
+public:
+    // 脚本中全局变量的槽下标，不存在时返回 -1
+    int globalSlot(const std::string& name) const;
+    size_t slotCount() const { return slots.size(); }
+
+private:
+    friend class LuaEngine;
+    friend class LuaState;
+
+    std::shared_ptr<llvm::orc::LLJIT> jit;      // 保证代码在脚本销毁前一直有效
+    int (*entry)() = nullptr;
+    std::map<std::string, unsigned> slots;      // global.<name> 和 <function>.env
+};
+
+class LuaEngine {
+public:
+    explicit LuaEngine(unsigned optLevel = 2);
+    ~LuaEngine();
+
+    // 编译失败时抛出 std::runtime_error；可以从多个线程调用
+    std::shared_ptr<const LuaScript> compileFile(const std::string& path);
+    std::shared_ptr<const LuaScript> compileString(std::string_view source);
+
+private:
+    std::shared_ptr<llvm::orc::LLJIT> jit;
+    unsigned optLevel;
+    std::mutex mutex;
+    size_t scripts = 0;
+};
+
+// 一次执行的状态。同一个 LuaState 同一时刻只能在一个线程上执行；
+// 脚本创建的表属于 LuaState 的堆，LuaState 销毁后不能再访问
+class LuaState {
+public:
+    explicit LuaState(std::shared_ptr<const LuaScript> script);
+    ~LuaState();
+
+    LuaState(const LuaState&) = delete;
+    LuaState& operator=(const LuaState&) = delete;
+
+    // 在当前线程上执行脚本的顶层代码，返回入口函数的返回值；没有被 pcall 捕获的错误
+    // 返回 LUA_STATE_ERROR，错误值由 error() 读出
+    int run();
+    double error() const { return lastError; }
+
+    // 读写全局变量（NaN-boxing 编码的值，见 Runtime.h），脚本中没有的变量读出 nil
+    double getGlobal(const std::string& name) const;
+    void setGlobal(const std::string& name, double value);
+
+private:
+    std::shared_ptr<const LuaScript> script;
+    std::unique_ptr<uint64_t[]> slots;
+    LuaExecution execution;
+    double lastError = 0;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// luac --shared 生成的共享库的稳定 C 接口。共享库只导出 lua_module 一个符号，
+// 宿主程序 dlopen 之后用 dlsym(handle, LUA_MODULE_SYMBOL) 取得导出表；
+// 共享库依赖 libluaruntime.so，运行时的状态（输出缓冲区等）在进程内只有一份
+#define LUA_MODULE_ABI_VERSION 1
+#define LUA_MODULE_SYMBOL "lua_module"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 参数和返回值都是 NaN-boxing 编码的 double（见 Runtime.h）。results 为 1 时
+// 签名是 double f(double, ...)，为 2 时是 LuaResultPair f(double, ...)
+typedef struct LuaExportedFunction {
+    const char* name;
+    void* address;
+    uint32_t params;
+    uint32_t results;
+} LuaExportedFunction;
+
+typedef struct LuaResultPair {
+    double first;
+    double second;
+} LuaResultPair;
+
+typedef struct LuaModuleInfo {
+    uint32_t abiVersion;
+    uint32_t functionCount;
+    const LuaExportedFunction* functions;   // 顶层函数，闭包不导出
+    int (*main)(void);                      // 执行 chunk 的顶层代码
+} LuaModuleInfo;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "AST.h"
+
+// AST 优化：在语法分析之后、闭包分析和生成代码之前执行，缩小交给 LLVM 的树
+//
+// - 常量折叠：数值的四则运算和取负，字符串连接（数值按 print 的格式转换），
+//   比较运算，左操作数是常量的 and/or 和操作数是常量的 not
+// - 死代码消除：return 之后的语句、条件为常量的 if 的另一个分支、条件为假的 while、
+//   条件为真的 repeat 只保留一次循环体、值为常量的表达式语句
+// - 纯函数求值：只读写自己的参数和局部变量、只调用纯函数的函数，以常量实参调用时
+//   在编译期解释执行，调用替换为返回值（多返回值函数的调用保持原样）
+//
+// 只折叠生成的代码有确定结果的情形：nil 或字符串参与算术运算、数值与字符串比较大小等保持原样。
+// 函数声明会被提升，包含函数声明的死代码不删除。
+class ASTOptimizer : public Visitor {
+public:
+    void run(BlockStmt* root);
+
+    // run 之后：name 是纯函数（parallel.map/parallel.for 只接受纯函数）
+    bool isPure(const std::string& name) const { return pureFunctions.count(name) > 0; }
+
+private:
+    // 编译期常量
+    struct Constant {
+        enum Kind { NIL, NUMBER, STRING } kind = NIL;
+        double number = 0;
+        std::string string;
+    };
+
+    // 解释执行纯函数时的局部变量，每层块一个作用域
+    using Scopes = std::vector<std::map<std::string, Constant>>;
+    enum class Flow { NORMAL, RETURN, FAIL };
+
+    // 编译期求值的步数和调用深度上限，超过时放弃折叠
+    static constexpr int MAX_STEPS = 100000;
+    static constexpr int MAX_DEPTH = 200;
+
+    std::map<std::string, std::vector<FunctionDecl*>> functions;
+    std::set<std::string> pureFunctions;
+    bool evaluateCalls = false;
+    int steps = 0;
+
+    // 访问表达式后要替换它的节点；访问语句后要替换或删除它
+    std::unique_ptr<Expr> replacement;
+    std::unique_ptr<Stmt> stmtReplacement;
+    bool removeStmt = false;
+
+    void foldExpr(std::unique_ptr<Expr>& expr);
+    void foldStmt(std::unique_ptr<Stmt>& stmt);
+    void foldStatements(std::vector<std::unique_ptr<Stmt>>& statements);
+
+    static bool toConstant(Expr* expr, Constant& value);
+    static std::unique_ptr<Expr> makeExpr(const Constant& value);
+    static bool toTruth(const Constant& value, bool& truth);
+    static bool isConstantCondition(Expr* expr, bool& truth);
+    static bool alwaysReturns(Stmt* stmt);
+    static bool containsFunction(Stmt* stmt);
+    static bool hasMultipleReturns(FunctionDecl* decl);
+    static bool applyBinary(BinaryOp op, const Constant& left, const Constant& right, Constant& result);
+    static bool isComparison(BinaryOp op);
+    static Constant makeBoolean(bool value);
+    static bool compare(BinaryOp op, const Constant& left, const Constant& right, Constant& result);
+
+    // 纯函数分析
+    void collectFunctions(const std::vector<std::unique_ptr<Stmt>>& statements);
+    void findPureFunctions();
+    bool isPureStmt(Stmt* stmt, std::vector<std::set<std::string>>& scopes, std::set<std::string>& callees);
+    bool isPureExpr(Expr* expr, const std::vector<std::set<std::string>>& scopes, std::set<std::string>& callees);
+
+    // 编译期解释器
+    bool call(const std::string& name, CallExpr* site, Scopes& scopes, std::vector<Constant>& results, int depth);
+    Flow execute(Stmt* stmt, Scopes& scopes, std::vector<Constant>& results, int depth);
+    bool evaluate(Expr* expr, Scopes& scopes, std::vector<Constant>& values, int depth);
+    bool evaluateValue(Expr* expr, Scopes& scopes, Constant& value, int depth);
+
+    void visit(BlockStmt* node) override;
+    void visit(FunctionDecl* node) override;
+    void visit(ReturnStmt* node) override;
+    void visit(IfStmt* node) override;
+    void visit(WhileStmt* node) override;
+    void visit(RepeatStmt* node) override;
+    void visit(ExprStmt* node) override;
+    void visit(BinaryExpr* node) override;
+    void visit(UnaryExpr* node) override;
+    void visit(NumberExpr* node) override;
+    void visit(StringExpr* node) override;
+    void visit(NilExpr* node) override;
+    void visit(VarExpr* node) override;
+    void visit(CallExpr* node) override;
+    void visit(PrintExpr* node) override;
+    void visit(LocalVarDecl* node) override;
+    void visit(AssignStmt* node) override;
+    void visit(IndexExpr* node) override;
+    void visit(TableExpr* node) override;
+    void visit(IndexAssignStmt* node) override;
+};
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+
+// 运行时库：生成的代码通过这里声明的 C 接口调用
+
+// 值表示：所有 Lua 值都是 double，非数值对象用 NaN-boxing 编码。
+// 高 16 位是类型标签，低 48 位是对象指针；0xFFF9 以上的 NaN 不会由算术运算产生。
+#define LUA_TAG_SHIFT 48
+#define LUA_PAYLOAD_MASK 0x0000FFFFFFFFFFFFULL
+#define LUA_TAG_STRING 0xFFF9ULL          // 以 '\0' 结尾的 const char*
+#define LUA_TAG_TABLE 0xFFFAULL           // LuaTable*
+#define LUA_TAG_FUNCTION 0xFFFBULL        // LuaFunction，见下
+#define LUA_TAG_COROUTINE 0xFFFCULL
+
+// 协程：协程体被编译成 LLVM 协程（switched-resume），挂起时只保留跨挂起点存活的状态。
+// LuaCoroutine 和协程帧都从 lua_alloc 分配。协程体返回或抛出错误后 coroutine.resume 把协程
+// 置为 dead 并销毁协程帧；挂起后不再恢复的协程的帧随 LuaState 的堆一起释放
+#define LUA_COROUTINE_TRANSFER 8
+
+enum LuaCoroutineStatus {
+    LUA_COROUTINE_SUSPENDED = 0,
+    LUA_COROUTINE_RUNNING = 1,
+    LUA_COROUTINE_DEAD = 2
+};
+
+struct LuaCoroutine {
+    void* handle;                               // llvm.coro.begin 返回的协程帧
+    int32_t status;
+    double transfer[LUA_COROUTINE_TRANSFER];    // resume 的参数，yield/return 的值
+};
+
+// 表：数组部分和开放寻址（线性探测）的哈希部分。
+// 数组部分按下标连续存放键 1..arraySize 的值（未装箱的 double），在末尾追加时把哈希部分中
+// 紧接着的键移过来；其余的键在哈希部分中，容量是 2 的幂，负载不超过 3/4。
+// 常量构造器的 entries 直接指向编译期按同样的哈希函数布局好的只读数据，
+// 第一次写入时才复制（写时复制）
+#define LUA_EMPTY_KEY 0xFFFF000000000000ULL     // 空槽的键，不会由运算或装箱产生
+#define LUA_DELETED_KEY 0xFFFE000000000000ULL   // 墓碑：键已移入数组部分，扩容时丢弃
+
+struct LuaTableEntry {
+    double key;
+    double value;
+};
+
+struct LuaTable {
+    LuaTableEntry* entries;
+    uint32_t capacity;
+    uint32_t count;         // 已占用的槽，包括值为 nil 的键和墓碑
+    uint32_t shared;        // entries 指向只读的常量数据
+    uint32_t flags;         // 作为元表时：第 e 位为 1 表示确定没有事件 e 的元方法
+    uint32_t arraySize;     // 数组部分的长度，元素可以是 0（与 nil 的编码相同）
+    uint32_t arrayCapacity;
+    double* array;
+    LuaTable* metatable;
+};
+
+// 元方法事件，也是 LuaTable::flags 中的位号。setmetatable 时探测元表的全部事件，
+// 之后写入以 "__" 开头的键时清零，查找不到时再置位；快速路径只需检查一位
+enum LuaEvent {
+    LUA_EVENT_INDEX = 0,
+    LUA_EVENT_NEWINDEX,
+    LUA_EVENT_ADD,
+    LUA_EVENT_SUB,
+    LUA_EVENT_MUL,
+    LUA_EVENT_DIV,
+    LUA_EVENT_UNM,
+    LUA_EVENT_CONCAT,
+    LUA_EVENT_EQ,
+    LUA_EVENT_LT,
+    LUA_EVENT_LE,
+    LUA_EVENT_COUNT
+};
+
+// 作为值使用的 Lua 函数（例如元方法）：按 C 调用约定、固定三个参数的包装函数，
+// 多余的参数为 nil，只返回第一个返回值
+typedef double (*LuaFunction)(double, double, double);
+
+// 键的哈希：编译器布局常量表时使用同一组函数，必须与运行时保持一致
+inline uint64_t lua_hash_bits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xFF51AFD7ED558CCDULL;
+    bits ^= bits >> 33;
+    return bits;
+}
+
+inline uint64_t lua_hash_string(const char* s) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (; *s; ++s) {
+        hash = (hash ^ static_cast<unsigned char>(*s)) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// 哈希部分的最大容量（2 的幂）；超过它的 count 不再扩大，避免截断成 0
+#define LUA_TABLE_MAX_CAPACITY 0x80000000U
+// @(n) 预留的数组部分不超过这么多个元素，更大的表在写入时按需增长
+#define LUA_TABLE_MAX_HINT 0x1000000U
+
+inline uint32_t lua_table_capacity(uint32_t count) {
+    uint64_t capacity = 4;
+    while (capacity < LUA_TABLE_MAX_CAPACITY && capacity * 3 < static_cast<uint64_t>(count) * 4) {
+        capacity *= 2;
+    }
+    return static_cast<uint32_t>(capacity);
+}
+
+// 数值转字符串（print 和 .. 使用，编译期折叠字符串连接时也用它）：与 Lua 的 "%.14g" 一致，
+// 绝对值小于 1e14 的整数值（最多 14 位有效数字，"%.14g" 不会改用指数形式）走不经过浮点格式化的
+// 快速路径。out 至少要有 LUA_NUMBER_BUFFER 个字节，返回写入的结尾
+#define LUA_NUMBER_BUFFER 32
+
+inline char* lua_format_number(char* out, double value) {
+    bool negativeZero = value == 0 && std::signbit(value);
+    if (value > -1e14 && value < 1e14 && value == std::floor(value) && !negativeZero) {
+        int64_t integer = static_cast<int64_t>(value);
+        char digits[20];
+        uint64_t magnitude = integer < 0 ? 0 - static_cast<uint64_t>(integer) : static_cast<uint64_t>(integer);
+        int count = 0;
+        do {
+            digits[count++] = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude);
+        if (integer < 0) {
+            *out++ = '-';
+        }
+        while (count) {
+            *out++ = digits[--count];
+        }
+        return out;
+    }
+    return std::to_chars(out, out + LUA_NUMBER_BUFFER, value, std::chars_format::general, 14).ptr;
+}
+
+// 协作式抢占：以抢占模式编译的代码在函数入口和循环回边把当前线程的预算减一，
+// 减到负数时调用 lua_preempt，由它装满预算并调用嵌入方设置的调度函数
+#define LUA_DEFAULT_BUDGET (1LL << 20)
+
+// 嵌入 API（LuaState）的一次执行：可重入代码的全局变量槽和脚本的堆。
+// 执行期间挂在当前线程上，堆在 LuaState 销毁时整体释放
+struct LuaHeap;
+
+struct LuaExecution {
+    uint64_t* slots;
+    LuaHeap* heap;
+};
+
+typedef void (*LuaPreemptHandler)(void* data);
+
+// 分配分析（luac -profile-alloc）：生成的代码在每个分配点（表构造、字符串连接、表写入引起的扩容、
+// 闭包创建、内置函数）之前调用 lua_profile_site 登记当前分配点，lua_alloc 按字节数抽样，
+// 按分配点统计分配量和仍然存活的字节数，退出时或收到 SIGUSR2 后输出报告
+enum LuaAllocKind {
+    LUA_ALLOC_TABLE = 0,
+    LUA_ALLOC_CONCAT,
+    LUA_ALLOC_SETINDEX,
+    LUA_ALLOC_CLOSURE,
+    LUA_ALLOC_BUILTIN
+};
+
+// 每个分配点一个只读的描述，地址就是分配点的标识
+struct LuaAllocSite {
+    const char* source;
+    int32_t line;
+    int32_t kind;
+};
+
+// error 和运行时错误抛出的 C++ 异常。生成的代码按 Itanium ABI 的表驱动展开处理它：
+// pcall 的调用点是 invoke，landingpad 按类型信息 _ZTI8LuaError 捕获
+struct LuaError {
+    double value;
+};
+
+extern "C" {
+
+// 输出：print 的每个参数调用一次，terminator 为 '\t'（后面还有参数）或 '\n'
+void lua_print_value(double value, int terminator);
+void lua_print_string(const char* value, int terminator);
+void lua_print_newline();
+void lua_flush();
+
+LuaCoroutine* lua_coroutine_new();
+[[noreturn]] void lua_coroutine_yield_outside();
+
+// 表
+LuaTable* lua_table_new(uint32_t sizeHint);
+// @(n)：n 必须是非负整数（nil 视为 0），为数组部分预留 min(n, LUA_TABLE_MAX_HINT) 个元素
+LuaTable* lua_table_sized(double size);
+LuaTable* lua_table_constant(const LuaTableEntry* entries, uint32_t capacity, uint32_t count);
+double lua_table_get(LuaTable* table, double key);
+void lua_table_set(LuaTable* table, double key, double value);
+// 把哈希部分中从 arraySize + 1 开始连续的键移入数组部分，返回数组部分的长度
+uint32_t lua_table_dense(LuaTable* table);
+// 保证数组部分可以放下 size 个元素
+void lua_table_reserve(LuaTable* table, uint32_t size);
+// 宿主释放不属于 LuaState 堆的表（运行时没有垃圾回收）
+void lua_table_free(LuaTable* table);
+
+// t[k] 和 t[k] = v：检查 t 是不是表，原始值为 nil 时才查看元表的 __index/__newindex
+double lua_index(double table, double key);
+void lua_setindex(double table, double key, double value);
+
+// 元表：lua_arith 是算术运算的慢速路径（数值运算的结果是 NaN 时才调用），
+// 处理字符串转换成数值和 __add 等元方法，一元负号的两个操作数相同
+double lua_setmetatable(double table, double metatable);
+double lua_getmetatable(double table);
+double lua_arith(int32_t event, double left, double right);
+// 比较运算的慢速路径（有一个操作数不是数值时才调用）：event 为 EQ/LT/LE，a > b 按 b < a 计算。
+// 字符串按内容比较，表先按同一性比较、再查找 __eq/__lt/__le 元方法，返回 1 或 0
+int32_t lua_compare(int32_t event, double left, double right);
+double lua_metamethod(double value, int32_t event);
+double lua_call_value(double function, double a, double b, double c);
+double lua_index_slow(LuaTable* table, double key);
+void lua_setindex_slow(LuaTable* table, double key, double value);
+
+// 数组部分上的向量操作（table.sum/min/max/dot/scale/fill/copy/sort）：
+// 参数是装箱的表，只处理键 1..n（n 为数组部分的长度），元素必须都是数值（sort 也接受全部是字符串）
+double lua_array_sum(double table);
+double lua_array_min(double table);
+double lua_array_max(double table);
+double lua_array_dot(double left, double right);
+double lua_array_scale(double table, double factor);
+double lua_array_fill(double table, double value, double count);
+double lua_array_copy(double table);
+double lua_array_sort(double table);
+
+// parallel.map(f, t) 和 parallel.for(f, first, last)：在线程池上并行计算 f(t[i]) 和
+// f(first), ..., f(last)，返回结果数组。f 是装箱的函数值，由编译器保证是纯函数；
+// t 的元素必须都是数值或字符串。f 抛出的错误在调用者线程上重新抛出
+double lua_parallel_map(double function, double table);
+double lua_parallel_for(double function, double first, double last);
+
+// a .. b：字符串和数值转成字符串后连接，结果从 lua_alloc 分配
+double lua_concat(double left, double right);
+
+// 预算：lua_budget_counter 返回当前线程的计数器。生成的代码在函数入口把它读到局部变量中，
+// 调用其他 Lua 函数前后和返回前与计数器同步，因此可以留在寄存器中；lua_preempt 装满
+// 当前线程的计数器并返回新的预算
+int64_t* lua_budget_counter();
+int64_t lua_preempt();
+void lua_set_budget(int64_t quantum);
+void lua_set_preempt_handler(LuaPreemptHandler handler, void* data);
+// lua_defer_preempt(1)/(0) 成对调用：期间 lua_preempt 只装满预算，不调用调度函数
+// （parallel 在调用者线程上持有线程池时不能切换到其他脚本）
+void lua_defer_preempt(int defer);
+
+// 执行状态：lua_set_execution 返回之前挂在当前线程上的执行（可以为空）。
+// lua_heap_share 非零时堆的分配加锁，parallel 的工作线程借用调用者的执行状态分配
+LuaExecution* lua_set_execution(LuaExecution* execution);
+LuaExecution* lua_get_execution();
+uint64_t* lua_state_slots();
+LuaHeap* lua_heap_new();
+void lua_heap_delete(LuaHeap* heap);
+void lua_heap_share(LuaHeap* heap, int shared);
+
+// 内存：有执行状态时从它的堆中分配，否则使用 malloc，按 8 字节对齐。lua_free 只接受
+// lua_alloc 返回的指针，只归还 malloc 分配的内存，堆中的内存在堆释放时整体归还
+void* lua_alloc(size_t size);
+void lua_free(void* memory);
+
+// 分配分析：lua_profile_start 注册退出时的报告和 SIGUSR2（可以重复调用）。
+// lua_profiling 非零时 lua_alloc/lua_free/lua_heap_delete 通知分析器。
+// 它可能在其他线程（LuaState、parallel 的工作线程）分配时被打开，所以是原子变量
+extern std::atomic<int> lua_profiling;
+void lua_profile_start();
+void lua_profile_site(const LuaAllocSite* site);
+void lua_profile_alloc(void* memory, size_t size, LuaHeap* heap);
+void lua_profile_free(void* memory);
+void lua_profile_release(LuaHeap* heap);
+void lua_profile_report();
+
+// 错误：lua_error 抛出 LuaError，运行时错误的值是 message 字符串。
+// lua_catch_error 在 landingpad 中结束捕获并返回错误值；没有被 pcall 捕获的错误
+// 由 lua_uncaught_error 刷新输出后报告并终止程序
+[[noreturn]] void lua_error(double value);
+[[noreturn]] void lua_runtime_error(const char* message);
+double lua_catch_error(void* exception);
+[[noreturn]] void lua_uncaught_error(void* exception);
+
+}
@@ -1,7 +1,10 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 enum class TokenType {
     TOKEN_EOF = 0,
@@ -35,7 +38,7 @@ enum class TokenType {
     TOKEN_COMMA,
     TOKEN_AND,
     TOKEN_OR,
-    TOKEN_EQ,
+    TOKEN_EQ,     // 等于 '=='
     TOKEN_DOT,    // 点操作符 '.'
     TOKEN_NE,     // 不等于 '~='
     TOKEN_LE,     // 小于等于 '<='
@@ -48,31 +51,48 @@ enum class TokenType {
     TOKEN_FOR,    // for
     TOKEN_IN,     // in
     TOKEN_LBRACE, // {
-    TOKEN_RBRACE  // }
+    TOKEN_RBRACE, // }
+    TOKEN_LBRACKET, // [
+    TOKEN_RBRACKET, // ]
+    TOKEN_MOD,    // %
+    TOKEN_POW,    // ^
+    TOKEN_CONCAT, // ..
+    TOKEN_AT      // @ 表构造器
 };
 
+// bison 语义值中的 token 文本：指向源码缓冲区的切片，不拷贝也不需要释放
+struct TokenText {
+    const char* data;
+    size_t length;
+
+    std::string str() const { return std::string(data, length); }
+};
+
+// 词法单元：value 是源码缓冲区中的切片（字符串不含引号），源码必须比 Token 活得久
 class Token {
 private:
     TokenType type;
-    std::string value;
-    int line;
-    int column;
+    std::string_view value;
+    double number;
+    uint32_t line;
+    uint32_t column;
     
 public:
     // 默认构造函数
-    Token() : type(TokenType::TOKEN_EOF), value(""), line(1), column(1) {}
+    Token() : type(TokenType::TOKEN_EOF), number(0), line(1), column(1) {}
     
     // 只有类型的构造函数
-    Token(TokenType t) : type(t), value(""), line(1), column(1) {}
+    Token(TokenType t) : type(t), number(0), line(1), column(1) {}
     
     // 完整的构造函数
-    Token(TokenType type, const std::string& value, int line, int column)
-        : type(type), value(value), line(line), column(column) {}
+    Token(TokenType type, std::string_view value, uint32_t line, uint32_t column, double number = 0)
+        : type(type), value(value), number(number), line(line), column(column) {}
     
     TokenType getType() const { return type; }
-    const std::string& getValue() const { return value; }
-    int getLine() const { return line; }
-    int getColumn() const { return column; }
+    std::string_view getValue() const { return value; }
+    double getNumber() const { return number; }
+    uint32_t getLine() const { return line; }
+    uint32_t getColumn() const { return column; }
 };
 
 #endif // TOKEN_H 
\ No newline at end of file
@@ -17,6 +17,10 @@ class VarExpr;
 class CallExpr;
 class PrintExpr;
 class LocalVarDecl;
+class AssignStmt;
+class IndexExpr;
+class TableExpr;
+class IndexAssignStmt;
 
 // 访问者基类
 class Visitor {
@@ -40,4 +44,8 @@ public:
     virtual void visit(CallExpr* node) = 0;
     virtual void visit(PrintExpr* node) = 0;
     virtual void visit(LocalVarDecl* node) = 0;
+    virtual void visit(AssignStmt* node) = 0;
+    virtual void visit(IndexExpr* node) = 0;
+    virtual void visit(TableExpr* node) = 0;
+    virtual void visit(IndexAssignStmt* node) = 0;
 }; 
\ No newline at end of file
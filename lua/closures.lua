@@ -0,0 +1,55 @@
+-- 顶层函数捕获顶层局部变量：读到的是变量的当前值，写入对顶层代码可见；
+-- 声明语句执行之前调用闭包是运行时错误；同名的遮蔽变量各有自己的单元
+
+local x = 5
+function show()
+  print(x)
+end
+show()
+x = 7
+show()
+
+local count = 0
+function bump(n)
+  count = count + n
+  return count
+end
+bump(2)
+bump(3)
+print(count)
+
+function outer()
+  local a = 1
+  function inner()
+    a = a + 1
+    return a
+  end
+  return inner
+end
+outer()
+print(inner())
+print(inner())
+
+print(pcall(late))
+local y = 9
+function late()
+  return y
+end
+print(late())
+
+local t = @{a = 1}
+function readt()
+  return t.a
+end
+t.a = 42
+print(readt())
+
+local z = 1
+function first()
+  return z
+end
+local z = 2
+function second()
+  return z
+end
+print(first(), second())
@@ -0,0 +1,47 @@
+-- pcall 捕获 error 和运行时错误（索引非表的值、非法比较），嵌套的 pcall 互不影响
+
+function safe(x)
+  return x * 2
+end
+
+function boom(x)
+  error("boom " .. x)
+  return 1
+end
+
+function deep(x)
+  return boom(x) + 1
+end
+
+function idx(t)
+  return t.a
+end
+
+function badcmp()
+  return "a" < 1
+end
+
+function report(ok, msg)
+  print("status", ok, msg)
+end
+
+report(pcall(safe, 21))
+report(pcall(boom, 1))
+report(pcall(deep, 2))
+report(pcall(idx, 5))
+report(pcall(badcmp))
+
+function nested(x)
+  report(pcall(boom, x))
+  return x + 100
+end
+report(pcall(nested, 3))
+
+function throwsTable()
+  error(@{code = 7})
+end
+function show(ok, e)
+  print(ok, e.code)
+end
+show(pcall(throwsTable))
+print("after")
@@ -0,0 +1,22 @@
+-- 数值格式化：|x| < 1e14 的整数按整数输出，其余按 %.14g，
+-- print、运行时的 .. 和常量折叠的 .. 结果一致
+
+function same(x)
+  return x
+end
+
+print(99999999999999)
+print(100000000000000)
+print(123456789012345)
+print(-123456789012345)
+print(0.1)
+
+print("" .. same(99999999999999))
+print("" .. same(100000000000000))
+print("" .. same(123456789012345))
+print("" .. same(-123456789012345))
+
+print("" .. 99999999999999)
+print("" .. 100000000000000)
+print("" .. 123456789012345)
+print("" .. -123456789012345)
@@ -0,0 +1,28 @@
+-- 比较运算和 and/or：and/or 返回操作数本身并且短路求值，字符串按内容比较，表按同一性比较
+
+local a = 3
+local b = 5
+print(a < b, a > b, a <= 3, a >= 4, a == 3, a ~= 3)
+print(not a, not nil, not (a < b), not (a > b))
+print(a and b, nil and b, a or b, nil or b, (a > b) or "dflt", (a < b) and "yes")
+
+local x = "ab"
+local y = "a" .. "b"
+print(x == y, x ~= y, "abc" < "abd", "b" <= "a", x == 1, 1 == x)
+
+local m = @{}
+local p = @{}
+print(m == p, m == m, m ~= p)
+
+local u = 0 / 0
+print(u == u, u ~= u, u < 1)
+
+function side(v)
+  print("side", v)
+  return v
+end
+local r = side(nil) and side(1)
+local q = side(1) or side(2)
+print(r, q)
+
+if a < b and b < 10 or nil then print("and-or") else print("no") end
@@ -0,0 +1,31 @@
+-- repeat-until：until 条件处于循环体作用域内，可以引用体内的 local，也包括被闭包捕获的 local
+
+local n = 0
+repeat
+  local done = n >= 3
+  n = n + 1
+until done
+print(n)
+function outer()
+  local i = 0
+  local last = 0
+  repeat
+    local k = i * 2
+    function get()
+      return k
+    end
+    last = get()
+    i = i + 1
+  until k >= 6
+  return i, last
+end
+print(outer())
+function pure(x)
+  local y = x
+  repeat
+    local z = y + 1
+    y = z
+  until z > 10
+  return y
+end
+print(pure(2))
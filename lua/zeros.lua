@@ -0,0 +1,30 @@
+-- 数组部分中的 0：中间和末尾的 0 都留在数组部分，向量操作和 parallel.map 不丢元素
+
+function half(x)
+  return x / 2
+end
+
+print(table.sum(@[1, 0, 2]))
+print(table.sum(@[1, 2, 0, 0, 4]))
+
+local t = @[5, 0, 0]
+t[4] = 7
+print(table.sum(t))
+t[2] = 0
+t[5] = 0
+t[6] = 1
+print(table.sum(t))
+
+local c = table.copy(@[0, 3, 0])
+c[4] = 2
+print(table.sum(c))
+
+local f = @{}
+f[3] = 9
+table.fill(f, 0, 4)
+f[5] = 6
+print(table.sum(f))
+
+local p = parallel.map(half, @[2, 0, 4, 0])
+p[5] = 10
+print(table.sum(p))
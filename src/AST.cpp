@@ -26,3 +26,17 @@ void RepeatStmt::accept(Visitor& visitor) {
     visitor.visit(this);
 }
 
+// LocalVarDecl 实现
+void LocalVarDecl::accept(Visitor& visitor) {
+    visitor.visit(this);
+}
+
+// AssignStmt 实现
+void AssignStmt::accept(Visitor& visitor) {
+    visitor.visit(this);
+}
+
+// IndexAssignStmt 实现
+void IndexAssignStmt::accept(Visitor& visitor) {
+    visitor.visit(this);
+}
@@ -0,0 +1,330 @@
+#include "Closure.h"
+#include <stdexcept>
+
+int FunctionInfo::upvalueIndex(FunctionInfo* owner, int slot) const {
+    for (size_t i = 0; i < upvalues.size(); ++i) {
+        if (upvalues[i].first == owner && upvalues[i].second == slot) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+bool FunctionInfo::isInside(const FunctionInfo* ancestor) const {
+    for (const FunctionInfo* f = this; f; f = f->parent) {
+        if (f == ancestor) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ClosureAnalysis::run(BlockStmt* root) {
+    // 顶层代码作为一帧，它的局部变量和函数的局部变量一样可以被捕获
+    mainInfo = FunctionInfo();
+    frames.push_back({&mainInfo, &mainInfo.slots, {{}}});
+    for (const auto& stmt : root->getStatements()) {
+        stmt->accept(*this);
+    }
+    frames.clear();
+
+    // 捕获了顶层局部变量的顶层函数是顶层代码的闭包
+    for (auto& entry : infos) {
+        FunctionInfo& info = entry.second;
+        if (!info.parent && info.hasUpvalues()) {
+            info.parent = &mainInfo;
+        }
+    }
+    checkClosureNames();
+
+    for (const auto& name : coroutineBodies) {
+        for (FunctionInfo* info : byName[name]) {
+            info->coroutine = true;
+        }
+    }
+
+    computeEscapes();
+    forwardUpvalues();
+
+    // 逃逸闭包捕获的变量必须活得比外层栈帧更久
+    for (auto& entry : infos) {
+        FunctionInfo& info = entry.second;
+        if (!info.escapes) {
+            continue;
+        }
+        for (const auto& upvalue : info.upvalues) {
+            upvalue.first->boxed.insert(upvalue.second);
+        }
+    }
+}
+
+// 函数按名字调用和生成，闭包的调用点按名字取得 upvals 的布局：同名的多个定义中有闭包
+// （嵌套定义或捕获了顶层局部变量）时无法确定调用的是哪一个，直接报错
+void ClosureAnalysis::checkClosureNames() {
+    for (const auto& entry : byName) {
+        if (entry.second.size() < 2) {
+            continue;
+        }
+        for (FunctionInfo* info : entry.second) {
+            if (info->isClosure()) {
+                throw std::runtime_error("Function '" + entry.first + "' defined at line " +
+                    std::to_string(info->decl->getLine()) +
+                    " is a closure and has another definition with the same name; "
+                    "nested functions and functions capturing top-level locals must have unique names");
+            }
+        }
+    }
+}
+
+FunctionInfo* ClosureAnalysis::getInfo(FunctionDecl* decl) {
+    auto it = infos.find(decl);
+    return it == infos.end() ? nullptr : &it->second;
+}
+
+FunctionInfo* ClosureAnalysis::lookup(const std::string& name) {
+    auto it = byName.find(name);
+    if (it == byName.end() || it->second.empty()) {
+        return nullptr;
+    }
+    return it->second.front();
+}
+
+int ClosureAnalysis::declareLocal(const std::string& name) {
+    Frame& frame = frames.back();
+    int slot = static_cast<int>(frame.slots->size());
+    frame.slots->push_back(name);
+    frame.scopes.back()[name] = slot;
+    return slot;
+}
+
+// 解析名字：本地变量绑定到槽号，外层函数的变量沿途登记为 upvalue，其余视为全局变量
+void ClosureAnalysis::reference(const std::string& name, BoundName* node) {
+    for (size_t k = frames.size(); k-- > 0;) {
+        int slot = -1;
+        for (auto scope = frames[k].scopes.rbegin(); scope != frames[k].scopes.rend(); ++scope) {
+            auto it = scope->find(name);
+            if (it != scope->end()) {
+                slot = it->second;
+                break;
+            }
+        }
+        if (slot < 0) {
+            continue;
+        }
+        if (k == frames.size() - 1) {
+            node->bind(Binding::LOCAL, slot);
+            return;
+        }
+        FunctionInfo* info = frames.back().info;
+        addUpvalue(info, frames[k].info, slot);
+        node->bind(Binding::UPVALUE, info->upvalueIndex(frames[k].info, slot));
+        return;
+    }
+    node->bind(Binding::GLOBAL, -1);
+    valueUses.insert(name);
+}
+
+void ClosureAnalysis::addUpvalue(FunctionInfo* from, FunctionInfo* owner, int slot) {
+    owner->captured.insert(slot);
+    for (FunctionInfo* f = from; f && f != owner; f = f->parent) {
+        if (f->upvalueIndex(owner, slot) < 0) {
+            f->upvalues.emplace_back(owner, slot);
+        }
+    }
+}
+
+void ClosureAnalysis::computeEscapes() {
+    // 被重复定义、当作值使用，或者在外层函数之外被调用的闭包都会逃逸
+    for (auto& entry : infos) {
+        FunctionInfo& info = entry.second;
+        const std::string& name = info.decl->getName();
+        if (info.isClosure() && (byName[name].size() > 1 || valueUses.count(name))) {
+            info.escapes = true;
+        }
+    }
+    for (const auto& call : calls) {
+        FunctionInfo* callee = lookup(call.callee);
+        if (callee && callee->isClosure() &&
+            !(call.caller && call.caller->isInside(callee->parent))) {
+            callee->escapes = true;
+        }
+    }
+
+    // 在逃逸闭包里被调用的闭包同样可能在外层函数返回后运行
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& call : calls) {
+            FunctionInfo* callee = lookup(call.callee);
+            if (!callee || !callee->isClosure() || callee->escapes) {
+                continue;
+            }
+            for (FunctionInfo* f = call.caller; f != callee->parent; f = f->parent) {
+                if (f->escapes) {
+                    callee->escapes = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// 非逃逸闭包的 upvals 由调用点在栈上构造，调用者需要能拿到所有被捕获变量的单元
+void ClosureAnalysis::forwardUpvalues() {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto& call : calls) {
+            FunctionInfo* callee = lookup(call.callee);
+            if (!callee || !callee->isClosure() || callee->escapes) {
+                continue;
+            }
+            for (const auto& upvalue : callee->upvalues) {
+                for (FunctionInfo* f = call.caller; f && f != upvalue.first; f = f->parent) {
+                    if (f->upvalueIndex(upvalue.first, upvalue.second) < 0) {
+                        f->upvalues.push_back(upvalue);
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ClosureAnalysis::visit(BlockStmt* node) {
+    frames.back().scopes.emplace_back();
+    for (const auto& stmt : node->getStatements()) {
+        stmt->accept(*this);
+    }
+    frames.back().scopes.pop_back();
+}
+
+void ClosureAnalysis::visit(FunctionDecl* node) {
+    FunctionInfo& info = infos[node];
+    info.decl = node;
+    info.parent = frames.back().info == &mainInfo ? nullptr : frames.back().info;
+    byName[node->getName()].push_back(&info);
+    functions.push_back(node);
+
+    info.slots.clear();
+    frames.push_back({&info, &info.slots, {{}}});
+    for (const auto& param : node->getParams()) {
+        declareLocal(param);
+    }
+    for (const auto& stmt : node->getBody()) {
+        stmt->accept(*this);
+    }
+    frames.pop_back();
+}
+
+void ClosureAnalysis::visit(ReturnStmt* node) {
+    for (const auto& value : node->getValues()) {
+        value->accept(*this);
+    }
+}
+
+void ClosureAnalysis::visit(IfStmt* node) {
+    node->getCondition()->accept(*this);
+    node->getThenBranch()->accept(*this);
+    if (node->getElseBranch()) {
+        node->getElseBranch()->accept(*this);
+    }
+}
+
+void ClosureAnalysis::visit(WhileStmt* node) {
+    node->getCondition()->accept(*this);
+    node->getBody()->accept(*this);
+}
+
+void ClosureAnalysis::visit(RepeatStmt* node) {
+    // until 条件处于循环体作用域内，可以引用体内的 local
+    auto* body = dynamic_cast<BlockStmt*>(node->getBody());
+    if (!body) {
+        node->getBody()->accept(*this);
+        node->getCondition()->accept(*this);
+        return;
+    }
+    frames.back().scopes.emplace_back();
+    for (const auto& stmt : body->getStatements()) {
+        stmt->accept(*this);
+    }
+    node->getCondition()->accept(*this);
+    frames.back().scopes.pop_back();
+}
+
+void ClosureAnalysis::visit(ExprStmt* node) {
+    if (node->getExpr()) {
+        node->getExpr()->accept(*this);
+    }
+}
+
+void ClosureAnalysis::visit(BinaryExpr* node) {
+    node->getLeft()->accept(*this);
+    node->getRight()->accept(*this);
+}
+
+void ClosureAnalysis::visit(UnaryExpr* node) {
+    node->getExpr()->accept(*this);
+}
+
+void ClosureAnalysis::visit(NumberExpr* node) {}
+
+void ClosureAnalysis::visit(StringExpr* node) {}
+
+void ClosureAnalysis::visit(NilExpr* node) {}
+
+void ClosureAnalysis::visit(VarExpr* node) {
+    reference(node->getName(), node);
+}
+
+void ClosureAnalysis::visit(CallExpr* node) {
+    calls.push_back({frames.back().info, node->getCallee()});
+    if (node->getCallee() == "coroutine.create" && !node->getArguments().empty()) {
+        if (auto* body = dynamic_cast<VarExpr*>(node->getArguments()[0].get())) {
+            coroutineBodies.insert(body->getName());
+        }
+    }
+    for (const auto& arg : node->getArguments()) {
+        arg->accept(*this);
+    }
+}
+
+void ClosureAnalysis::visit(PrintExpr* node) {
+    node->getExpr()->accept(*this);
+}
+
+void ClosureAnalysis::visit(LocalVarDecl* node) {
+    if (node->getInitializer()) {
+        node->getInitializer()->accept(*this);
+    }
+    node->bind(Binding::LOCAL, declareLocal(node->getName()));
+}
+
+void ClosureAnalysis::visit(AssignStmt* node) {
+    node->getValue()->accept(*this);
+    reference(node->getName(), node);
+}
+
+void ClosureAnalysis::visit(IndexExpr* node) {
+    node->getObject()->accept(*this);
+    node->getKey()->accept(*this);
+}
+
+void ClosureAnalysis::visit(TableExpr* node) {
+    if (node->getSize()) {
+        node->getSize()->accept(*this);
+    }
+    for (const auto& field : node->getFields()) {
+        field.key->accept(*this);
+        field.value->accept(*this);
+    }
+    if (!node->getConstructor().empty()) {
+        calls.push_back({frames.back().info, node->getConstructor()});
+    }
+}
+
+void ClosureAnalysis::visit(IndexAssignStmt* node) {
+    node->getValue()->accept(*this);
+    node->getTarget()->accept(*this);
+}
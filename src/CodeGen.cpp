@@ -1,4 +1,5 @@
 #include "CodeGen.h"
+#include "Optimizer.h"
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Function.h>
@@ -16,18 +17,36 @@
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Transforms/Coroutines/CoroCleanup.h>
+#include <llvm/Transforms/Coroutines/CoroEarly.h>
+#include <llvm/Transforms/Coroutines/CoroSplit.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/Support/Path.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/Program.h>
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include "Runtime.h"
+#include "LuaModule.h"
 
-CodeGenerator::~CodeGenerator() = default;
+// luac --shared 生成的共享库链接的 libluaruntime.so 所在目录，可以用同名环境变量覆盖
+#ifndef LUA_RUNTIME_LIBRARY_DIR
+#define LUA_RUNTIME_LIBRARY_DIR "."
+#endif
 
-void CodeGenerator::declarePrintf() {
-    // 声明printf函数
-    std::vector<llvm::Type*> printfArgs;
-    printfArgs.push_back(llvm::PointerType::get(builder->getInt8Ty(), 0));
-    llvm::FunctionType* printfType = llvm::FunctionType::get(
-        llvm::Type::getInt32Ty(*context), printfArgs, true);
-    printfFunc = llvm::Function::Create(
-        printfType, llvm::Function::ExternalLinkage, "printf", module.get());
-}
+// 构建时嵌入的运行时库 bitcode（见 cmake/EmbedBitcode.cmake），没有 clang 时为空
+extern const unsigned char luaRuntimeBitcode[];
+extern const size_t luaRuntimeBitcodeSize;
+
+CodeGenerator::~CodeGenerator() = default;
 
 CodeGenerator::CodeGenerator() {
     // 创建LLVM上下文和模块
@@ -35,57 +54,85 @@ CodeGenerator::CodeGenerator() {
     module = std::make_unique<llvm::Module>("lua", *context);
     builder = std::make_unique<llvm::IRBuilder<>>(*context);
     
-    // 声明 printf 函数
-    std::vector<llvm::Type*> printfArgs;
-    printfArgs.push_back(llvm::PointerType::get(builder->getInt8Ty(), 0));
-    llvm::FunctionType* printfType = 
-        llvm::FunctionType::get(builder->getInt32Ty(), printfArgs, true);
-    module->getOrInsertFunction("printf", printfType);
+    // 声明运行时库中的内置函数
+    initBuiltins();
 }
 
 void CodeGenerator::generateCode(Stmt* root) {
-    // 第一阶段：收集所有函数声明
+    // 第一阶段：AST 优化，然后做闭包分析和表的逃逸分析，收集所有函数声明
+    if (auto* blockStmt = dynamic_cast<BlockStmt*>(root)) {
+        optimizer.run(blockStmt);
+        closures.run(blockStmt);
+        scalarTables.run(blockStmt, closures);
+    }
+    collectRedefinitions();
     collectFunctionDeclarations(root);
+    declareImports();
+    initDebugInfo();
+    if (sharedLibrary) {
+        initTargetMachine();
+    }
     
-    // 第二阶段：生成所有函数的实现
-    if (auto* blockStmt = dynamic_cast<BlockStmt*>(root)) {
-        for (const auto& stmt : blockStmt->getStatements()) {
-            if (auto* funcDecl = dynamic_cast<FunctionDecl*>(stmt.get())) {
-                visit(funcDecl);
-            }
+    // 第二阶段：生成所有函数（包括嵌套函数）的实现
+    for (FunctionDecl* funcDecl : closures.getFunctions()) {
+        generateFunction(funcDecl);
+        if (closures.getInfo(funcDecl)->coroutine) {
+            generateCoroutine(funcDecl);
         }
     }
     
-    // 创建 main 函数
+    // 创建 main 函数：chunk 的代码生成在 <entry>.chunk 中，由入口函数调用
     llvm::FunctionType* mainType = 
         llvm::FunctionType::get(llvm::Type::getInt32Ty(*context), false);
     llvm::Function* mainFunc = 
-        llvm::Function::Create(mainType, llvm::Function::ExternalLinkage,
-                             "main", module.get());
+        llvm::Function::Create(mainType, llvm::Function::InternalLinkage,
+                             entryName + ".chunk", module.get());
     
     currentFunction = mainFunc;
+    currentInfo = closures.getMainInfo();
+    coroState = nullptr;
+    stateSlotBase = nullptr;
+    beginDebugFunction(mainFunc, entryName, 1);
     
     // 创建入口基本块
     llvm::BasicBlock* block = 
         llvm::BasicBlock::Create(*context, "entry", mainFunc);
     builder->SetInsertPoint(block);
+    beginLocals(closures.getMainSlots());
+    emitEntryBudgetCheck(true);
+    
+    // 可重入模式下槽数组初始为零，声明提升后第一个定义在执行到任何定义语句之前生效
+    if (reentrant) {
+        for (const auto& entry : redefinitions) {
+            builder->CreateStore(getDefinition(entry.second.front()), getFunctionSlot(entry.first));
+        }
+    }
     
-    // 生成全局代码（非函数声明的语句）
+    // 生成全局代码；函数声明语句只在重新定义时更新当前定义，函数体已经单独生成
     if (auto* blockStmt = dynamic_cast<BlockStmt*>(root)) {
         for (const auto& stmt : blockStmt->getStatements()) {
-            if (!dynamic_cast<FunctionDecl*>(stmt.get())) {
-                stmt->accept(*this);
-            }
+            generateStatement(stmt.get());
         }
-    } else if (!dynamic_cast<FunctionDecl*>(root)) {
-        root->accept(*this);
+    } else {
+        generateStatement(root);
     }
     
-    // 确保基本块有终止指令
-    if (!block->getTerminator()) {
+    // 确保基本块有终止指令，退出前刷新输出缓冲区
+    if (!builder->GetInsertBlock()->getTerminator()) {
+        emitBudgetSave();
+        builder->CreateCall(module->getFunction("lua_flush"));
         builder->CreateRet(llvm::ConstantInt::get(
             llvm::Type::getInt32Ty(*context), 0));
     }
+    sealAllBlocks();
+    emitEntry(mainFunc);
+    for (const std::string& name : functionValues) {
+        emitFunctionValue(name);
+    }
+    
+    if (debugBuilder) {
+        debugBuilder->finalize();
+    }
     
     // 验证生成的代码
     std::string errorInfo;
@@ -93,6 +140,20 @@ void CodeGenerator::generateCode(Stmt* root) {
     if (llvm::verifyModule(*module, &errorStream)) {
         throw std::runtime_error("Module verification failed: " + errorInfo);
     }
+    
+    if (sharedLibrary) {
+        emitModuleInfo();
+    }
+    
+    // 先链接运行时再优化，运行时的快速路径才能内联进用户代码
+    linkRuntime();
+    
+    // 协程体必须在执行或输出目标代码之前拆分，优化流水线自带协程拆分
+    if (optLevel > 0) {
+        optimizeModule();
+    } else if (hasCoroutines) {
+        lowerCoroutines();
+    }
 }
 
 // 添加函数声明收集方法
@@ -105,51 +166,110 @@ void CodeGenerator::collectFunctionDeclarations(Stmt* node) {
         return;
     }
     
+    // 嵌套在控制语句中的函数
+    if (auto* ifStmt = dynamic_cast<IfStmt*>(node)) {
+        collectFunctionDeclarations(ifStmt->getThenBranch());
+        if (ifStmt->getElseBranch()) {
+            collectFunctionDeclarations(ifStmt->getElseBranch());
+        }
+        return;
+    }
+    if (auto* whileStmt = dynamic_cast<WhileStmt*>(node)) {
+        collectFunctionDeclarations(whileStmt->getBody());
+        return;
+    }
+    if (auto* repeatStmt = dynamic_cast<RepeatStmt*>(node)) {
+        collectFunctionDeclarations(repeatStmt->getBody());
+        return;
+    }
+    
     // 处理函数声明
     if (auto* funcDecl = dynamic_cast<FunctionDecl*>(node)) {
         std::string name = funcDecl->getName();
         
-        // 如果函数已经声明，跳过
-        if (module->getFunction(name)) {
+        // 如果函数已经声明，跳过；重新定义的函数每个定义各生成一个
+        auto redefined = redefinitions.find(name);
+        size_t index = 0;
+        if (redefined != redefinitions.end()) {
+            auto& decls = redefined->second;
+            index = std::find(decls.begin(), decls.end(), funcDecl) - decls.begin();
+        }
+        if (index == 0 && module->getFunction(name)) {
             return;
         }
         
-        // 创建参数类型列表
-        std::vector<llvm::Type*> paramTypes(
+        // 创建参数类型列表，闭包的第一个参数是隐藏的 upvals
+        FunctionInfo* info = closures.getInfo(funcDecl);
+        bool hasUpvalues = info && info->hasUpvalues();
+        std::vector<llvm::Type*> paramTypes;
+        if (hasUpvalues) {
+            paramTypes.push_back(llvm::PointerType::get(builder->getInt8Ty(), 0));
+        }
+        paramTypes.insert(paramTypes.end(),
             funcDecl->getParams().size(),
             llvm::Type::getDoubleTy(*context));
         
         // 确定返回类型
-        llvm::Type* returnType;
-        if (hasMultipleReturns(funcDecl)) {
-            std::vector<llvm::Type*> returnTypes(2, 
-                llvm::Type::getDoubleTy(*context));
-            returnType = llvm::StructType::create(
-                *context, returnTypes, name + "_return");
-        } else {
-            returnType = llvm::Type::getDoubleTy(*context);
-        }
+        llvm::Type* returnType = createReturnType(name, hasMultipleReturns(funcDecl));
         
         // 创建函数类型
         llvm::FunctionType* functionType = 
             llvm::FunctionType::get(returnType, paramTypes, false);
         
-        // 创建函数
-        llvm::Function* func = llvm::Function::Create(
-            functionType,
-            llvm::Function::ExternalLinkage,
-            name,
-            module.get());
+        // 创建函数：Lua 函数之间使用 fastcc，闭包和之后的定义只在本模块中调用
+        llvm::Function* func;
+        if (index > 0) {
+            llvm::Function* first = module->getFunction(name);
+            func = llvm::Function::Create(first->getFunctionType(),
+                llvm::Function::InternalLinkage,
+                name + "." + std::to_string(index + 1),
+                module.get());
+        } else {
+            func = llvm::Function::Create(
+                functionType,
+                info && info->isClosure() ? llvm::Function::InternalLinkage
+                                          : llvm::Function::ExternalLinkage,
+                name,
+                module.get());
+        }
+        func->setCallingConv(llvm::CallingConv::Fast);
+        definitions[funcDecl] = func;
             
         // 设置函数参数名称
-        size_t idx = 0;
-        for (auto& arg : func->args()) {
-            arg.setName(funcDecl->getParams()[idx++]);
+        auto argIt = func->arg_begin();
+        if (hasUpvalues) {
+            (argIt++)->setName("upvals");
+        }
+        for (const auto& param : funcDecl->getParams()) {
+            (argIt++)->setName(param);
+        }
+        
+        // 不优化时设置函数属性以防止优化
+        if (optLevel == 0) {
+            func->addFnAttr(llvm::Attribute::NoInline);
+            func->addFnAttr(llvm::Attribute::OptimizeNone);
         }
         
-        // 设置函数属性以防止优化
-        func->addFnAttr(llvm::Attribute::NoInline);
-        func->addFnAttr(llvm::Attribute::OptimizeNone);
+        // 协程体的 ramp 函数：ptr name.coro(ptr co [, ptr upvals])，返回协程帧
+        if (info && info->coroutine) {
+            llvm::Type* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+            std::vector<llvm::Type*> coroParams(hasUpvalues ? 2 : 1, ptrTy);
+            llvm::Function* coro = llvm::Function::Create(
+                llvm::FunctionType::get(ptrTy, coroParams, false),
+                llvm::Function::ExternalLinkage,
+                name + ".coro",
+                module.get());
+            coro->getArg(0)->setName("co");
+            if (hasUpvalues) {
+                coro->getArg(1)->setName("upvals");
+            }
+            coro->addFnAttr(llvm::Attribute::PresplitCoroutine);
+        }
+        
+        // 递归收集嵌套函数
+        for (const auto& stmt : funcDecl->getBody()) {
+            collectFunctionDeclarations(stmt.get());
+        }
     }
 }
 
@@ -158,6 +278,14 @@ void CodeGenerator::visit(NumberExpr* node) {
 }
 
 void CodeGenerator::visit(BinaryExpr* node) {
+    if (node->getOp() == BinaryOp::AND_OP || node->getOp() == BinaryOp::OR_OP) {
+        lastValue = emitLogical(node);
+        return;
+    }
+    if (isComparison(node->getOp())) {
+        lastValue = emitCondition(node);
+        return;
+    }
     node->getLeft()->accept(*this);
     llvm::Value* L = lastValue;
     node->getRight()->accept(*this);
@@ -165,75 +293,272 @@ void CodeGenerator::visit(BinaryExpr* node) {
     
     switch (node->getOp()) {
         case BinaryOp::ADD:
-            lastValue = builder->CreateFAdd(L, R, "addtmp");
+            lastValue = emitArith(LUA_EVENT_ADD, L, R, builder->CreateFAdd(L, R, "addtmp"));
             break;
         case BinaryOp::SUB:
-            lastValue = builder->CreateFSub(L, R, "subtmp");
+            lastValue = emitArith(LUA_EVENT_SUB, L, R, builder->CreateFSub(L, R, "subtmp"));
             break;
         case BinaryOp::MUL:
-            lastValue = builder->CreateFMul(L, R, "multmp");
+            lastValue = emitArith(LUA_EVENT_MUL, L, R, builder->CreateFMul(L, R, "multmp"));
             break;
         case BinaryOp::DIV:
-            lastValue = builder->CreateFDiv(L, R, "divtmp");
+            lastValue = emitArith(LUA_EVENT_DIV, L, R, builder->CreateFDiv(L, R, "divtmp"));
+            break;
+        case BinaryOp::CONCAT:
+            emitAllocationSite(LUA_ALLOC_CONCAT);
+            lastValue = builder->CreateCall(module->getFunction("lua_concat"), {L, R}, "concat");
+            endAllocationSite();
             break;
         default:
             throw std::runtime_error("Unknown binary operator");
     }
 }
 
-void CodeGenerator::visit(PrintExpr* node) {
-    // 生成要打印的表达式的代码
-    node->getExpr()->accept(*this);
-    llvm::Value* exprValue = lastValue;
+// 算术运算的快速路径就是数值运算本身：装箱的对象都是 NaN，只要有一个操作数不是数值，
+// 结果就是 NaN。结果是 NaN 时才调用 lua_arith 处理字符串转换和元方法（数值运算本身
+// 得到的 NaN 由它重新计算）
+llvm::Value* CodeGenerator::emitArith(int32_t event, llvm::Value* left, llvm::Value* right,
+                                      llvm::Value* result) {
+    if (auto* constant = llvm::dyn_cast<llvm::ConstantFP>(result)) {
+        if (!constant->isNaN()) {
+            return result;
+        }
+    }
+    llvm::BasicBlock* fastBB = builder->GetInsertBlock();
+    llvm::BasicBlock* slowBB = llvm::BasicBlock::Create(*context, "arith.slow", currentFunction);
+    llvm::BasicBlock* doneBB = llvm::BasicBlock::Create(*context, "arith.done", currentFunction);
+    builder->CreateCondBr(builder->CreateFCmpUNO(result, result), slowBB, doneBB,
+        llvm::MDBuilder(*context).createBranchWeights(1, 2000));
+    sealBlock(slowBB);
+    
+    builder->SetInsertPoint(slowBB);
+    llvm::Value* slow = builder->CreateCall(module->getFunction("lua_arith"),
+        {builder->getInt32(event), left, right}, "arith");
+    builder->CreateBr(doneBB);
+    
+    sealBlock(doneBB);
+    builder->SetInsertPoint(doneBB);
+    llvm::PHINode* value = builder->CreatePHI(builder->getDoubleTy(), 2, "arith.value");
+    value->addIncoming(result, fastBB);
+    value->addIncoming(slow, slowBB);
+    return value;
+}
+
+// 条件为真：不是 nil（0.0）的值，包括字符串、表等装箱的值（NaN）
+llvm::Value* CodeGenerator::emitTruth(llvm::Value* value) {
+    return builder->CreateFCmpUNE(value, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), "truth");
+}
+
+bool CodeGenerator::isComparison(BinaryOp op) const {
+    switch (op) {
+        case BinaryOp::EQ:
+        case BinaryOp::NEQ:
+        case BinaryOp::LT:
+        case BinaryOp::LT_EQ:
+        case BinaryOp::GT:
+        case BinaryOp::GT_EQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// 比较运算、and/or 和 not：作为条件时不需要先物化成值
+bool CodeGenerator::isCondition(Expr* expr) const {
+    if (auto* binary = dynamic_cast<BinaryExpr*>(expr)) {
+        return isComparison(binary->getOp()) || binary->getOp() == BinaryOp::AND_OP ||
+               binary->getOp() == BinaryOp::OR_OP;
+    }
+    auto* unary = dynamic_cast<UnaryExpr*>(expr);
+    return unary && unary->getOp() == UnaryOp::NOT_OP;
+}
+
+// 按条件跳转到 trueBB 或 falseBB：and/or 短路求值，not 交换目标，比较运算直接 fcmp。
+// 新建的中间块只有一个前驱，立即封闭；trueBB 和 falseBB 由调用者在返回后封闭
+void CodeGenerator::emitBranch(Expr* condition, llvm::BasicBlock* trueBB, llvm::BasicBlock* falseBB) {
+    if (auto* binary = dynamic_cast<BinaryExpr*>(condition)) {
+        BinaryOp op = binary->getOp();
+        if (op == BinaryOp::AND_OP || op == BinaryOp::OR_OP) {
+            llvm::BasicBlock* rightBB = llvm::BasicBlock::Create(
+                *context, op == BinaryOp::AND_OP ? "and.rhs" : "or.rhs", currentFunction);
+            if (op == BinaryOp::AND_OP) {
+                emitBranch(binary->getLeft(), rightBB, falseBB);
+            } else {
+                emitBranch(binary->getLeft(), trueBB, rightBB);
+            }
+            sealBlock(rightBB);
+            builder->SetInsertPoint(rightBB);
+            emitBranch(binary->getRight(), trueBB, falseBB);
+            return;
+        }
+        if (isComparison(op)) {
+            llvm::Value* left = generateValue(binary->getLeft());
+            llvm::Value* right = generateValue(binary->getRight());
+            emitCompareBranch(op, left, right, trueBB, falseBB);
+            return;
+        }
+    }
+    if (auto* unary = dynamic_cast<UnaryExpr*>(condition)) {
+        if (unary->getOp() == UnaryOp::NOT_OP) {
+            emitBranch(unary->getExpr(), falseBB, trueBB);
+            return;
+        }
+    }
+    builder->CreateCondBr(emitTruth(generateValue(condition)), trueBB, falseBB);
+}
+
+// 比较就是 fcmp：为真时两个操作数一定都是数值，直接跳到 trueBB；为假时再检查是否有
+// 装箱的值（NaN），有才调用 lua_compare 处理字符串、表和元方法。
+// a > b 按 b < a、a ~= b 按 not (a == b) 生成。与数值常量比较相等时另一个操作数是
+// 装箱的值也一定不相等，不需要慢速路径
+void CodeGenerator::emitCompareBranch(BinaryOp op, llvm::Value* left, llvm::Value* right,
+                                      llvm::BasicBlock* trueBB, llvm::BasicBlock* falseBB) {
+    switch (op) {
+        case BinaryOp::GT:
+            std::swap(left, right);
+            op = BinaryOp::LT;
+            break;
+        case BinaryOp::GT_EQ:
+            std::swap(left, right);
+            op = BinaryOp::LT_EQ;
+            break;
+        case BinaryOp::NEQ:
+            std::swap(trueBB, falseBB);
+            op = BinaryOp::EQ;
+            break;
+        default:
+            break;
+    }
+    int32_t event = op == BinaryOp::EQ ? LUA_EVENT_EQ : op == BinaryOp::LT ? LUA_EVENT_LT : LUA_EVENT_LE;
+    llvm::CmpInst::Predicate predicate = op == BinaryOp::EQ ? llvm::CmpInst::FCMP_OEQ
+        : op == BinaryOp::LT ? llvm::CmpInst::FCMP_OLT : llvm::CmpInst::FCMP_OLE;
+    llvm::Value* result = builder->CreateFCmp(predicate, left, right, "cmp");
     
-    // 如果表达式结果是结构体类型，提取第一个元素
-    if (exprValue->getType()->isStructTy()) {
-        exprValue = builder->CreateExtractValue(exprValue, 0);
+    auto isNumber = [](llvm::Value* value) {
+        auto* constant = llvm::dyn_cast<llvm::ConstantFP>(value);
+        return constant && !constant->isNaN();
+    };
+    if ((isNumber(left) && isNumber(right)) || (op == BinaryOp::EQ && (isNumber(left) || isNumber(right)))) {
+        builder->CreateCondBr(result, trueBB, falseBB);
+        return;
     }
     
-    // 声明 printf 函数（如果还没有声明）
-    llvm::Function* printf = module->getFunction("printf");
-    if (!printf) {
-        std::vector<llvm::Type*> args;
-        args.push_back(llvm::PointerType::get(builder->getInt8Ty(), 0));
-        llvm::FunctionType* printfType = 
-            llvm::FunctionType::get(builder->getInt32Ty(), args, true);
-        printf = llvm::Function::Create(printfType, 
-            llvm::Function::ExternalLinkage, "printf", module.get());
+    llvm::BasicBlock* checkBB = llvm::BasicBlock::Create(*context, "cmp.check", currentFunction);
+    llvm::BasicBlock* slowBB = llvm::BasicBlock::Create(*context, "cmp.slow", currentFunction);
+    builder->CreateCondBr(result, trueBB, checkBB);
+    sealBlock(checkBB);
+    
+    builder->SetInsertPoint(checkBB);
+    builder->CreateCondBr(builder->CreateFCmpUNO(left, right, "cmp.boxed"), slowBB, falseBB,
+        llvm::MDBuilder(*context).createBranchWeights(1, 2000));
+    sealBlock(slowBB);
+    
+    builder->SetInsertPoint(slowBB);
+    llvm::Value* slow = builder->CreateCall(module->getFunction("lua_compare"),
+        {builder->getInt32(event), left, right}, "compare");
+    builder->CreateCondBr(builder->CreateICmpNE(slow, builder->getInt32(0)), trueBB, falseBB);
+}
+
+// 比较运算和 not 作为值使用：真为 1，假为 nil
+llvm::Value* CodeGenerator::emitCondition(Expr* condition) {
+    llvm::BasicBlock* trueBB = llvm::BasicBlock::Create(*context, "cond.true", currentFunction);
+    llvm::BasicBlock* falseBB = llvm::BasicBlock::Create(*context, "cond.false", currentFunction);
+    llvm::BasicBlock* doneBB = llvm::BasicBlock::Create(*context, "cond.done", currentFunction);
+    emitBranch(condition, trueBB, falseBB);
+    sealBlock(trueBB);
+    sealBlock(falseBB);
+    builder->SetInsertPoint(trueBB);
+    builder->CreateBr(doneBB);
+    builder->SetInsertPoint(falseBB);
+    builder->CreateBr(doneBB);
+    
+    sealBlock(doneBB);
+    builder->SetInsertPoint(doneBB);
+    llvm::PHINode* value = builder->CreatePHI(builder->getDoubleTy(), 2, "cond.value");
+    value->addIncoming(llvm::ConstantFP::get(*context, llvm::APFloat(1.0)), trueBB);
+    value->addIncoming(llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), falseBB);
+    return value;
+}
+
+// a and b、a or b 作为值使用：结果是 a 或 b 本身，右操作数只在需要时求值
+llvm::Value* CodeGenerator::emitLogical(BinaryExpr* node) {
+    bool isAnd = node->getOp() == BinaryOp::AND_OP;
+    llvm::Value* left = generateValue(node->getLeft());
+    if (auto* constant = llvm::dyn_cast<llvm::ConstantFP>(left)) {
+        return constant->isZero() == isAnd ? left : generateValue(node->getRight());
     }
+    
+    llvm::BasicBlock* leftBB = builder->GetInsertBlock();
+    llvm::BasicBlock* rightBB = llvm::BasicBlock::Create(*context, isAnd ? "and.rhs" : "or.rhs", currentFunction);
+    llvm::BasicBlock* doneBB = llvm::BasicBlock::Create(*context, isAnd ? "and.end" : "or.end", currentFunction);
+    llvm::Value* truth = emitTruth(left);
+    builder->CreateCondBr(truth, isAnd ? rightBB : doneBB, isAnd ? doneBB : rightBB);
+    sealBlock(rightBB);
+    
+    builder->SetInsertPoint(rightBB);
+    llvm::Value* right = generateValue(node->getRight());
+    rightBB = builder->GetInsertBlock();
+    builder->CreateBr(doneBB);
+    
+    sealBlock(doneBB);
+    builder->SetInsertPoint(doneBB);
+    llvm::PHINode* value = builder->CreatePHI(builder->getDoubleTy(), 2, isAnd ? "and.value" : "or.value");
+    value->addIncoming(left, leftBB);
+    value->addIncoming(right, rightBB);
+    return value;
+}
 
-    // 创建格式字符串
-    llvm::Value* formatStr = builder->CreateGlobalString("%g\n", "fmt");
-    llvm::Value* formatStrPtr = builder->CreatePointerCast(
-        formatStr, 
-        llvm::PointerType::get(builder->getInt8Ty(), 0)
-    );
+void CodeGenerator::visit(PrintExpr* node) {
+    // 生成要打印的表达式的代码
+    node->getExpr()->accept(*this);
+    emitPrint({lastValue});
+}
 
-    // 调用 printf
-    std::vector<llvm::Value*> args;
-    args.push_back(formatStrPtr);
-    args.push_back(exprValue);
-    builder->CreateCall(printf, args);
+// 每个参数调用一次运行时的输出函数，参数之间用制表符分隔；
+// 最后一个参数是多返回值时打印全部返回值
+void CodeGenerator::emitPrint(const std::vector<llvm::Value*>& args) {
+    std::vector<llvm::Value*> values;
+    for (size_t i = 0; i < args.size(); ++i) {
+        llvm::Value* value = args[i];
+        if (auto* structTy = llvm::dyn_cast<llvm::StructType>(value->getType())) {
+            unsigned count = i + 1 == args.size() ? structTy->getNumElements() : 1;
+            for (unsigned j = 0; j < count; ++j) {
+                values.push_back(builder->CreateExtractValue(value, j));
+            }
+        } else {
+            values.push_back(value);
+        }
+    }
+    
+    if (values.empty()) {
+        builder->CreateCall(module->getFunction("lua_print_newline"));
+        return;
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+        llvm::Value* terminator = builder->getInt32(i + 1 == values.size() ? '\n' : '\t');
+        builder->CreateCall(module->getFunction("lua_print_value"), {values[i], terminator});
+    }
 }
 
 void CodeGenerator::visit(IfStmt* node) {
     llvm::Function* function = builder->GetInsertBlock()->getParent();
     
-    llvm::BasicBlock* thenBB = llvm::BasicBlock::Create(*context, "then", function);
+    llvm::BasicBlock* thenBB = llvm::BasicBlock::Create(*context, "then");
     llvm::BasicBlock* elseBB = llvm::BasicBlock::Create(*context, "else");
     llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(*context, "ifcont");
     
     // 生成条件代码
-    node->getCondition()->accept(*this);
-    llvm::Value* condV = lastValue;
-    condV = builder->CreateFCmpONE(condV, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), "ifcond");
-    
-    builder->CreateCondBr(condV, thenBB, elseBB);
+    emitBranch(node->getCondition(), thenBB, elseBB);
+    sealBlock(thenBB);
+    sealBlock(elseBB);
     
-    // 生成then分支
+    // 生成then分支，分支以 return 结束时不再跳到合并块
+    function->insert(function->end(), thenBB);
     builder->SetInsertPoint(thenBB);
     node->getThenBranch()->accept(*this);
-    builder->CreateBr(mergeBB);
+    if (!builder->GetInsertBlock()->getTerminator()) {
+        builder->CreateBr(mergeBB);
+    }
     
     // 生成else分支
     function->insert(function->end(), elseBB);
@@ -241,10 +566,13 @@ void CodeGenerator::visit(IfStmt* node) {
     if (node->getElseBranch()) {
         node->getElseBranch()->accept(*this);
     }
-    builder->CreateBr(mergeBB);
+    if (!builder->GetInsertBlock()->getTerminator()) {
+        builder->CreateBr(mergeBB);
+    }
     
     // 生成合并块
     function->insert(function->end(), mergeBB);
+    sealBlock(mergeBB);
     builder->SetInsertPoint(mergeBB);
 }
 
@@ -258,16 +586,18 @@ void CodeGenerator::visit(WhileStmt* node) {
     builder->CreateBr(condBB);
     
     builder->SetInsertPoint(condBB);
-    node->getCondition()->accept(*this);
-    llvm::Value* condV = lastValue;
-    condV = builder->CreateFCmpONE(condV, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), "whilecond");
-    
-    builder->CreateCondBr(condV, bodyBB, afterBB);
+    emitBranch(node->getCondition(), bodyBB, afterBB);
+    sealBlock(bodyBB);
+    sealBlock(afterBB);
     
     function->insert(function->end(), bodyBB);
     builder->SetInsertPoint(bodyBB);
     node->getBody()->accept(*this);
-    builder->CreateBr(condBB);
+    emitBudgetCheck();
+    if (!builder->GetInsertBlock()->getTerminator()) {
+        builder->CreateBr(condBB);
+    }
+    sealBlock(condBB);
     
     function->insert(function->end(), afterBB);
     builder->SetInsertPoint(afterBB);
@@ -284,54 +614,82 @@ void CodeGenerator::visit(RepeatStmt* node) {
     
     builder->SetInsertPoint(bodyBB);
     node->getBody()->accept(*this);
-    builder->CreateBr(condBB);
+    if (!builder->GetInsertBlock()->getTerminator()) {
+        builder->CreateBr(condBB);
+    }
+    sealBlock(condBB);
     
     function->insert(function->end(), condBB);
     builder->SetInsertPoint(condBB);
-    node->getCondition()->accept(*this);
-    llvm::Value* condV = lastValue;
-    condV = builder->CreateFCmpONE(condV, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), "repeatcond");
+    // 条件中的体内 local 按槽号读取，得到循环体末尾的值
     
-    builder->CreateCondBr(condV, afterBB, bodyBB);
+    // 回边上的检查点放在单独的块中，退出循环时不消耗预算
+    llvm::BasicBlock* backedgeBB = preemption
+        ? llvm::BasicBlock::Create(*context, "repeatback") : bodyBB;
+    emitBranch(node->getCondition(), afterBB, backedgeBB);
+    sealBlock(afterBB);
+    if (backedgeBB != bodyBB) {
+        sealBlock(backedgeBB);
+        function->insert(function->end(), backedgeBB);
+        builder->SetInsertPoint(backedgeBB);
+        emitBudgetCheck();
+        builder->CreateBr(bodyBB);
+    }
+    sealBlock(bodyBB);
     
     function->insert(function->end(), afterBB);
     builder->SetInsertPoint(afterBB);
 }
 
-void CodeGenerator::visit(FunctionDecl* node) {
+void CodeGenerator::generateFunction(FunctionDecl* node) {
     std::string name = node->getName();
     
     // 获取已声明的函数
-    llvm::Function* function = module->getFunction(name);
+    llvm::Function* function = getDefinition(node);
     if (!function) {
         throw std::runtime_error("Function " + name + " not found in module");
     }
     
+    // 不能按定义分别生成的同名函数只生成第一个定义
+    if (!function->empty()) {
+        return;
+    }
+    
     // 保存当前函数
     currentFunction = function;
+    currentInfo = closures.getInfo(node);
+    coroState = nullptr;
+    beginDebugFunction(function, name, node->getLine());
     
     // 创建基本块
     llvm::BasicBlock* block = 
         llvm::BasicBlock::Create(*context, "entry", function);
     builder->SetInsertPoint(block);
     
-    // 处理参数
-    namedValues.clear();
-    size_t idx = 0;
-    for (auto& arg : function->args()) {
-        arg.setName(node->getParams()[idx++]);
-        llvm::AllocaInst* alloca = createEntryBlockAlloca(function, arg.getName().str());
-        builder->CreateStore(&arg, alloca);
-        namedValues[arg.getName().str()] = alloca;
+    beginLocals(currentInfo->slots);
+    stateSlotBase = nullptr;
+    auto argIt = function->arg_begin();
+    if (currentInfo->hasUpvalues()) {
+        if (currentInfo->escapes) {
+            emitClosureEnvCheck(currentInfo, &*argIt);
+        }
+        bindUpvalues(&*argIt++);
+    }
+    
+    // 处理参数：参数占前面的槽
+    for (size_t i = 0; i < node->getParams().size(); ++i) {
+        declareLocal(static_cast<int>(i), &*argIt++);
     }
+    emitEntryBudgetCheck(true);
     
     // 生成函数体
     for (const auto& stmt : node->getBody()) {
-        stmt->accept(*this);
+        generateStatement(stmt.get());
     }
     
     // 确保有返回值
-    if (!block->getTerminator()) {
+    if (!builder->GetInsertBlock()->getTerminator()) {
+        emitBudgetSave();
         if (function->getReturnType()->isStructTy()) {
             llvm::Value* returnStruct = llvm::UndefValue::get(function->getReturnType());
             returnStruct = builder->CreateInsertValue(returnStruct,
@@ -343,6 +701,33 @@ void CodeGenerator::visit(FunctionDecl* node) {
             builder->CreateRet(llvm::ConstantFP::get(*context, llvm::APFloat(0.0)));
         }
     }
+    sealAllBlocks();
+}
+
+// 从 upvals 中取出捕获变量的单元
+void CodeGenerator::bindUpvalues(llvm::Value* upvals) {
+    llvm::Type* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+    for (size_t i = 0; i < currentInfo->upvalues.size(); ++i) {
+        const auto& upvalue = currentInfo->upvalues[i];
+        llvm::Value* slot = builder->CreateConstGEP1_64(ptrTy, upvals, i);
+        llvm::Value* cell = builder->CreateLoad(ptrTy, slot, currentInfo->upvalueName(i) + ".cell");
+        upvalueCells[upvalue] = cell;
+        upvalueSlots.push_back(cell);
+    }
+}
+
+void CodeGenerator::visit(FunctionDecl* node) {
+    // 函数体在 generateCode 中单独生成，这里只需更新重新定义的函数的当前定义，
+    // 或者为逃逸闭包保存它捕获的变量
+    if (redefinitions.count(node->getName())) {
+        builder->CreateStore(getDefinition(node), getFunctionSlot(node->getName()));
+        return;
+    }
+    FunctionInfo* info = closures.getInfo(node);
+    if (!info || !info->escapes || !info->hasUpvalues()) {
+        return;
+    }
+    createUpvalueArray(info, true);
 }
 
 void CodeGenerator::visit(ReturnStmt* node) {
@@ -350,6 +735,20 @@ void CodeGenerator::visit(ReturnStmt* node) {
         throw std::runtime_error("Return statement outside of function");
     }
     
+    // 协程体返回时把第一个返回值交给 resume，并停在最终挂起点
+    if (coroState) {
+        llvm::Value* value = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+        if (!node->getValues().empty()) {
+            node->getValues()[0]->accept(*this);
+            value = lastValue;
+            if (value->getType()->isStructTy()) {
+                value = builder->CreateExtractValue(value, 0);
+            }
+        }
+        emitCoroutineReturn(value);
+        return;
+    }
+    
     llvm::Type* returnTy = currentFunction->getReturnType();
     if (llvm::StructType* structTy = llvm::dyn_cast<llvm::StructType>(returnTy)) {
         // 处理多返回值
@@ -376,6 +775,7 @@ void CodeGenerator::visit(ReturnStmt* node) {
                 llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), i);
         }
         
+        emitBudgetSave();
         builder->CreateRet(returnStruct);
     } else {
         // 单返回值
@@ -385,26 +785,362 @@ void CodeGenerator::visit(ReturnStmt* node) {
             if (lastValue->getType()->isStructTy()) {
                 lastValue = builder->CreateExtractValue(lastValue, 0);
             }
+            emitBudgetSave();
             builder->CreateRet(lastValue);
         } else {
+            emitBudgetSave();
             builder->CreateRet(llvm::ConstantFP::get(*context, llvm::APFloat(0.0)));
         }
     }
 }
 
 void CodeGenerator::visit(LocalVarDecl* node) {
+    // 不逃逸的表不分配：字段先置为 nil，再按构造器中的顺序写入
+    if (const std::vector<int>* fields = scalarTables.getFields(node)) {
+        for (int slot : *fields) {
+            writeLocal(slot, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)));
+        }
+        for (const auto& field : static_cast<TableExpr*>(node->getInitializer())->getFields()) {
+            writeLocal(scalarTables.getFieldSlot(field.key.get()), generateValue(field.value.get()));
+        }
+        return;
+    }
+    
+    // 先求初始值，使 local x = x 中右侧的 x 指向外层变量
+    llvm::Value* value = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
     if (node->getInitializer()) {
         node->getInitializer()->accept(*this);
-        llvm::AllocaInst* alloca = builder->CreateAlloca(
-            llvm::Type::getDoubleTy(*context), nullptr, node->getName());
-        builder->CreateStore(lastValue, alloca);
+        value = lastValue;
+        if (value->getType()->isStructTy()) {
+            value = builder->CreateExtractValue(value, 0);
+        }
+    }
+    declareLocal(node->getSlot(), value);
+}
+
+void CodeGenerator::visit(AssignStmt* node) {
+    node->getValue()->accept(*this);
+    llvm::Value* value = lastValue;
+    if (value->getType()->isStructTy()) {
+        value = builder->CreateExtractValue(value, 0);
     }
+    writeVariable(*node, node->getName(), value);
 }
 
 void CodeGenerator::visit(StringExpr* node) {
-    llvm::Value* str = builder->CreateGlobalString(node->getValue());
-    lastValue = builder->CreatePointerCast(str, 
-        llvm::PointerType::get(builder->getInt8Ty(), 0));
+    lastValue = getStringConstant(node->getValue());
+}
+
+// 字符串常量：相同内容共用一个全局字符串，值是装箱后的常量表达式
+llvm::Constant* CodeGenerator::getStringConstant(const std::string& value) {
+    auto it = strings.find(value);
+    if (it != strings.end()) {
+        return it->second;
+    }
+    llvm::Constant* data = builder->CreateGlobalString(value, ".str");
+    llvm::Constant* bits = llvm::ConstantExpr::getAdd(
+        llvm::ConstantExpr::getPtrToInt(data, builder->getInt64Ty()),
+        builder->getInt64(LUA_TAG_STRING << LUA_TAG_SHIFT));
+    llvm::Constant* boxed = llvm::ConstantExpr::getBitCast(bits, builder->getDoubleTy());
+    strings[value] = boxed;
+    return boxed;
+}
+
+void CodeGenerator::visit(IndexExpr* node) {
+    int field = scalarTables.getFieldSlot(node);
+    if (field >= 0) {
+        lastValue = readLocal(field, builder->GetInsertBlock());
+        return;
+    }
+    llvm::Value* object = generateValue(node->getObject());
+    llvm::Value* key = generateValue(node->getKey());
+    lastValue = builder->CreateCall(module->getFunction("lua_index"), {object, key}, "index");
+}
+
+void CodeGenerator::visit(IndexAssignStmt* node) {
+    int field = scalarTables.getFieldSlot(node->getTarget());
+    if (field >= 0) {
+        writeLocal(field, generateValue(node->getValue()));
+        return;
+    }
+    llvm::Value* object = generateValue(node->getTarget()->getObject());
+    llvm::Value* key = generateValue(node->getTarget()->getKey());
+    llvm::Value* value = generateValue(node->getValue());
+    emitAllocationSite(LUA_ALLOC_SETINDEX);
+    builder->CreateCall(module->getFunction("lua_setindex"), {object, key, value});
+    endAllocationSite();
+}
+
+// 表构造器：键和值都是字面量的字段在编译期按运行时的哈希函数布局成只读数据，
+// 运行时表直接引用这块数据（写时复制），其余字段逐个写入
+void CodeGenerator::visit(TableExpr* node) {
+    std::map<std::string, ConstantField> constants;
+    std::set<std::string> dynamicKeys;
+    std::vector<const TableExpr::Field*> dynamicFields;
+    
+    for (const auto& field : node->getFields()) {
+        // 列表和记录的键总是字面量；同一个键以最后一次出现为准
+        std::string identity;
+        uint64_t hash = 0;
+        llvm::Constant* key = getConstantKey(field.key.get(), identity, hash);
+        if (key && !dynamicKeys.count(identity)) {
+            if (dynamic_cast<NilExpr*>(field.value.get())) {
+                constants.erase(identity);
+                continue;
+            }
+            if (llvm::Constant* value = getConstantValue(field.value.get())) {
+                constants[identity] = {hash, key, value};
+                continue;
+            }
+        }
+        if (key) {
+            constants.erase(identity);
+            dynamicKeys.insert(identity);
+        }
+        dynamicFields.push_back(&field);
+    }
+    
+    llvm::Value* table;
+    if (constants.empty()) {
+        if (node->getSize()) {
+            // n 可以是任意值，由运行时检查并限制预留的大小
+            llvm::Value* size = generateValue(node->getSize());
+            emitAllocationSite(LUA_ALLOC_TABLE);
+            table = builder->CreateCall(module->getFunction("lua_table_sized"), {size}, "table");
+        } else {
+            llvm::Value* sizeHint = builder->getInt32(dynamicFields.size());
+            emitAllocationSite(LUA_ALLOC_TABLE);
+            table = builder->CreateCall(module->getFunction("lua_table_new"), {sizeHint}, "table");
+        }
+    } else {
+        std::vector<ConstantField> fields;
+        for (const auto& entry : constants) {
+            fields.push_back(entry.second);
+        }
+        emitAllocationSite(LUA_ALLOC_TABLE);
+        table = emitConstantTable(fields);
+    }
+    endAllocationSite();
+    
+    for (const TableExpr::Field* field : dynamicFields) {
+        llvm::Value* key = generateValue(field->key.get());
+        llvm::Value* value = generateValue(field->value.get());
+        emitAllocationSite(LUA_ALLOC_TABLE);
+        builder->CreateCall(module->getFunction("lua_table_set"), {table, key, value});
+        endAllocationSite();
+    }
+    lastValue = boxPointer(table, LUA_TAG_TABLE);
+    
+    // @name{...}：以表为参数调用 name，表达式的值仍然是表
+    if (!node->getConstructor().empty()) {
+        const std::string& name = node->getConstructor();
+        llvm::Function* function = module->getFunction(name);
+        if (!function) {
+            throw std::runtime_error("Unknown function: " + name);
+        }
+        std::vector<llvm::Value*> args;
+        FunctionInfo* info = closures.lookup(name);
+        if (info && info->hasUpvalues()) {
+            if (info->escapes) {
+                args.push_back(builder->CreateLoad(
+                    llvm::PointerType::get(builder->getInt8Ty(), 0),
+                    getClosureEnv(info), name + ".upvals"));
+            } else {
+                args.push_back(createUpvalueArray(info, false));
+            }
+        }
+        llvm::Value* boxed = lastValue;
+        args.push_back(boxed);
+        while (args.size() < function->arg_size()) {
+            args.push_back(llvm::ConstantFP::get(*context, llvm::APFloat(0.0)));
+        }
+        emitFunctionCall(function, args, name);
+        lastValue = boxed;
+    }
+}
+
+// 表构造器中的字面量键：数字按位模式（-0 与 0 相同），字符串按内容
+llvm::Constant* CodeGenerator::getConstantKey(Expr* expr, std::string& identity, uint64_t& hash) {
+    if (auto* number = dynamic_cast<NumberExpr*>(expr)) {
+        double value = number->getValue() == 0 ? 0.0 : number->getValue();
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        identity = "n" + std::to_string(bits);
+        hash = lua_hash_bits(bits);
+        return llvm::ConstantFP::get(*context, llvm::APFloat(value));
+    }
+    if (auto* string = dynamic_cast<StringExpr*>(expr)) {
+        identity = "s" + string->getValue();
+        hash = lua_hash_string(string->getValue().c_str());
+        return getStringConstant(string->getValue());
+    }
+    return nullptr;
+}
+
+llvm::Constant* CodeGenerator::getConstantValue(Expr* expr) {
+    if (auto* number = dynamic_cast<NumberExpr*>(expr)) {
+        return llvm::ConstantFP::get(*context, llvm::APFloat(number->getValue()));
+    }
+    if (auto* string = dynamic_cast<StringExpr*>(expr)) {
+        return getStringConstant(string->getValue());
+    }
+    return nullptr;
+}
+
+// 按 lua_table_get 的探测顺序把键值对放进只读数组，返回引用它的表
+llvm::Value* CodeGenerator::emitConstantTable(const std::vector<ConstantField>& fields) {
+    uint32_t count = fields.size();
+    uint32_t capacity = lua_table_capacity(count);
+    uint32_t mask = capacity - 1;
+    llvm::Constant* emptyKey = llvm::ConstantFP::get(*context,
+        llvm::APFloat(llvm::APFloat::IEEEdouble(), llvm::APInt(64, LUA_EMPTY_KEY)));
+    llvm::Constant* nil = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+    std::vector<llvm::Constant*> data(2 * static_cast<size_t>(capacity));
+    for (uint32_t i = 0; i < capacity; ++i) {
+        data[2 * i] = emptyKey;
+        data[2 * i + 1] = nil;
+    }
+    
+    bool relocated = false;
+    for (const ConstantField& field : fields) {
+        uint32_t slot = static_cast<uint32_t>(field.hash) & mask;
+        while (data[2 * slot] != emptyKey) {
+            slot = (slot + 1) & mask;
+        }
+        data[2 * slot] = field.key;
+        data[2 * slot + 1] = field.value;
+        relocated |= !llvm::isa<llvm::ConstantFP>(field.key) || !llvm::isa<llvm::ConstantFP>(field.value);
+    }
+    
+    // 只有数字时用紧凑的 ConstantDataArray，字符串需要重定位
+    llvm::Constant* initializer;
+    if (relocated) {
+        initializer = llvm::ConstantArray::get(
+            llvm::ArrayType::get(builder->getDoubleTy(), data.size()), data);
+    } else {
+        std::vector<uint64_t> bits(data.size());
+        for (size_t i = 0; i < data.size(); ++i) {
+            bits[i] = llvm::cast<llvm::ConstantFP>(data[i])->getValueAPF().bitcastToAPInt().getZExtValue();
+        }
+        initializer = llvm::ConstantDataArray::getFP(builder->getDoubleTy(), bits);
+    }
+    auto* global = new llvm::GlobalVariable(*module, initializer->getType(), true,
+        llvm::GlobalValue::PrivateLinkage, initializer, "table.const");
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    global->setAlignment(llvm::Align(8));
+    
+    return builder->CreateCall(module->getFunction("lua_table_constant"),
+        {global, builder->getInt32(capacity), builder->getInt32(count)}, "table");
+}
+
+// 分配之前登记分配点：每个 (行, 种类) 一个只读的 LuaAllocSite，运行时按它的地址统计
+void CodeGenerator::emitAllocationSite(int32_t kind) {
+    if (profileSource.empty()) {
+        return;
+    }
+    llvm::GlobalVariable*& site = allocationSites[{statementLine, kind}];
+    if (!site) {
+        llvm::Type* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+        llvm::StructType* siteType = llvm::StructType::get(*context,
+            {ptrTy, builder->getInt32Ty(), builder->getInt32Ty()});
+        llvm::GlobalVariable* source = module->getGlobalVariable("alloc.source", true);
+        if (!source) {
+            source = builder->CreateGlobalString(profileSource, "alloc.source", 0, module.get());
+        }
+        site = new llvm::GlobalVariable(*module, siteType, true, llvm::GlobalValue::PrivateLinkage,
+            llvm::ConstantStruct::get(siteType, {source, builder->getInt32(statementLine), builder->getInt32(kind)}),
+            "alloc.site");
+    }
+    builder->CreateCall(module->getFunction("lua_profile_site"), {site});
+}
+
+// 分配点只对紧接着的一次运行时调用有效，调用返回后恢复为未知分配点
+void CodeGenerator::endAllocationSite() {
+    if (profileSource.empty()) {
+        return;
+    }
+    builder->CreateCall(module->getFunction("lua_profile_site"),
+        {llvm::ConstantPointerNull::get(llvm::PointerType::get(builder->getInt8Ty(), 0))});
+}
+
+// 普通函数把预算复制到自己的 budget.local 中（mem2reg 之后留在寄存器里）：入口从当前线程的
+// 计数器读入，调用 Lua 函数之前和返回之前写回，调用之后重新读入。调度函数可能让脚本在
+// 另一个线程上继续执行，所以每次都重新取计数器的地址。协程体直接读写线程的计数器
+void CodeGenerator::emitEntryBudgetCheck(bool cacheCounter) {
+    budgetLocal = nullptr;
+    if (preemption && cacheCounter) {
+        budgetLocal = createEntryBlockAlloca(currentFunction, "budget.local", builder->getInt64Ty());
+        emitBudgetReload();
+    }
+    emitBudgetCheck();
+}
+
+void CodeGenerator::emitBudgetSave() {
+    if (!budgetLocal) {
+        return;
+    }
+    llvm::Value* counter = builder->CreateCall(module->getFunction("lua_budget_counter"), {}, "budget.counter");
+    builder->CreateStore(builder->CreateLoad(builder->getInt64Ty(), budgetLocal, "budget"), counter);
+}
+
+void CodeGenerator::emitBudgetReload() {
+    if (!budgetLocal) {
+        return;
+    }
+    llvm::Value* counter = builder->CreateCall(module->getFunction("lua_budget_counter"), {}, "budget.counter");
+    builder->CreateStore(builder->CreateLoad(builder->getInt64Ty(), counter, "budget"), budgetLocal);
+}
+
+// 检查点只有一次减法和一个几乎不会跳转的分支，耗尽时的调用放在冷路径上
+void CodeGenerator::emitBudgetCheck() {
+    if (!preemption || builder->GetInsertBlock()->getTerminator()) {
+        return;
+    }
+    llvm::Value* counter = budgetLocal;
+    if (!counter) {
+        counter = builder->CreateCall(module->getFunction("lua_budget_counter"), {}, "budget.counter");
+    }
+    llvm::Value* budget = builder->CreateLoad(builder->getInt64Ty(), counter, "budget");
+    llvm::Value* left = builder->CreateSub(budget, builder->getInt64(1), "budget.left");
+    builder->CreateStore(left, counter);
+    
+    llvm::BasicBlock* preemptBB = llvm::BasicBlock::Create(*context, "preempt", currentFunction);
+    llvm::BasicBlock* continueBB = llvm::BasicBlock::Create(*context, "budget.ok", currentFunction);
+    builder->CreateCondBr(builder->CreateICmpSLT(left, builder->getInt64(0)), preemptBB, continueBB,
+        llvm::MDBuilder(*context).createBranchWeights(1, LUA_DEFAULT_BUDGET));
+    sealBlock(preemptBB);
+    
+    builder->SetInsertPoint(preemptBB);
+    llvm::Value* refilled = builder->CreateCall(module->getFunction("lua_preempt"), {}, "budget.refilled");
+    builder->CreateStore(refilled, counter);
+    builder->CreateBr(continueBB);
+    sealBlock(continueBB);
+    builder->SetInsertPoint(continueBB);
+}
+
+// 生成语句前切换到它的源码位置，语句内生成的指令都带上这个位置；
+// 当前块已经结束（return 之后保留下来的函数声明）时不再生成
+void CodeGenerator::generateStatement(Stmt* stmt) {
+    if (builder->GetInsertBlock()->getTerminator()) {
+        return;
+    }
+    if (stmt->getLine() > 0) {
+        statementLine = stmt->getLine();
+    }
+    if (debugBuilder && stmt->getLine() > 0) {
+        builder->SetCurrentDebugLocation(llvm::DILocation::get(
+            *context, stmt->getLine(), stmt->getColumn(), currentFunction->getSubprogram()));
+    }
+    stmt->accept(*this);
+}
+
+// 求值表达式，多返回值只取第一个
+llvm::Value* CodeGenerator::generateValue(Expr* expr) {
+    expr->accept(*this);
+    if (lastValue->getType()->isStructTy()) {
+        return builder->CreateExtractValue(lastValue, 0);
+    }
+    return lastValue;
 }
 
 void CodeGenerator::visit(NilExpr* node) {
@@ -412,16 +1148,23 @@ void CodeGenerator::visit(NilExpr* node) {
 }
 
 void CodeGenerator::visit(UnaryExpr* node) {
+    // not 的操作数本身是条件时按条件跳转生成，否则直接 select
+    if (node->getOp() == UnaryOp::NOT_OP) {
+        if (isCondition(node->getExpr())) {
+            lastValue = emitCondition(node);
+        } else {
+            lastValue = builder->CreateSelect(emitTruth(generateValue(node->getExpr())),
+                llvm::ConstantFP::get(*context, llvm::APFloat(0.0)),
+                llvm::ConstantFP::get(*context, llvm::APFloat(1.0)), "not");
+        }
+        return;
+    }
     node->getExpr()->accept(*this);
     llvm::Value* exprValue = lastValue;
     
     switch (node->getOp()) {
-        case UnaryOp::NOT_OP:
-            lastValue = builder->CreateFCmpOEQ(
-                exprValue, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)));
-            break;
         case UnaryOp::NEG:
-            lastValue = builder->CreateFNeg(exprValue);
+            lastValue = emitArith(LUA_EVENT_UNM, exprValue, exprValue, builder->CreateFNeg(exprValue));
             break;
         default:
             throw std::runtime_error("Unknown unary operator");
@@ -456,47 +1199,133 @@ void CodeGenerator::saveModuleToFile(const std::string& filename) {
     dest.close();
 }
 
-void CodeGenerator::visit(CallExpr* node) {
-    std::string calleeName = node->getCallee();
-    llvm::Function* callee = module->getFunction(calleeName);
-    
-    if (!callee) {
-        if (calleeName == "print") {
+// 目标文件先写到临时文件，再用系统的 C 编译器驱动链接成共享库
+void CodeGenerator::emitSharedLibrary(const std::string& filename) {
+    if (!targetMachine) {
+        throw std::runtime_error("Module was not generated for a shared library");
+    }
+    llvm::SmallString<128> objectPath;
+    int fd;
+    if (std::error_code ec = llvm::sys::fs::createTemporaryFile("luac", "o", fd, objectPath)) {
+        throw std::runtime_error("Could not create object file: " + ec.message());
+    }
+    {
+        llvm::raw_fd_ostream dest(fd, true);
+        llvm::legacy::PassManager passManager;
+#if LLVM_VERSION_MAJOR >= 18
+        llvm::CodeGenFileType fileType = llvm::CodeGenFileType::ObjectFile;
+#else
+        llvm::CodeGenFileType fileType = llvm::CGFT_ObjectFile;
+#endif
+        if (targetMachine->addPassesToEmitFile(passManager, dest, nullptr, fileType)) {
+            throw std::runtime_error("Target machine cannot emit object files");
+        }
+        passManager.run(*module);
+    }
+    
+    const char* runtimeDir = getenv("LUA_RUNTIME_LIBRARY_DIR");
+    std::string libraryDir = runtimeDir ? runtimeDir : LUA_RUNTIME_LIBRARY_DIR;
+    auto linker = llvm::sys::findProgramByName("cc");
+    if (!linker) {
+        llvm::sys::fs::remove(objectPath);
+        throw std::runtime_error("Could not find the system linker driver (cc)");
+    }
+    std::vector<std::string> args = {
+        *linker, "-shared", "-o", filename, objectPath.str().str(),
+        "-L" + libraryDir, "-lluaruntime", "-Wl,-rpath," + libraryDir,
+    };
+    std::vector<llvm::StringRef> argRefs(args.begin(), args.end());
+    std::string error;
+    int status = llvm::sys::ExecuteAndWait(*linker, argRefs, std::nullopt, {}, 0, 0, &error);
+    llvm::sys::fs::remove(objectPath);
+    if (status != 0) {
+        throw std::runtime_error("Linking " + filename + " failed" + (error.empty() ? "" : ": " + error));
+    }
+}
+
+void CodeGenerator::visit(CallExpr* node) {
+    std::string calleeName = node->getCallee();
+    llvm::Function* callee = module->getFunction(calleeName);
+    
+    if (!callee) {
+        if (calleeName.compare(0, 10, "coroutine.") == 0) {
+            emitCoroutineCall(node);
+            return;
+        }
+        if (calleeName.compare(0, 6, "table.") == 0) {
+            emitBuiltinCall(node, "lua_array_" + calleeName.substr(6));
+            return;
+        }
+        if (calleeName.compare(0, 9, "parallel.") == 0) {
+            emitParallelCall(node);
+            return;
+        }
+        if (calleeName == "setmetatable" || calleeName == "getmetatable") {
+            emitBuiltinCall(node, "lua_" + calleeName);
+            return;
+        }
+        if (calleeName == "pcall") {
+            emitProtectedCall(node);
+            return;
+        }
+        if (calleeName == "error") {
+            // error(v [, level])：抛出 v，不附加位置信息
+            const auto& arguments = node->getArguments();
+            llvm::Value* value = arguments.empty() ? llvm::ConstantFP::get(*context, llvm::APFloat(0.0))
+                                                   : generateValue(arguments[0].get());
+            builder->CreateCall(module->getFunction("lua_error"), {value});
+            lastValue = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+            return;
+        }
+        if (calleeName == "print") {
             // 处理 print 函数调用
             std::vector<llvm::Value*> args;
             for (const auto& arg : node->getArguments()) {
                 arg->accept(*this);
                 args.push_back(lastValue);
             }
-            
-            // 创建格式字符串
-            llvm::Value* formatStr = builder->CreateGlobalString("%g\n", "fmt");
-            
-            // 调用 printf
-            std::vector<llvm::Value*> printfArgs;
-            printfArgs.push_back(builder->CreatePointerCast(formatStr,
-                llvm::PointerType::get(builder->getInt8Ty(), 0)));
-            printfArgs.push_back(args[0]);
-            
-            lastValue = builder->CreateCall(module->getFunction("printf"), printfArgs);
+            emitPrint(args);
+            lastValue = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
             return;
         }
         throw std::runtime_error("Unknown function: " + calleeName);
     }
     
-    // 生成参数
+    // 创建函数调用
+    std::vector<llvm::Value*> args = generateArguments(calleeName, callee, node->getArguments(), 0);
+    lastValue = emitFunctionCall(callee, args, calleeName);
+}
+
+// 从第 first 个实参开始生成调用 callee 的参数
+std::vector<llvm::Value*> CodeGenerator::generateArguments(const std::string& calleeName, llvm::Function* callee,
+    const std::vector<std::unique_ptr<Expr>>& arguments, size_t first) {
+    // 闭包的隐藏参数：逃逸闭包从 <name>.env 取，否则在栈上就地构造
     std::vector<llvm::Value*> args;
-    for (const auto& arg : node->getArguments()) {
-        arg->accept(*this);
+    size_t arity = callee->arg_size();
+    FunctionInfo* info = closures.lookup(calleeName);
+    if (info && info->hasUpvalues()) {
+        if (info->escapes) {
+            args.push_back(builder->CreateLoad(
+                llvm::PointerType::get(builder->getInt8Ty(), 0),
+                getClosureEnv(info), calleeName + ".upvals"));
+        } else {
+            args.push_back(createUpvalueArray(info, false));
+        }
+        --arity;
+    }
+    
+    // 生成参数
+    for (size_t i = first; i < arguments.size(); ++i) {
+        arguments[i]->accept(*this);
         
         // 如果参数是函数调用的结果，并且是结构体类型
         if (lastValue->getType()->isStructTy()) {
             // 如果当前函数只需要一个参数，提取第一个元素
-            if (callee->arg_size() == 1) {
+            if (arity == 1) {
                 lastValue = builder->CreateExtractValue(lastValue, 0);
             }
             // 如果当前函数需要两个参数，提取两个元素
-            else if (callee->arg_size() == 2) {
+            else if (arity == 2) {
                 llvm::Value* firstValue = builder->CreateExtractValue(lastValue, 0);
                 llvm::Value* secondValue = builder->CreateExtractValue(lastValue, 1);
                 args.push_back(firstValue);
@@ -506,22 +1335,258 @@ void CodeGenerator::visit(CallExpr* node) {
         }
         args.push_back(lastValue);
     }
+    return args;
+}
+
+// 参数和返回值都是装箱的值的运行时函数，例如 table.sum(t) 对应 lua_array_sum，缺少的参数为 nil
+void CodeGenerator::emitBuiltinCall(CallExpr* node, const std::string& runtimeName) {
+    const std::string& calleeName = node->getCallee();
+    llvm::Function* function = module->getFunction(runtimeName);
+    if (!function) {
+        throw std::runtime_error("Unknown function: " + calleeName);
+    }
+    const auto& arguments = node->getArguments();
+    if (arguments.size() > function->arg_size()) {
+        throw std::runtime_error(calleeName + " expects at most " +
+            std::to_string(function->arg_size()) + " arguments");
+    }
+    std::vector<llvm::Value*> args;
+    for (const auto& arg : arguments) {
+        args.push_back(generateValue(arg.get()));
+    }
+    while (args.size() < function->arg_size()) {
+        args.push_back(llvm::ConstantFP::get(*context, llvm::APFloat(0.0)));
+    }
+    emitAllocationSite(LUA_ALLOC_BUILTIN);
+    lastValue = builder->CreateCall(function, args);
+    endAllocationSite();
+}
+
+// parallel.map(f, t) 和 parallel.for(f, first, last)：f 在多个线程上同时执行，
+// 必须是纯函数（只读写参数和局部变量、只调用纯函数），不会读写共享的全局变量和表
+void CodeGenerator::emitParallelCall(CallExpr* node) {
+    const std::string& calleeName = node->getCallee();
+    size_t arity = calleeName == "parallel.map" ? 2 : calleeName == "parallel.for" ? 3 : 0;
+    if (!arity) {
+        throw std::runtime_error("Unknown function: " + calleeName);
+    }
+    const auto& arguments = node->getArguments();
+    if (arguments.size() != arity) {
+        throw std::runtime_error(calleeName + " expects " + std::to_string(arity) + " arguments");
+    }
+    auto* function = dynamic_cast<VarExpr*>(arguments[0].get());
+    if (!function || function->getBinding() != Binding::GLOBAL || !module->getFunction(function->getName())) {
+        throw std::runtime_error(calleeName + " expects a function name as its first argument");
+    }
+    if (!optimizer.isPure(function->getName())) {
+        throw std::runtime_error(calleeName + ": function '" + function->getName() +
+            "' is not pure (it may only use its parameters and locals and call pure functions)");
+    }
+    std::vector<llvm::Value*> args;
+    for (const auto& arg : arguments) {
+        args.push_back(generateValue(arg.get()));
+    }
+    emitAllocationSite(LUA_ALLOC_BUILTIN);
+    lastValue = builder->CreateCall(module->getFunction("lua_parallel_" + calleeName.substr(9)), args);
+    endAllocationSite();
+}
+
+// 多次定义的顶层函数：所有定义的签名相同、都不是闭包或协程体时按定义分别生成，
+// 否则仍然只生成第一个定义
+void CodeGenerator::collectRedefinitions() {
+    std::map<std::string, std::vector<FunctionDecl*>> byName;
+    for (FunctionDecl* decl : closures.getFunctions()) {
+        byName[decl->getName()].push_back(decl);
+    }
+    for (auto& [name, decls] : byName) {
+        if (decls.size() < 2) {
+            continue;
+        }
+        bool separate = true;
+        for (FunctionDecl* decl : decls) {
+            FunctionInfo* info = closures.getInfo(decl);
+            if (info->isClosure() || info->hasUpvalues() || info->coroutine ||
+                decl->getParams().size() != decls.front()->getParams().size() ||
+                hasMultipleReturns(decl) != hasMultipleReturns(decls.front())) {
+                separate = false;
+                break;
+            }
+        }
+        if (separate) {
+            redefinitions[name] = decls;
+        }
+    }
+}
+
+// 函数声明对应的 LLVM 函数，之前的 chunk 定义的函数只有按名字的声明
+llvm::Function* CodeGenerator::getDefinition(FunctionDecl* node) {
+    auto it = definitions.find(node);
+    return it != definitions.end() ? it->second : module->getFunction(node->getName());
+}
+
+// 重新定义的函数的当前定义，初始为第一个定义
+llvm::Value* CodeGenerator::getFunctionSlot(const std::string& name) {
+    std::string slotName = "function." + name;
+    if (reentrant) {
+        return getStateSlot(slotName);
+    }
+    if (llvm::GlobalVariable* slot = module->getGlobalVariable(slotName, true)) {
+        return slot;
+    }
+    return new llvm::GlobalVariable(*module, llvm::PointerType::get(builder->getInt8Ty(), 0), false,
+        llvm::GlobalValue::InternalLinkage, getDefinition(redefinitions[name].front()), slotName);
+}
+
+// 调用 Lua 函数。重新定义的函数预测为当前语句之前最后一个定义（没有时为第一个），
+// 守卫只比较一次函数指针：命中时直接调用，否则通过当前定义的指针间接调用
+llvm::Value* CodeGenerator::emitFunctionCall(llvm::Function* callee, const std::vector<llvm::Value*>& args,
+                                             const std::string& name) {
+    auto redefined = redefinitions.find(name);
+    emitBudgetSave();
+    if (redefined == redefinitions.end()) {
+        llvm::CallBase* call = createCall(callee->getFunctionType(), callee, args, name + "_result");
+        call->setCallingConv(callee->getCallingConv());
+        emitBudgetReload();
+        return call;
+    }
+    FunctionDecl* predictedDecl = redefined->second.front();
+    for (FunctionDecl* decl : redefined->second) {
+        if (decl->getLine() <= statementLine) {
+            predictedDecl = decl;
+        }
+    }
+    llvm::Function* predicted = getDefinition(predictedDecl);
     
-    // 创建函数调用
-    lastValue = builder->CreateCall(callee, args, calleeName + "_result");
+    llvm::Value* current = builder->CreateLoad(llvm::PointerType::get(builder->getInt8Ty(), 0),
+        getFunctionSlot(name), name + ".current");
+    llvm::Value* isPredicted = builder->CreateICmpEQ(current, predicted, name + ".guard");
+    llvm::BasicBlock* directBB = llvm::BasicBlock::Create(*context, name + ".direct", currentFunction);
+    llvm::BasicBlock* indirectBB = llvm::BasicBlock::Create(*context, name + ".indirect", currentFunction);
+    llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(*context, name + ".merge", currentFunction);
+    builder->CreateCondBr(isPredicted, directBB, indirectBB,
+        llvm::MDBuilder(*context).createBranchWeights(2000, 1));
+    sealBlock(directBB);
+    sealBlock(indirectBB);
+    
+    builder->SetInsertPoint(directBB);
+    llvm::CallBase* direct = createCall(predicted->getFunctionType(), predicted, args, name + "_result");
+    direct->setCallingConv(llvm::CallingConv::Fast);
+    llvm::BasicBlock* directEnd = builder->GetInsertBlock();
+    builder->CreateBr(mergeBB);
+    
+    builder->SetInsertPoint(indirectBB);
+    llvm::CallBase* indirect = createCall(predicted->getFunctionType(), current, args, name + "_result");
+    indirect->setCallingConv(llvm::CallingConv::Fast);
+    llvm::BasicBlock* indirectEnd = builder->GetInsertBlock();
+    builder->CreateBr(mergeBB);
+    
+    sealBlock(mergeBB);
+    builder->SetInsertPoint(mergeBB);
+    llvm::PHINode* result = builder->CreatePHI(predicted->getReturnType(), 2, name + "_result");
+    result->addIncoming(direct, directEnd);
+    result->addIncoming(indirect, indirectEnd);
+    emitBudgetReload();
+    return result;
 }
 
-void CodeGenerator::visit(VarExpr* expr) {
-    llvm::AllocaInst* alloca = namedValues[expr->getName()];
-    if (!alloca) {
-        throw std::runtime_error("Unknown variable: " + expr->getName());
+// pcall 保护的调用点（landingPad 不为空）生成 invoke，正常返回后在新的基本块中继续
+llvm::CallBase* CodeGenerator::createCall(llvm::FunctionType* type, llvm::Value* callee,
+                                          llvm::ArrayRef<llvm::Value*> args, const std::string& name) {
+    if (!landingPad) {
+        return builder->CreateCall(type, callee, args, type->getReturnType()->isVoidTy() ? "" : name);
+    }
+    llvm::BasicBlock* normalBB = llvm::BasicBlock::Create(*context, name + ".ok", currentFunction);
+    llvm::CallBase* call = builder->CreateInvoke(type, callee, normalBB, landingPad, args, name);
+    sealBlock(normalBB);
+    builder->SetInsertPoint(normalBB);
+    return call;
+}
+
+// pcall(f, ...)：以保护模式调用 f，返回状态和 f 的第一个返回值或错误值。
+// 正常路径只是一条 invoke，错误由 C++ 异常表驱动的展开送到这里的 landingpad
+void CodeGenerator::emitProtectedCall(CallExpr* node) {
+    const auto& arguments = node->getArguments();
+    auto* target = arguments.empty() ? nullptr : dynamic_cast<VarExpr*>(arguments[0].get());
+    llvm::Function* callee = target ? module->getFunction(target->getName()) : nullptr;
+    if (!callee) {
+        throw std::runtime_error("pcall expects the name of a function");
+    }
+    const std::string& name = target->getName();
+    std::vector<llvm::Value*> args = generateArguments(name, callee, arguments, 1);
+    
+    currentFunction->setPersonalityFn(getPersonality());
+    llvm::BasicBlock* errorBB = llvm::BasicBlock::Create(*context, "pcall.error", currentFunction);
+    llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(*context, "pcall.done", currentFunction);
+    
+    llvm::BasicBlock* outerPad = landingPad;
+    landingPad = errorBB;
+    llvm::Value* value = emitFunctionCall(callee, args, name);
+    landingPad = outerPad;
+    if (value->getType()->isStructTy()) {
+        value = builder->CreateExtractValue(value, 0);
     }
-    lastValue = builder->CreateLoad(alloca->getAllocatedType(), alloca, expr->getName().c_str());
+    llvm::BasicBlock* okEnd = builder->GetInsertBlock();
+    builder->CreateBr(mergeBB);
+    
+    sealBlock(errorBB);
+    builder->SetInsertPoint(errorBB);
+    llvm::LandingPadInst* pad = builder->CreateLandingPad(
+        llvm::StructType::get(llvm::PointerType::get(builder->getInt8Ty(), 0), builder->getInt32Ty()), 1, "pcall.pad");
+    pad->addClause(getErrorTypeInfo());
+    // 被调用者可能已经消耗了预算，局部副本要和正常返回时一样重新读取
+    emitBudgetReload();
+    llvm::Value* error = builder->CreateCall(module->getFunction("lua_catch_error"),
+        {builder->CreateExtractValue(pad, 0)}, "error");
+    builder->CreateBr(mergeBB);
+    
+    sealBlock(mergeBB);
+    builder->SetInsertPoint(mergeBB);
+    llvm::PHINode* status = builder->CreatePHI(builder->getDoubleTy(), 2, "pcall.status");
+    status->addIncoming(llvm::ConstantFP::get(*context, llvm::APFloat(1.0)), okEnd);
+    status->addIncoming(llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), errorBB);
+    llvm::PHINode* result = builder->CreatePHI(builder->getDoubleTy(), 2, "pcall.value");
+    result->addIncoming(value, okEnd);
+    result->addIncoming(error, errorBB);
+    
+    llvm::Value* pair = llvm::UndefValue::get(
+        llvm::StructType::get(builder->getDoubleTy(), builder->getDoubleTy()));
+    pair = builder->CreateInsertValue(pair, status, 0);
+    lastValue = builder->CreateInsertValue(pair, result, 1);
+}
+
+// Lua 代码的最外层（入口函数和共享库的导出函数）：没有被 pcall 捕获的错误在这里报告并终止程序
+llvm::BasicBlock* CodeGenerator::createUncaughtHandler() {
+    currentFunction->setPersonalityFn(getPersonality());
+    llvm::BasicBlock* block = llvm::BasicBlock::Create(*context, "uncaught", currentFunction);
+    llvm::IRBuilder<> handlerBuilder(block);
+    llvm::LandingPadInst* pad = handlerBuilder.CreateLandingPad(
+        llvm::StructType::get(llvm::PointerType::get(builder->getInt8Ty(), 0), builder->getInt32Ty()), 1, "pad");
+    pad->addClause(getErrorTypeInfo());
+    handlerBuilder.CreateCall(module->getFunction("lua_uncaught_error"),
+        {handlerBuilder.CreateExtractValue(pad, 0)});
+    handlerBuilder.CreateUnreachable();
+    sealBlock(block);
+    return block;
+}
+
+llvm::Function* CodeGenerator::getPersonality() {
+    return llvm::cast<llvm::Function>(module->getOrInsertFunction("__gxx_personality_v0",
+        llvm::FunctionType::get(builder->getInt32Ty(), true)).getCallee());
+}
+
+// LuaError 的 C++ 类型信息（Itanium ABI 的名字），landingpad 只捕获 Lua 错误
+llvm::Constant* CodeGenerator::getErrorTypeInfo() {
+    return module->getOrInsertGlobal("_ZTI8LuaError", llvm::PointerType::get(builder->getInt8Ty(), 0));
+}
+
+void CodeGenerator::visit(VarExpr* expr) {
+    lastValue = readVariable(*expr, expr->getName());
 }
 
 void CodeGenerator::visit(BlockStmt* node) {
+    // 块内局部变量的作用域已经由 ClosureAnalysis 解析为槽号
     for (const auto& stmt : node->getStatements()) {
-        stmt->accept(*this);
+        generateStatement(stmt.get());
     }
 }
 
@@ -539,29 +1604,1117 @@ bool CodeGenerator::hasMultipleReturns(FunctionDecl* node) {
 
 // 添加一个辅助函数来创建entry block alloca
 llvm::AllocaInst* CodeGenerator::createEntryBlockAlloca(llvm::Function* function,
-                                                       const std::string& varName) {
+                                                       const std::string& varName,
+                                                       llvm::Type* type) {
     llvm::IRBuilder<> tmpBuilder(&function->getEntryBlock(),
                                 function->getEntryBlock().begin());
-    return tmpBuilder.CreateAlloca(llvm::Type::getDoubleTy(*context),
+    return tmpBuilder.CreateAlloca(type ? type : llvm::Type::getDoubleTy(*context),
                                  nullptr, varName);
 }
 
-void CodeGenerator::initBuiltins() {
-    // 声明 printf 函数
-    std::vector<llvm::Type*> printfArgs;
-    printfArgs.push_back(llvm::PointerType::get(builder->getInt8Ty(), 0));
-    llvm::FunctionType* printfType = llvm::FunctionType::get(
-        llvm::Type::getInt32Ty(*context), printfArgs, true);
-    printfFunc = llvm::Function::Create(
-        printfType, llvm::Function::ExternalLinkage, "printf", module.get());
+// 为被闭包捕获的参数或局部变量分配单元：被逃逸闭包捕获的放到堆上，其余留在栈帧中
+llvm::Value* CodeGenerator::createLocalStorage(int slot) {
+    const std::string& name = (*slotNames)[slot];
+    llvm::Value* storage;
+    if (currentInfo && currentInfo->boxed.count(slot)) {
+        storage = createHeapAllocation(sizeof(double), name + ".box");
+    } else {
+        storage = createEntryBlockAlloca(currentFunction, name);
+    }
+    upvalueCells[{currentInfo, slot}] = storage;
+    return storage;
+}
+
+// 逃逸闭包的变量单元和 upvals 从 lua_alloc 分配，在 LuaState 中随脚本的堆一起释放。
+// 没有 LuaState 时来自 malloc：upvals 每个闭包只有一份，但外层函数每次调用装箱的
+// 变量单元可能仍被 <name>.env 引用，运行时没有回收它们的时机，直到进程退出
+llvm::Value* CodeGenerator::createHeapAllocation(uint64_t size, const std::string& name) {
+    emitAllocationSite(LUA_ALLOC_CLOSURE);
+    llvm::Value* memory = builder->CreateCall(module->getFunction("lua_alloc"), {builder->getInt64(size)}, name);
+    endAllocationSite();
+    return memory;
+}
+
+// 构造闭包的 upvals：依次存放各个捕获变量单元的指针。
+// 逃逸闭包的 upvals 第一次执行声明语句时分配并存入 <name>.env，之后原地更新：
+// 闭包（包括协程体）在入口处就取出所有单元指针，不会再读到更新后的内容
+llvm::Value* CodeGenerator::createUpvalueArray(FunctionInfo* info, bool onHeap) {
+    llvm::Type* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+    const std::string& name = info->decl->getName();
+    size_t count = info->upvalues.size();
+    
+    llvm::Value* upvals;
+    if (onHeap) {
+        llvm::Value* env = getClosureEnv(info);
+        llvm::Value* previous = builder->CreateLoad(ptrTy, env, name + ".env");
+        llvm::BasicBlock* currentBB = builder->GetInsertBlock();
+        llvm::BasicBlock* allocBB = llvm::BasicBlock::Create(*context, "env.alloc", currentFunction);
+        llvm::BasicBlock* doneBB = llvm::BasicBlock::Create(*context, "env.done", currentFunction);
+        builder->CreateCondBr(builder->CreateIsNull(previous), allocBB, doneBB);
+        sealBlock(allocBB);
+        
+        builder->SetInsertPoint(allocBB);
+        llvm::Value* allocated = createHeapAllocation(count * sizeof(void*), name + ".upvals");
+        builder->CreateStore(allocated, env);
+        builder->CreateBr(doneBB);
+        sealBlock(doneBB);
         
-    // 声明 fflush 函数
-    std::vector<llvm::Type*> flushArgs;
-    flushArgs.push_back(llvm::PointerType::get(builder->getInt8Ty(), 0));
-    llvm::FunctionType* flushType = llvm::FunctionType::get(
-        llvm::Type::getInt32Ty(*context), flushArgs, false);
-    llvm::Function::Create(
-        flushType, llvm::Function::ExternalLinkage, "fflush", module.get());
+        builder->SetInsertPoint(doneBB);
+        llvm::PHINode* phi = builder->CreatePHI(ptrTy, 2, name + ".upvals");
+        phi->addIncoming(previous, currentBB);
+        phi->addIncoming(allocated, allocBB);
+        upvals = phi;
+    } else {
+        upvals = createEntryBlockAlloca(currentFunction, name + ".upvals",
+            llvm::ArrayType::get(ptrTy, count));
+    }
+    
+    for (size_t i = 0; i < count; ++i) {
+        llvm::Value* cell = upvalueCells[info->upvalues[i]];
+        if (!cell) {
+            throw std::runtime_error("Variable " + info->upvalueName(i) +
+                " captured by " + name + " is not visible here");
+        }
+        builder->CreateStore(cell, builder->CreateConstGEP1_64(ptrTy, upvals, i));
+    }
+    return upvals;
+}
+
+// 逃逸闭包的声明语句还没有执行过时 upvals 为空，调用它是运行时错误。
+// 普通函数在函数入口检查（错误能被包住这次调用的 pcall 捕获），协程在 coroutine.create 时检查
+void CodeGenerator::emitClosureEnvCheck(FunctionInfo* info, llvm::Value* upvals) {
+    llvm::BasicBlock* unsetBB = llvm::BasicBlock::Create(*context, "env.unset", currentFunction);
+    llvm::BasicBlock* readyBB = llvm::BasicBlock::Create(*context, "env.ready", currentFunction);
+    builder->CreateCondBr(builder->CreateIsNull(upvals), unsetBB, readyBB,
+        llvm::MDBuilder(*context).createBranchWeights(1, 2000));
+    sealBlock(unsetBB);
+    sealBlock(readyBB);
+    
+    builder->SetInsertPoint(unsetBB);
+    llvm::Function* errorFunc = module->getFunction("lua_error");
+    createCall(errorFunc->getFunctionType(), errorFunc, {getStringConstant(
+        "attempt to call closure '" + info->decl->getName() + "' before its definition was executed")}, "");
+    builder->CreateUnreachable();
+    
+    builder->SetInsertPoint(readyBB);
+}
+
+// 逃逸闭包最近一次创建时的 upvals
+llvm::Value* CodeGenerator::getClosureEnv(FunctionInfo* info) {
+    std::string envName = info->decl->getName() + ".env";
+    if (reentrant) {
+        return getStateSlot(envName);
+    }
+    if (llvm::GlobalVariable* env = module->getGlobalVariable(envName, true)) {
+        return env;
+    }
+    llvm::PointerType* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+    return new llvm::GlobalVariable(*module, ptrTy, false,
+        llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantPointerNull::get(ptrTy), envName);
+}
+
+// 未声明为局部变量的名字都是全局变量，初始值为 nil
+llvm::Value* CodeGenerator::getOrCreateGlobal(const std::string& name) {
+    std::string globalName = "global." + name;
+    if (reentrant) {
+        return getStateSlot(globalName);
+    }
+    if (llvm::GlobalVariable* global = module->getGlobalVariable(globalName)) {
+        return global;
+    }
+    // 之前的 chunk 已经定义的全局变量只声明，共享同一个存储
+    llvm::Constant* initializer = nullptr;
+    if (!imports || !imports->globals.count(name)) {
+        initializer = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+    }
+    return new llvm::GlobalVariable(*module, llvm::Type::getDoubleTy(*context), false,
+        llvm::GlobalValue::ExternalLinkage, initializer, globalName);
+}
+
+// 槽数组由 lua_state_slots 取得，普通函数在入口块中取一次；
+// 协程可能在另一个线程上恢复，每次访问都重新获取
+llvm::Value* CodeGenerator::getStateSlot(const std::string& name) {
+    unsigned index = stateSlots.emplace(name, stateSlots.size()).first->second;
+    llvm::Function* getSlots = module->getFunction("lua_state_slots");
+    llvm::Value* slots = stateSlotBase;
+    if (!slots && coroState) {
+        slots = builder->CreateCall(getSlots, {}, "state.slots");
+    } else if (!slots) {
+        llvm::BasicBlock& entry = currentFunction->getEntryBlock();
+        llvm::IRBuilder<> entryBuilder(&entry, entry.getFirstInsertionPt());
+        slots = stateSlotBase = entryBuilder.CreateCall(getSlots, {}, "state.slots");
+    }
+    return builder->CreateConstInBoundsGEP1_64(builder->getInt64Ty(), slots, index, name);
+}
+
+// 进入新函数：清空上一个函数的变量定义，入口块没有前驱，直接封闭
+void CodeGenerator::beginLocals(const std::vector<std::string>& names) {
+    blockDefs.clear();
+    slotCells.clear();
+    upvalueSlots.clear();
+    upvalueCells.clear();
+    slotNames = &names;
+    sealBlock(builder->GetInsertBlock());
+}
+
+// 声明本地变量：被闭包捕获的放进变量单元，其余只记录当前定义
+void CodeGenerator::declareLocal(int slot, llvm::Value* value) {
+    if (currentInfo && currentInfo->captured.count(slot)) {
+        llvm::Value* cell = createLocalStorage(slot);
+        slotCells[slot] = cell;
+        builder->CreateStore(value, cell);
+        return;
+    }
+    writeLocal(slot, value);
+}
+
+llvm::Value* CodeGenerator::readVariable(const BoundName& ref, const std::string& name) {
+    llvm::Type* doubleTy = builder->getDoubleTy();
+    switch (ref.getBinding()) {
+    case Binding::LOCAL: {
+        auto cell = slotCells.find(ref.getSlot());
+        if (cell != slotCells.end()) {
+            return builder->CreateLoad(doubleTy, cell->second, name);
+        }
+        return readLocal(ref.getSlot(), builder->GetInsertBlock());
+    }
+    case Binding::UPVALUE:
+        return builder->CreateLoad(doubleTy, upvalueSlots[ref.getSlot()], name);
+    case Binding::GLOBAL:
+        break;
+    }
+    if (module->getFunction(name)) {
+        return getFunctionValue(name);
+    }
+    return builder->CreateLoad(doubleTy, getOrCreateGlobal(name), name);
+}
+
+void CodeGenerator::writeVariable(const BoundName& ref, const std::string& name, llvm::Value* value) {
+    switch (ref.getBinding()) {
+    case Binding::LOCAL: {
+        auto cell = slotCells.find(ref.getSlot());
+        if (cell != slotCells.end()) {
+            builder->CreateStore(value, cell->second);
+        } else {
+            writeLocal(ref.getSlot(), value);
+        }
+        return;
+    }
+    case Binding::UPVALUE:
+        builder->CreateStore(value, upvalueSlots[ref.getSlot()]);
+        return;
+    case Binding::GLOBAL:
+        break;
+    }
+    if (module->getFunction(name)) {
+        throw std::runtime_error("Function values are not supported: " + name);
+    }
+    builder->CreateStore(value, getOrCreateGlobal(name));
+}
+
+void CodeGenerator::writeLocal(int slot, llvm::Value* value) {
+    blockDefs[builder->GetInsertBlock()].defs[slot] = value;
+}
+
+llvm::Value* CodeGenerator::readLocal(int slot, llvm::BasicBlock* block) {
+    BlockDefs& defs = blockDefs[block];
+    auto it = defs.defs.find(slot);
+    if (it != defs.defs.end() && it->second) {
+        return it->second;
+    }
+    return readLocalRecursive(slot, block);
+}
+
+// 本块中没有定义：未封闭的块先放不完整的 phi；唯一前驱直接向上查找；
+// 多个前驱时先登记 phi 打断循环，再从各个前驱取操作数
+llvm::Value* CodeGenerator::readLocalRecursive(int slot, llvm::BasicBlock* block) {
+    llvm::Value* value;
+    if (!blockDefs[block].sealed) {
+        llvm::PHINode* phi = createPhi(slot, block);
+        blockDefs[block].incompletePhis.emplace_back(phi, slot);
+        value = phi;
+    } else if (llvm::BasicBlock* pred = block->getSinglePredecessor()) {
+        value = readLocal(slot, pred);
+    } else if (llvm::pred_empty(block)) {
+        // 不可达的块，或者在声明之前读取（不会发生）
+        value = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+    } else {
+        llvm::PHINode* phi = createPhi(slot, block);
+        blockDefs[block].defs[slot] = phi;
+        value = addPhiOperands(slot, phi);
+    }
+    blockDefs[block].defs[slot] = value;
+    return value;
+}
+
+llvm::PHINode* CodeGenerator::createPhi(int slot, llvm::BasicBlock* block) {
+    llvm::Type* doubleTy = builder->getDoubleTy();
+    const std::string& name = (*slotNames)[slot];
+    if (block->empty()) {
+        return llvm::PHINode::Create(doubleTy, 0, name, block);
+    }
+    return llvm::PHINode::Create(doubleTy, 0, name, &block->front());
+}
+
+// 每条入边一个操作数（条件分支两边指向同一个块时也是两条边）
+llvm::Value* CodeGenerator::addPhiOperands(int slot, llvm::PHINode* phi) {
+    llvm::BasicBlock* block = phi->getParent();
+    for (llvm::BasicBlock* pred : llvm::predecessors(block)) {
+        phi->addIncoming(readLocal(slot, pred), pred);
+    }
+    return tryRemoveTrivialPhi(phi);
+}
+
+// 所有操作数都是同一个值（或 phi 自身）时用这个值替换 phi，
+// 然后重新检查因此可能变得平凡的其他 phi
+llvm::Value* CodeGenerator::tryRemoveTrivialPhi(llvm::PHINode* phi) {
+    llvm::Value* same = nullptr;
+    for (llvm::Value* op : phi->incoming_values()) {
+        if (op == same || op == phi) {
+            continue;
+        }
+        if (same) {
+            return phi;
+        }
+        same = op;
+    }
+    if (!same) {
+        same = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+    }
+
+    std::vector<llvm::WeakTrackingVH> users;
+    for (llvm::User* user : phi->users()) {
+        if (user != phi && llvm::isa<llvm::PHINode>(user)) {
+            users.emplace_back(user);
+        }
+    }
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+
+    // 只检查已经补齐操作数的 phi，正在填充或尚未封闭的 phi 由各自的调用者处理；
+    // same 本身也可能在其中被替换，用值句柄跟踪
+    llvm::WeakTrackingVH result(same);
+    for (llvm::Value* user : users) {
+        auto* userPhi = llvm::dyn_cast_or_null<llvm::PHINode>(user);
+        if (userPhi && blockDefs[userPhi->getParent()].sealed &&
+            userPhi->getNumIncomingValues() == llvm::pred_size(userPhi->getParent())) {
+            tryRemoveTrivialPhi(userPhi);
+        }
+    }
+    return result;
+}
+
+// 块的所有前驱都已生成：补齐其中不完整的 phi（补齐过程中可能新增，按下标遍历）
+void CodeGenerator::sealBlock(llvm::BasicBlock* block) {
+    BlockDefs& defs = blockDefs[block];
+    if (defs.sealed) {
+        return;
+    }
+    for (size_t i = 0; i < defs.incompletePhis.size(); ++i) {
+        auto [phi, slot] = defs.incompletePhis[i];
+        addPhiOperands(slot, phi);
+    }
+    defs.incompletePhis.clear();
+    defs.sealed = true;
+}
+
+// 函数生成结束时封闭剩下的块（协程的挂起分派等没有显式封闭的块）
+void CodeGenerator::sealAllBlocks() {
+    for (llvm::BasicBlock& block : *currentFunction) {
+        sealBlock(&block);
+    }
+}
+
+// 协程体：与普通函数共用语句生成，但参数来自第一次 resume，
+// return/yield 通过 LuaCoroutine::transfer 传值并挂起
+void CodeGenerator::generateCoroutine(FunctionDecl* node) {
+    std::string name = node->getName();
+    llvm::Function* function = module->getFunction(name + ".coro");
+    if (!function || !function->empty()) {
+        return;
+    }
+    hasCoroutines = true;
+    
+    currentFunction = function;
+    currentInfo = closures.getInfo(node);
+    stateSlotBase = nullptr;
+    beginDebugFunction(function, name, node->getLine());
+    
+    llvm::PointerType* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+    llvm::BasicBlock* entryBB = llvm::BasicBlock::Create(*context, "entry", function);
+    llvm::BasicBlock* allocBB = llvm::BasicBlock::Create(*context, "coro.alloc", function);
+    llvm::BasicBlock* beginBB = llvm::BasicBlock::Create(*context, "coro.begin", function);
+    llvm::BasicBlock* startBB = llvm::BasicBlock::Create(*context, "coro.start", function);
+    coroFinalBB = llvm::BasicBlock::Create(*context, "coro.final");
+    coroCleanupBB = llvm::BasicBlock::Create(*context, "coro.cleanup");
+    coroSuspendBB = llvm::BasicBlock::Create(*context, "coro.suspend");
+    
+    // 协程帧只在 CoroElide 无法把它放进调用者栈帧时才分配，大小由 CoroSplit 计算。
+    // 从 lua_alloc 分配：没有运行完的协程的帧随 LuaState 的堆一起释放
+    builder->SetInsertPoint(entryBB);
+    beginLocals(currentInfo->slots);
+    llvm::Value* id = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_id),
+        {builder->getInt32(0), llvm::ConstantPointerNull::get(ptrTy),
+         llvm::ConstantPointerNull::get(ptrTy), llvm::ConstantPointerNull::get(ptrTy)}, "id");
+    llvm::Value* needAlloc = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_alloc), {id}, "need.alloc");
+    builder->CreateCondBr(needAlloc, allocBB, beginBB);
+    
+    builder->SetInsertPoint(allocBB);
+    llvm::Value* size = builder->CreateCall(llvm::Intrinsic::getDeclaration(
+        module.get(), llvm::Intrinsic::coro_size, {builder->getInt64Ty()}), {}, "size");
+    llvm::Value* mem = builder->CreateCall(module->getFunction("lua_alloc"), {size}, "mem");
+    builder->CreateBr(beginBB);
+    
+    builder->SetInsertPoint(beginBB);
+    llvm::PHINode* frame = builder->CreatePHI(ptrTy, 2, "frame");
+    frame->addIncoming(llvm::ConstantPointerNull::get(ptrTy), entryBB);
+    frame->addIncoming(mem, allocBB);
+    llvm::Value* handle = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_begin), {id, frame}, "handle");
+    
+    // 初始挂起之前取出捕获变量的单元，之后 <name>.env 中的 upvals 可能被原地更新
+    auto argIt = function->arg_begin();
+    coroState = &*argIt++;
+    if (currentInfo->hasUpvalues()) {
+        bindUpvalues(&*argIt++);
+    }
+    
+    // 初始挂起：coroutine.create 返回时协程体还没有开始执行
+    emitCoroutineSuspend(false, startBB);
+    
+    builder->SetInsertPoint(startBB);
+    
+    // 参数是第一次 resume 传入的值
+    if (node->getParams().size() > LUA_COROUTINE_TRANSFER) {
+        throw std::runtime_error("Too many parameters for coroutine body " + name);
+    }
+    for (size_t i = 0; i < node->getParams().size(); ++i) {
+        llvm::Value* arg = builder->CreateLoad(builder->getDoubleTy(),
+            getCoroutineField(coroState, 2, i), node->getParams()[i]);
+        declareLocal(static_cast<int>(i), arg);
+    }
+    // 协程可能在另一个线程上恢复，计数器不能跨挂起点缓存
+    emitEntryBudgetCheck(false);
+    
+    // 生成函数体
+    for (const auto& stmt : node->getBody()) {
+        generateStatement(stmt.get());
+    }
+    if (!builder->GetInsertBlock()->getTerminator()) {
+        emitCoroutineReturn(llvm::ConstantFP::get(*context, llvm::APFloat(0.0)));
+    }
+    
+    // 最终挂起点之后不会再被 resume
+    llvm::BasicBlock* unreachableBB = llvm::BasicBlock::Create(*context, "coro.unreachable");
+    function->insert(function->end(), coroFinalBB);
+    builder->SetInsertPoint(coroFinalBB);
+    emitCoroutineSuspend(true, unreachableBB);
+    
+    function->insert(function->end(), unreachableBB);
+    builder->SetInsertPoint(unreachableBB);
+    builder->CreateUnreachable();
+    
+    // 销毁时释放协程帧
+    function->insert(function->end(), coroCleanupBB);
+    builder->SetInsertPoint(coroCleanupBB);
+    llvm::Value* memToFree = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_free), {id, handle}, "mem.free");
+    llvm::FunctionCallee freeFunc = module->getOrInsertFunction("lua_free",
+        builder->getVoidTy(), ptrTy);
+    builder->CreateCall(freeFunc, {memToFree});
+    builder->CreateBr(coroSuspendBB);
+    
+    function->insert(function->end(), coroSuspendBB);
+    builder->SetInsertPoint(coroSuspendBB);
+    llvm::Function* coroEnd = llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_end);
+    std::vector<llvm::Value*> endArgs = {handle, builder->getFalse()};
+    // LLVM 18 起 llvm.coro.end 多了一个 token 参数
+    if (coroEnd->getFunctionType()->getNumParams() == 3) {
+        endArgs.push_back(llvm::ConstantTokenNone::get(*context));
+    }
+    builder->CreateCall(coroEnd, endArgs);
+    builder->CreateRet(handle);
+    sealAllBlocks();
+    
+    coroState = nullptr;
+}
+
+// llvm.coro.suspend 返回 0 表示被 resume，1 表示被销毁，-1 表示挂起并返回调用者
+void CodeGenerator::emitCoroutineSuspend(bool final, llvm::BasicBlock* resumeBB) {
+    llvm::Value* result = builder->CreateCall(
+        llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_suspend),
+        {llvm::ConstantTokenNone::get(*context), builder->getInt1(final)}, "suspend");
+    llvm::SwitchInst* dispatch = builder->CreateSwitch(result, coroSuspendBB, 2);
+    dispatch->addCase(builder->getInt8(0), resumeBB);
+    dispatch->addCase(builder->getInt8(1), coroCleanupBB);
+}
+
+void CodeGenerator::emitCoroutineReturn(llvm::Value* value) {
+    builder->CreateStore(value, getCoroutineField(coroState, 2, 0));
+    builder->CreateStore(builder->getInt32(LUA_COROUTINE_DEAD), getCoroutineField(coroState, 1));
+    builder->CreateBr(coroFinalBB);
+}
+
+// coroutine.create(f) / coroutine.resume(co, ...) / coroutine.yield(v)
+void CodeGenerator::emitCoroutineCall(CallExpr* node) {
+    const std::string& calleeName = node->getCallee();
+    const auto& arguments = node->getArguments();
+    llvm::PointerType* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+    llvm::Value* nil = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+    
+    if (calleeName == "coroutine.create") {
+        auto* body = arguments.size() == 1 ? dynamic_cast<VarExpr*>(arguments[0].get()) : nullptr;
+        llvm::Function* ramp = body ? module->getFunction(body->getName() + ".coro") : nullptr;
+        if (!ramp) {
+            throw std::runtime_error("coroutine.create expects the name of a function");
+        }
+        
+        llvm::FunctionCallee newFunc = module->getOrInsertFunction("lua_coroutine_new", ptrTy);
+        emitAllocationSite(LUA_ALLOC_BUILTIN);
+        llvm::Value* co = builder->CreateCall(newFunc, {}, "co");
+        std::vector<llvm::Value*> args = {co};
+        FunctionInfo* info = closures.lookup(body->getName());
+        if (info->hasUpvalues()) {
+            llvm::Value* upvals = builder->CreateLoad(ptrTy, getClosureEnv(info), body->getName() + ".upvals");
+            emitClosureEnvCheck(info, upvals);
+            args.push_back(upvals);
+        }
+        llvm::Value* handle = builder->CreateCall(ramp, args, "handle");
+        endAllocationSite();
+        builder->CreateStore(handle, getCoroutineField(co, 0));
+        lastValue = boxPointer(co, LUA_TAG_COROUTINE);
+        return;
+    }
+    
+    if (calleeName == "coroutine.yield") {
+        llvm::Value* value = nil;
+        if (!arguments.empty()) {
+            arguments[0]->accept(*this);
+            value = lastValue;
+            if (value->getType()->isStructTy()) {
+                value = builder->CreateExtractValue(value, 0);
+            }
+        }
+        if (!coroState) {
+            llvm::FunctionCallee outsideFunc = module->getOrInsertFunction(
+                "lua_coroutine_yield_outside", builder->getVoidTy());
+            builder->CreateCall(outsideFunc);
+            lastValue = nil;
+            return;
+        }
+        
+        // yield 的值交给 resume，下一次 resume 的第一个参数成为 yield 的结果
+        builder->CreateStore(value, getCoroutineField(coroState, 2, 0));
+        llvm::BasicBlock* resumedBB = llvm::BasicBlock::Create(*context, "coro.resumed", currentFunction);
+        emitCoroutineSuspend(false, resumedBB);
+        builder->SetInsertPoint(resumedBB);
+        lastValue = builder->CreateLoad(builder->getDoubleTy(), getCoroutineField(coroState, 2, 0), "yield_result");
+        return;
+    }
+    
+    if (calleeName == "coroutine.resume") {
+        if (arguments.empty() || arguments.size() - 1 > LUA_COROUTINE_TRANSFER) {
+            throw std::runtime_error("coroutine.resume expects a coroutine and at most " +
+                std::to_string(LUA_COROUTINE_TRANSFER) + " values");
+        }
+        std::vector<llvm::Value*> values;
+        for (const auto& arg : arguments) {
+            arg->accept(*this);
+            if (lastValue->getType()->isStructTy()) {
+                lastValue = builder->CreateExtractValue(lastValue, 0);
+            }
+            values.push_back(lastValue);
+        }
+        
+        llvm::BasicBlock* badBB = llvm::BasicBlock::Create(*context, "resume.bad", currentFunction);
+        llvm::BasicBlock* statusBB = llvm::BasicBlock::Create(*context, "resume.status", currentFunction);
+        llvm::BasicBlock* resumeBB = llvm::BasicBlock::Create(*context, "resume.run");
+        llvm::BasicBlock* failBB = llvm::BasicBlock::Create(*context, "resume.fail");
+        llvm::BasicBlock* mergeBB = llvm::BasicBlock::Create(*context, "resume.end");
+        
+        // 参数不是协程是错误；不在挂起状态的协程不能 resume，返回 nil 和错误消息
+        builder->CreateCondBr(hasTag(values[0], LUA_TAG_COROUTINE), statusBB, badBB,
+            llvm::MDBuilder(*context).createBranchWeights(2000, 1));
+        builder->SetInsertPoint(badBB);
+        llvm::Function* errorFunc = module->getFunction("lua_error");
+        createCall(errorFunc->getFunctionType(), errorFunc,
+            {getStringConstant("bad argument #1 to 'coroutine.resume' (coroutine expected)")}, "");
+        builder->CreateUnreachable();
+        
+        builder->SetInsertPoint(statusBB);
+        llvm::Value* co = unboxPointer(values[0]);
+        llvm::Value* statusPtr = getCoroutineField(co, 1);
+        llvm::Value* status = builder->CreateLoad(builder->getInt32Ty(), statusPtr, "status");
+        builder->CreateCondBr(builder->CreateICmpEQ(status, builder->getInt32(LUA_COROUTINE_SUSPENDED)),
+            resumeBB, failBB);
+        
+        currentFunction->insert(currentFunction->end(), resumeBB);
+        builder->SetInsertPoint(resumeBB);
+        for (size_t i = 1; i < values.size(); ++i) {
+            builder->CreateStore(values[i], getCoroutineField(co, 2, i - 1));
+        }
+        builder->CreateStore(builder->getInt32(LUA_COROUTINE_RUNNING), statusPtr);
+        llvm::Value* handle = builder->CreateLoad(ptrTy, getCoroutineField(co, 0), "handle");
+        llvm::BasicBlock* resumedBB = llvm::BasicBlock::Create(*context, "resume.returned", currentFunction);
+        llvm::BasicBlock* unwindBB = llvm::BasicBlock::Create(*context, "resume.unwind", currentFunction);
+        currentFunction->setPersonalityFn(getPersonality());
+        builder->CreateInvoke(llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_resume),
+            resumedBB, unwindBB, {handle});
+        
+        // 协程体抛出的错误：协程不能再恢复，置为 dead 并销毁协程帧，再把错误抛给外层
+        sealBlock(unwindBB);
+        builder->SetInsertPoint(unwindBB);
+        llvm::LandingPadInst* pad = builder->CreateLandingPad(
+            llvm::StructType::get(ptrTy, builder->getInt32Ty()), 1, "resume.pad");
+        pad->addClause(getErrorTypeInfo());
+        llvm::Value* error = builder->CreateCall(module->getFunction("lua_catch_error"),
+            {builder->CreateExtractValue(pad, 0)}, "error");
+        builder->CreateStore(builder->getInt32(LUA_COROUTINE_DEAD), statusPtr);
+        builder->CreateCall(llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_destroy), {handle});
+        createCall(errorFunc->getFunctionType(), errorFunc, {error}, "");
+        builder->CreateUnreachable();
+        
+        sealBlock(resumedBB);
+        builder->SetInsertPoint(resumedBB);
+        // 协程体返回时已经把状态置为 dead，此时停在最终挂起点，可以释放协程帧；
+        // 否则回到挂起状态
+        llvm::Value* after = builder->CreateLoad(builder->getInt32Ty(), statusPtr, "status");
+        llvm::Value* dead = builder->CreateICmpEQ(after, builder->getInt32(LUA_COROUTINE_DEAD));
+        llvm::BasicBlock* destroyBB = llvm::BasicBlock::Create(*context, "resume.destroy", currentFunction);
+        llvm::BasicBlock* suspendedBB = llvm::BasicBlock::Create(*context, "resume.suspended", currentFunction);
+        llvm::BasicBlock* resumeEndBB = llvm::BasicBlock::Create(*context, "resume.result", currentFunction);
+        builder->CreateCondBr(dead, destroyBB, suspendedBB);
+        
+        builder->SetInsertPoint(destroyBB);
+        builder->CreateCall(llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::coro_destroy), {handle});
+        builder->CreateBr(resumeEndBB);
+        
+        builder->SetInsertPoint(suspendedBB);
+        builder->CreateStore(builder->getInt32(LUA_COROUTINE_SUSPENDED), statusPtr);
+        builder->CreateBr(resumeEndBB);
+        
+        builder->SetInsertPoint(resumeEndBB);
+        llvm::Value* result = builder->CreateLoad(builder->getDoubleTy(), getCoroutineField(co, 2, 0), "resume_result");
+        builder->CreateBr(mergeBB);
+        
+        currentFunction->insert(currentFunction->end(), failBB);
+        builder->SetInsertPoint(failBB);
+        llvm::Value* message = builder->CreateSelect(
+            builder->CreateICmpEQ(status, builder->getInt32(LUA_COROUTINE_DEAD)),
+            getStringConstant("cannot resume dead coroutine"),
+            getStringConstant("cannot resume non-suspended coroutine"), "resume.error");
+        builder->CreateBr(mergeBB);
+        
+        // 和 pcall 一样返回状态（成功为 1，失败为 nil）和值
+        currentFunction->insert(currentFunction->end(), mergeBB);
+        builder->SetInsertPoint(mergeBB);
+        llvm::PHINode* ok = builder->CreatePHI(builder->getDoubleTy(), 2, "resume.status");
+        ok->addIncoming(llvm::ConstantFP::get(*context, llvm::APFloat(1.0)), resumeEndBB);
+        ok->addIncoming(nil, failBB);
+        llvm::PHINode* phi = builder->CreatePHI(builder->getDoubleTy(), 2, "resume");
+        phi->addIncoming(result, resumeEndBB);
+        phi->addIncoming(message, failBB);
+        
+        llvm::Value* pair = llvm::UndefValue::get(
+            llvm::StructType::get(builder->getDoubleTy(), builder->getDoubleTy()));
+        pair = builder->CreateInsertValue(pair, ok, 0);
+        lastValue = builder->CreateInsertValue(pair, phi, 1);
+        return;
+    }
+    
+    throw std::runtime_error("Unknown function: " + calleeName);
+}
+
+// 与 Runtime.h 中的 struct LuaCoroutine 布局一致
+llvm::StructType* CodeGenerator::getCoroutineType() {
+    if (!coroutineType) {
+        coroutineType = llvm::StructType::create(*context, {
+            llvm::PointerType::get(builder->getInt8Ty(), 0),
+            builder->getInt32Ty(),
+            llvm::ArrayType::get(builder->getDoubleTy(), LUA_COROUTINE_TRANSFER)
+        }, "LuaCoroutine");
+    }
+    return coroutineType;
+}
+
+llvm::Value* CodeGenerator::getCoroutineField(llvm::Value* co, unsigned field, unsigned index) {
+    if (field == 2) {
+        return builder->CreateInBoundsGEP(getCoroutineType(), co,
+            {builder->getInt32(0), builder->getInt32(field), builder->getInt32(index)});
+    }
+    return builder->CreateStructGEP(getCoroutineType(), co, field);
+}
+
+// 运行 CoroEarly/CoroSplit/CoroCleanup，把协程体拆分成 ramp/resume/destroy 函数
+void CodeGenerator::lowerCoroutines() {
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+    llvm::PassBuilder passBuilder;
+    passBuilder.registerModuleAnalyses(mam);
+    passBuilder.registerCGSCCAnalyses(cgam);
+    passBuilder.registerFunctionAnalyses(fam);
+    passBuilder.registerLoopAnalyses(lam);
+    passBuilder.crossRegisterProxies(lam, fam, cgam, mam);
+    
+    llvm::ModulePassManager mpm;
+    mpm.addPass(llvm::CoroEarlyPass());
+    llvm::CGSCCPassManager cgpm;
+    cgpm.addPass(llvm::CoroSplitPass());
+    mpm.addPass(llvm::createModuleToPostOrderCGSCCPassAdaptor(std::move(cgpm)));
+    mpm.addPass(llvm::CoroCleanupPass());
+    mpm.run(*module, mam);
+}
+
+// 多返回值函数返回两个 double 组成的结构体
+llvm::Type* CodeGenerator::createReturnType(const std::string& name, bool multipleReturns) {
+    if (!multipleReturns) {
+        return llvm::Type::getDoubleTy(*context);
+    }
+    std::vector<llvm::Type*> returnTypes(2, llvm::Type::getDoubleTy(*context));
+    return llvm::StructType::create(*context, returnTypes, name + "_return");
+}
+
+// 之前的 chunk 定义、本 chunk 没有重新定义的函数只生成声明，由 JIT 按符号解析
+void CodeGenerator::declareImports() {
+    if (!imports) {
+        return;
+    }
+    for (const auto& entry : imports->functions) {
+        if (module->getFunction(entry.first)) {
+            continue;
+        }
+        std::vector<llvm::Type*> paramTypes(entry.second.params, llvm::Type::getDoubleTy(*context));
+        llvm::FunctionType* functionType = llvm::FunctionType::get(
+            createReturnType(entry.first, entry.second.multipleReturns), paramTypes, false);
+        llvm::Function* function = llvm::Function::Create(functionType,
+            llvm::Function::ExternalLinkage, entry.first, module.get());
+        function->setCallingConv(llvm::CallingConv::Fast);
+    }
+}
+
+// 登记本 chunk 定义的顶层函数和全局变量，闭包只能在定义它的 chunk 中调用
+void CodeGenerator::exportSymbols(ChunkSymbols& symbols) {
+    for (FunctionDecl* decl : closures.getFunctions()) {
+        FunctionInfo* info = closures.getInfo(decl);
+        llvm::Function* function = module->getFunction(decl->getName());
+        if (info->isClosure() || !function) {
+            continue;
+        }
+        symbols.functions[decl->getName()] = {
+            decl->getParams().size(), function->getReturnType()->isStructTy()};
+    }
+    for (const llvm::GlobalVariable& global : module->globals()) {
+        std::string name = global.getName().str();
+        if (!global.isDeclaration() && name.compare(0, 7, "global.") == 0) {
+            symbols.globals.insert(name.substr(7));
+        }
+    }
+}
+
+std::pair<std::unique_ptr<llvm::LLVMContext>, std::unique_ptr<llvm::Module>>
+CodeGenerator::releaseModule() {
+    return {std::move(context), std::move(module)};
+}
+
+// 编译单元和源文件；Lua 没有 DWARF 语言编号，按 C 登记以便调试器显示行号
+void CodeGenerator::initDebugInfo() {
+    if (debugSource.empty()) {
+        return;
+    }
+    module->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+    module->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+    
+    llvm::SmallString<256> path(debugSource);
+    llvm::sys::fs::make_absolute(path);
+    debugBuilder = std::make_unique<llvm::DIBuilder>(*module);
+    llvm::DIFile* file = debugBuilder->createFile(
+        llvm::sys::path::filename(path), llvm::sys::path::parent_path(path));
+    debugUnit = debugBuilder->createCompileUnit(
+        llvm::dwarf::DW_LANG_C, file, "luac", optLevel > 0, "", 0);
+}
+
+// 为函数创建 DISubprogram，并把后续指令的位置设为函数所在行
+void CodeGenerator::beginDebugFunction(llvm::Function* function, const std::string& name, int line) {
+    if (!debugBuilder) {
+        return;
+    }
+    llvm::DIType* number = debugBuilder->createBasicType("number", 64, llvm::dwarf::DW_ATE_float);
+    llvm::DIType* pointer = debugBuilder->createPointerType(nullptr, 64);
+    auto debugType = [&](llvm::Type* type) -> llvm::Metadata* {
+        if (type->isDoubleTy()) {
+            return number;
+        }
+        return type->isPointerTy() ? pointer : nullptr;
+    };
+    
+    std::vector<llvm::Metadata*> types = {debugType(function->getReturnType())};
+    for (llvm::Argument& arg : function->args()) {
+        types.push_back(debugType(arg.getType()));
+    }
+    llvm::DISubprogram::DISPFlags flags = llvm::DISubprogram::SPFlagDefinition;
+    if (optLevel > 0) {
+        flags |= llvm::DISubprogram::SPFlagOptimized;
+    }
+    llvm::DISubprogram* subprogram = debugBuilder->createFunction(
+        debugUnit->getFile(), name, function->getName(), debugUnit->getFile(), line,
+        debugBuilder->createSubroutineType(debugBuilder->getOrCreateTypeArray(types)),
+        line, llvm::DINode::FlagPrototyped, flags);
+    function->setSubprogram(subprogram);
+    builder->SetCurrentDebugLocation(llvm::DILocation::get(*context, line, 0, subprogram));
+}
+
+// 宿主 CPU 的位置无关代码；数据布局在优化之前设置，优化器才能按目标的大小和对齐工作
+void CodeGenerator::initTargetMachine() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    
+    std::string triple = llvm::sys::getProcessTriple();
+    std::string error;
+    const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target) {
+        throw std::runtime_error("Failed to find target " + triple + ": " + error);
+    }
+    targetMachine.reset(target->createTargetMachine(triple, llvm::sys::getHostCPUName(), "",
+        llvm::TargetOptions(), llvm::Reloc::PIC_));
+    module->setTargetTriple(triple);
+    module->setDataLayout(targetMachine->createDataLayout());
+}
+
+// 导出表 lua_module：顶层函数和 chunk 入口。其余符号都改为内部链接，
+// 共享库只导出这一个符号，不会与宿主进程或其他脚本的符号冲突
+void CodeGenerator::emitModuleInfo() {
+    llvm::Type* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+    llvm::StructType* functionType = llvm::StructType::create(*context,
+        {ptrTy, ptrTy, builder->getInt32Ty(), builder->getInt32Ty()}, "LuaExportedFunction");
+    llvm::StructType* moduleType = llvm::StructType::create(*context,
+        {builder->getInt32Ty(), builder->getInt32Ty(), ptrTy, ptrTy}, "LuaModuleInfo");
+    
+    std::vector<llvm::Constant*> functions;
+    for (FunctionDecl* decl : closures.getFunctions()) {
+        llvm::Function* function = module->getFunction(decl->getName());
+        if (closures.getInfo(decl)->isClosure() || !function || function->isDeclaration() ||
+            getDefinition(decl) != function) {
+            continue;
+        }
+        llvm::Constant* name = builder->CreateGlobalString(decl->getName(), "lua.name", 0, module.get());
+        functions.push_back(llvm::ConstantStruct::get(functionType, {
+            name, createExportWrapper(decl),
+            builder->getInt32(decl->getParams().size()),
+            builder->getInt32(function->getReturnType()->isStructTy() ? 2 : 1)}));
+    }
+    llvm::ArrayType* tableType = llvm::ArrayType::get(functionType, functions.size());
+    auto* table = new llvm::GlobalVariable(*module, tableType, true, llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantArray::get(tableType, functions), "lua.functions");
+    
+    for (llvm::Function& function : *module) {
+        if (!function.isDeclaration()) {
+            function.setLinkage(llvm::GlobalValue::InternalLinkage);
+        }
+    }
+    for (llvm::GlobalVariable& global : module->globals()) {
+        if (!global.isDeclaration()) {
+            global.setLinkage(llvm::GlobalValue::InternalLinkage);
+        }
+    }
+    
+    new llvm::GlobalVariable(*module, moduleType, true, llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantStruct::get(moduleType, {
+            builder->getInt32(LUA_MODULE_ABI_VERSION),
+            builder->getInt32(functions.size()),
+            table, module->getFunction(entryName)}),
+        LUA_MODULE_SYMBOL);
+}
+
+// 入口函数：调用 chunk 的代码，捕获没有被 pcall 捕获的错误。
+// 可重入模式下错误抛给宿主，由 LuaState::run 转换成状态码
+void CodeGenerator::emitEntry(llvm::Function* chunk) {
+    llvm::Function* entry = llvm::Function::Create(chunk->getFunctionType(),
+        llvm::Function::ExternalLinkage, entryName, module.get());
+    currentFunction = entry;
+    stateSlotBase = nullptr;
+    budgetLocal = nullptr;
+    builder->SetCurrentDebugLocation(llvm::DebugLoc());
+    builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", entry));
+    if (!profileSource.empty()) {
+        builder->CreateCall(module->getFunction("lua_profile_start"));
+    }
+    landingPad = reentrant ? nullptr : createUncaughtHandler();
+    llvm::Value* status = createCall(chunk->getFunctionType(), chunk, {}, "status");
+    landingPad = nullptr;
+    builder->CreateRet(status);
+}
+
+// 函数作为值：装箱的指针指向包装函数 <name>.value（见 Runtime.h 的 LuaFunction），
+// 包装函数的函数体在所有函数生成之后由 emitFunctionValue 生成
+llvm::Value* CodeGenerator::getFunctionValue(const std::string& name) {
+    llvm::Function* wrapper = module->getFunction(name + ".value");
+    FunctionInfo* info = closures.lookup(name);
+    if (!wrapper && info && (info->coroutine || (info->hasUpvalues() && !info->escapes))) {
+        throw std::runtime_error("Function values are not supported: " + name);
+    }
+    if (!wrapper) {
+        std::vector<llvm::Type*> paramTypes(3, builder->getDoubleTy());
+        wrapper = llvm::Function::Create(
+            llvm::FunctionType::get(builder->getDoubleTy(), paramTypes, false),
+            llvm::Function::InternalLinkage, name + ".value", module.get());
+        functionValues.push_back(name);
+    }
+    return boxPointer(wrapper, LUA_TAG_FUNCTION);
+}
+
+// 逃逸闭包的 upvals 从 <name>.env 取；参数不足时补 nil，多返回值只返回第一个
+void CodeGenerator::emitFunctionValue(const std::string& name) {
+    llvm::Function* wrapper = module->getFunction(name + ".value");
+    llvm::Function* function = module->getFunction(name);
+    currentFunction = wrapper;
+    currentInfo = nullptr;
+    coroState = nullptr;
+    stateSlotBase = nullptr;
+    budgetLocal = nullptr;
+    landingPad = nullptr;
+    statementLine = 0;
+    builder->SetCurrentDebugLocation(llvm::DebugLoc());
+    builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", wrapper));
+    
+    std::vector<llvm::Value*> args;
+    FunctionInfo* info = closures.lookup(name);
+    if (info && info->hasUpvalues()) {
+        args.push_back(builder->CreateLoad(llvm::PointerType::get(builder->getInt8Ty(), 0),
+            getClosureEnv(info), name + ".upvals"));
+    }
+    for (llvm::Argument& arg : wrapper->args()) {
+        if (args.size() < function->arg_size()) {
+            args.push_back(&arg);
+        }
+    }
+    while (args.size() < function->arg_size()) {
+        args.push_back(llvm::ConstantFP::get(*context, llvm::APFloat(0.0)));
+    }
+    llvm::Value* result = emitFunctionCall(function, args, name);
+    if (result->getType()->isStructTy()) {
+        result = builder->CreateExtractValue(result, 0);
+    }
+    builder->CreateRet(result);
+}
+
+// 宿主按 C 调用约定调用导出的函数，包装函数转调 fastcc 的 Lua 函数（重新定义过的调用当前定义）
+llvm::Function* CodeGenerator::createExportWrapper(FunctionDecl* decl) {
+    llvm::Function* function = module->getFunction(decl->getName());
+    llvm::Function* wrapper = llvm::Function::Create(function->getFunctionType(),
+        llvm::Function::InternalLinkage, decl->getName() + ".export", module.get());
+    
+    currentFunction = wrapper;
+    stateSlotBase = nullptr;
+    budgetLocal = nullptr;
+    statementLine = 0;
+    builder->SetCurrentDebugLocation(llvm::DebugLoc());
+    builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", wrapper));
+    std::vector<llvm::Value*> args;
+    for (llvm::Argument& arg : wrapper->args()) {
+        args.push_back(&arg);
+    }
+    landingPad = createUncaughtHandler();
+    llvm::Value* result = emitFunctionCall(function, args, decl->getName());
+    landingPad = nullptr;
+    builder->CreateRet(result);
+    return wrapper;
+}
+
+// 把运行时库的 bitcode 链接进模块，只链接用到的函数，并改为内部链接以便内联和删除。
+// 运行时状态（输出缓冲区等）只在宿主进程中保留一份：读写可变全局变量的函数
+// 只保留声明，仍然调用进程中的实现
+void CodeGenerator::linkRuntime() {
+    if (luaRuntimeBitcodeSize == 0) {
+        return;
+    }
+    
+    llvm::MemoryBufferRef buffer(
+        llvm::StringRef(reinterpret_cast<const char*>(luaRuntimeBitcode), luaRuntimeBitcodeSize),
+        "luaruntime.bc");
+    llvm::Expected<std::unique_ptr<llvm::Module>> runtime = llvm::parseBitcodeFile(buffer, *context);
+    if (!runtime) {
+        throw std::runtime_error("Failed to load runtime bitcode: " +
+                                 llvm::toString(runtime.takeError()));
+    }
+    
+    // 找出直接或间接访问可变全局变量的函数
+    std::set<llvm::Function*> stateful;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (llvm::Function& function : **runtime) {
+            if (function.isDeclaration() || stateful.count(&function)) {
+                continue;
+            }
+            bool touchesState = false;
+            for (llvm::Instruction& inst : llvm::instructions(function)) {
+                for (llvm::Value* operand : inst.operands()) {
+                    llvm::Value* base = operand->stripInBoundsConstantOffsets();
+                    if (auto* global = llvm::dyn_cast<llvm::GlobalVariable>(base)) {
+                        touchesState |= !global->isConstant();
+                    } else if (auto* callee = llvm::dyn_cast<llvm::Function>(base)) {
+                        touchesState |= stateful.count(callee) > 0;
+                    }
+                }
+            }
+            if (touchesState) {
+                stateful.insert(&function);
+                changed = true;
+            }
+        }
+    }
+    
+    std::vector<std::string> linked;
+    for (llvm::Function& function : **runtime) {
+        if (function.isDeclaration()) {
+            continue;
+        }
+        if (stateful.count(&function)) {
+            if (!function.hasLocalLinkage()) {
+                function.deleteBody();
+            }
+            continue;
+        }
+        // 与生成的函数保持一致，否则内联器会认为目标特性不兼容
+        function.removeFnAttr("target-cpu");
+        function.removeFnAttr("target-features");
+        function.removeFnAttr("tune-cpu");
+        if (!function.hasLocalLinkage()) {
+            linked.push_back(function.getName().str());
+        }
+    }
+    
+    if (llvm::Linker::linkModules(*module, std::move(*runtime), llvm::Linker::Flags::LinkOnlyNeeded)) {
+        throw std::runtime_error("Failed to link runtime bitcode");
+    }
+    
+    for (const auto& name : linked) {
+        llvm::Function* function = module->getFunction(name);
+        if (function && !function->isDeclaration()) {
+            function->setLinkage(llvm::GlobalValue::InternalLinkage);
+            function->setVisibility(llvm::GlobalValue::DefaultVisibility);
+        }
+    }
+}
+
+// 标准的 -O1/-O2/-O3 流水线，其中包含协程拆分
+void CodeGenerator::optimizeModule() {
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+    llvm::PassBuilder passBuilder;
+    passBuilder.registerModuleAnalyses(mam);
+    passBuilder.registerCGSCCAnalyses(cgam);
+    passBuilder.registerFunctionAnalyses(fam);
+    passBuilder.registerLoopAnalyses(lam);
+    passBuilder.crossRegisterProxies(lam, fam, cgam, mam);
+    
+    llvm::OptimizationLevel level = optLevel == 1 ? llvm::OptimizationLevel::O1
+                                  : optLevel == 2 ? llvm::OptimizationLevel::O2
+                                  : llvm::OptimizationLevel::O3;
+    llvm::ModulePassManager mpm = passBuilder.buildPerModuleDefaultPipeline(level);
+    mpm.run(*module, mam);
+}
+
+llvm::Value* CodeGenerator::boxPointer(llvm::Value* ptr, uint64_t tag) {
+    llvm::Value* bits = builder->CreatePtrToInt(ptr, builder->getInt64Ty());
+    bits = builder->CreateOr(bits, builder->getInt64(tag << LUA_TAG_SHIFT));
+    return builder->CreateBitCast(bits, builder->getDoubleTy());
+}
+
+llvm::Value* CodeGenerator::unboxPointer(llvm::Value* value) {
+    llvm::Value* bits = builder->CreateBitCast(value, builder->getInt64Ty());
+    bits = builder->CreateAnd(bits, builder->getInt64(LUA_PAYLOAD_MASK));
+    return builder->CreateIntToPtr(bits, llvm::PointerType::get(builder->getInt8Ty(), 0));
+}
+
+llvm::Value* CodeGenerator::hasTag(llvm::Value* value, uint64_t tag) {
+    llvm::Value* bits = builder->CreateBitCast(value, builder->getInt64Ty());
+    return builder->CreateICmpEQ(builder->CreateLShr(bits, LUA_TAG_SHIFT), builder->getInt64(tag));
+}
+
+void CodeGenerator::initBuiltins() {
+    llvm::Type* ptrTy = llvm::PointerType::get(builder->getInt8Ty(), 0);
+    
+    // 声明输出函数（见 Runtime.h）
+    module->getOrInsertFunction("lua_print_value",
+        builder->getVoidTy(), builder->getDoubleTy(), builder->getInt32Ty());
+    module->getOrInsertFunction("lua_print_newline", builder->getVoidTy());
+    module->getOrInsertFunction("lua_flush", builder->getVoidTy());
+    
+    // 声明抢占函数：计数器是线程局部变量，lua_preempt 也会写它，而且会调用嵌入方的调度函数
+    // （可能抛出异常），只在冷路径上调用
+    module->getOrInsertFunction("lua_budget_counter", ptrTy);
+    llvm::Function* preempt = llvm::cast<llvm::Function>(
+        module->getOrInsertFunction("lua_preempt", builder->getInt64Ty()).getCallee());
+    preempt->addFnAttr(llvm::Attribute::Cold);
+    
+    // 声明可重入模式下取得当前 LuaState 槽数组的函数（没有 LuaState 时抛出错误）
+    module->getOrInsertFunction("lua_state_slots", ptrTy);
+    
+    // 声明内存分配和分配分析函数
+    module->getOrInsertFunction("lua_alloc", ptrTy, builder->getInt64Ty());
+    module->getOrInsertFunction("lua_profile_start", builder->getVoidTy());
+    module->getOrInsertFunction("lua_profile_site", builder->getVoidTy(), ptrTy);
+    
+    // 声明表操作函数
+    module->getOrInsertFunction("lua_table_new", ptrTy, builder->getInt32Ty());
+    module->getOrInsertFunction("lua_table_sized", ptrTy, builder->getDoubleTy());
+    module->getOrInsertFunction("lua_table_constant",
+        ptrTy, ptrTy, builder->getInt32Ty(), builder->getInt32Ty());
+    module->getOrInsertFunction("lua_table_set",
+        builder->getVoidTy(), ptrTy, builder->getDoubleTy(), builder->getDoubleTy());
+    module->getOrInsertFunction("lua_index",
+        builder->getDoubleTy(), builder->getDoubleTy(), builder->getDoubleTy());
+    module->getOrInsertFunction("lua_setindex",
+        builder->getVoidTy(), builder->getDoubleTy(), builder->getDoubleTy(), builder->getDoubleTy());
+    
+    // 声明数组部分上的向量操作：参数和返回值都是装箱的值
+    const std::pair<const char*, unsigned> arrayFunctions[] = {
+        {"sum", 1}, {"min", 1}, {"max", 1}, {"dot", 2},
+        {"scale", 2}, {"fill", 3}, {"copy", 1}, {"sort", 1},
+    };
+    for (const auto& [name, params] : arrayFunctions) {
+        std::vector<llvm::Type*> paramTypes(params, builder->getDoubleTy());
+        module->getOrInsertFunction(std::string("lua_array_") + name,
+            llvm::FunctionType::get(builder->getDoubleTy(), paramTypes, false));
+    }
+    
+    // 声明并行函数：函数参数是装箱的函数值
+    module->getOrInsertFunction("lua_parallel_map",
+        builder->getDoubleTy(), builder->getDoubleTy(), builder->getDoubleTy());
+    module->getOrInsertFunction("lua_parallel_for",
+        builder->getDoubleTy(), builder->getDoubleTy(), builder->getDoubleTy(), builder->getDoubleTy());
+    
+    // 声明元表函数
+    module->getOrInsertFunction("lua_setmetatable",
+        builder->getDoubleTy(), builder->getDoubleTy(), builder->getDoubleTy());
+    module->getOrInsertFunction("lua_getmetatable", builder->getDoubleTy(), builder->getDoubleTy());
+    llvm::Function* arith = llvm::cast<llvm::Function>(module->getOrInsertFunction("lua_arith",
+        builder->getDoubleTy(), builder->getInt32Ty(), builder->getDoubleTy(), builder->getDoubleTy()).getCallee());
+    arith->addFnAttr(llvm::Attribute::Cold);
+    llvm::Function* compare = llvm::cast<llvm::Function>(module->getOrInsertFunction("lua_compare",
+        builder->getInt32Ty(), builder->getInt32Ty(), builder->getDoubleTy(), builder->getDoubleTy()).getCallee());
+    compare->addFnAttr(llvm::Attribute::Cold);
+    
+    // 声明错误处理函数：lua_error 抛出 LuaError，lua_catch_error 在 landingpad 中取出错误值
+    llvm::Function* errorFunc = llvm::cast<llvm::Function>(
+        module->getOrInsertFunction("lua_error", builder->getVoidTy(), builder->getDoubleTy()).getCallee());
+    errorFunc->setDoesNotReturn();
+    module->getOrInsertFunction("lua_catch_error", builder->getDoubleTy(), ptrTy);
+    llvm::Function* uncaught = llvm::cast<llvm::Function>(
+        module->getOrInsertFunction("lua_uncaught_error", builder->getVoidTy(), ptrTy).getCallee());
+    uncaught->setDoesNotReturn();
+    
+    // 声明字符串函数
+    module->getOrInsertFunction("lua_concat",
+        builder->getDoubleTy(), builder->getDoubleTy(), builder->getDoubleTy());
 }
 
 void CodeGenerator::executeCode() {
@@ -583,6 +2736,12 @@ void CodeGenerator::executeCode() {
     if (!engine) {
         throw std::runtime_error("Failed to create execution engine: " + error);
     }
+    
+    // 让 GDB 和 perf 能看到 JIT 生成的函数；perf 支持需要 LLVM 以 LLVM_USE_PERF 构建
+    engine->RegisterJITEventListener(llvm::JITEventListener::createGDBRegistrationListener());
+    if (llvm::JITEventListener* perf = llvm::JITEventListener::createPerfJITEventListener()) {
+        engine->RegisterJITEventListener(perf);
+    }
 
     // 获取 main 函数
     auto mainFunc = (int (*)())engine->getFunctionAddress("main");
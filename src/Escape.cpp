@@ -0,0 +1,229 @@
+#include "Escape.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+void TableEscapeAnalysis::run(BlockStmt* root, ClosureAnalysis& closures) {
+    tables.clear();
+    fieldSlots.clear();
+    analyze(root->getStatements(), closures.getMainSlotsRef(), closures.getMainInfo());
+    for (FunctionDecl* decl : closures.getFunctions()) {
+        FunctionInfo* info = closures.getInfo(decl);
+        analyze(decl->getBody(), info->slots, info);
+    }
+}
+
+const std::vector<int>* TableEscapeAnalysis::getFields(LocalVarDecl* decl) const {
+    auto it = tables.find(decl);
+    return it == tables.end() ? nullptr : &it->second;
+}
+
+int TableEscapeAnalysis::getFieldSlot(Expr* node) const {
+    auto it = fieldSlots.find(node);
+    return it == fieldSlots.end() ? -1 : it->second;
+}
+
+// 分析一个函数体（不进入嵌套函数），为不逃逸的表的每个字段分配槽
+void TableEscapeAnalysis::analyze(const std::vector<std::unique_ptr<Stmt>>& statements,
+                                  std::vector<std::string>& functionSlots, const FunctionInfo* info) {
+    candidates.clear();
+    escaped.clear();
+    accesses.clear();
+    for (const auto& stmt : statements) {
+        stmt->accept(*this);
+    }
+
+    std::map<int, std::map<std::string, int>> fields;
+    auto fieldSlot = [&](int table, const std::string& key, const std::string& label) {
+        auto it = fields[table].find(key);
+        if (it != fields[table].end()) {
+            return it->second;
+        }
+        LocalVarDecl* decl = candidates[table];
+        int slot = static_cast<int>(functionSlots.size());
+        functionSlots.push_back(decl->getName() + label);
+        fields[table][key] = slot;
+        tables[decl].push_back(slot);
+        return slot;
+    };
+
+    std::string identity, label;
+    for (const auto& entry : candidates) {
+        LocalVarDecl* decl = entry.second;
+        if (escaped.count(entry.first) || (info && info->captured.count(entry.first))) {
+            continue;
+        }
+        tables[decl];
+        for (const auto& field : static_cast<TableExpr*>(decl->getInitializer())->getFields()) {
+            getKey(field.key.get(), identity, label);
+            fieldSlots[field.key.get()] = fieldSlot(entry.first, identity, label);
+        }
+    }
+    for (const Access& access : accesses) {
+        auto candidate = candidates.find(access.table);
+        if (candidate != candidates.end() && tables.count(candidate->second)) {
+            fieldSlots[access.node] = fieldSlot(access.table, access.key, access.label);
+        }
+    }
+}
+
+// 字面量键：数字按位模式（-0 与 0 相同，NaN 不能作为键），字符串按内容；label 用于槽名
+bool TableEscapeAnalysis::getKey(Expr* expr, std::string& identity, std::string& label) {
+    if (auto* number = dynamic_cast<NumberExpr*>(expr)) {
+        if (std::isnan(number->getValue())) {
+            return false;
+        }
+        double value = number->getValue() == 0 ? 0.0 : number->getValue();
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "[%.14g]", value);
+        identity = "n" + std::to_string(bits);
+        label = buffer;
+        return true;
+    }
+    if (auto* string = dynamic_cast<StringExpr*>(expr)) {
+        identity = "s" + string->getValue();
+        label = "." + string->getValue();
+        return true;
+    }
+    return false;
+}
+
+// local t = @{...}：键都是字面量，没有 @name，@(n) 的 n 是字面量（求值没有副作用）
+bool TableEscapeAnalysis::isCandidate(LocalVarDecl* decl) {
+    auto* table = dynamic_cast<TableExpr*>(decl->getInitializer());
+    if (decl->getBinding() != Binding::LOCAL || !table || !table->getConstructor().empty()) {
+        return false;
+    }
+    // 非法的 @(n) 留给 lua_table_sized 报错
+    if (table->getSize()) {
+        auto* size = dynamic_cast<NumberExpr*>(table->getSize());
+        if (!size || !(size->getValue() >= 0 && size->getValue() <= UINT32_MAX) ||
+            size->getValue() != static_cast<uint32_t>(size->getValue())) {
+            return false;
+        }
+    }
+    std::string identity, label;
+    for (const auto& field : table->getFields()) {
+        if (!getKey(field.key.get(), identity, label)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TableEscapeAnalysis::visit(BlockStmt* node) {
+    for (const auto& stmt : node->getStatements()) {
+        stmt->accept(*this);
+    }
+}
+
+// 嵌套函数单独分析，它对外层变量的引用是 upvalue，由 captured 排除
+void TableEscapeAnalysis::visit(FunctionDecl* node) {}
+
+void TableEscapeAnalysis::visit(ReturnStmt* node) {
+    for (const auto& value : node->getValues()) {
+        value->accept(*this);
+    }
+}
+
+void TableEscapeAnalysis::visit(IfStmt* node) {
+    node->getCondition()->accept(*this);
+    node->getThenBranch()->accept(*this);
+    if (node->getElseBranch()) {
+        node->getElseBranch()->accept(*this);
+    }
+}
+
+void TableEscapeAnalysis::visit(WhileStmt* node) {
+    node->getCondition()->accept(*this);
+    node->getBody()->accept(*this);
+}
+
+void TableEscapeAnalysis::visit(RepeatStmt* node) {
+    // 条件中体内 local 的槽号已由 ClosureAnalysis 在体作用域内解析
+    node->getBody()->accept(*this);
+    node->getCondition()->accept(*this);
+}
+
+void TableEscapeAnalysis::visit(ExprStmt* node) {
+    if (node->getExpr()) {
+        node->getExpr()->accept(*this);
+    }
+}
+
+void TableEscapeAnalysis::visit(BinaryExpr* node) {
+    node->getLeft()->accept(*this);
+    node->getRight()->accept(*this);
+}
+
+void TableEscapeAnalysis::visit(UnaryExpr* node) {
+    node->getExpr()->accept(*this);
+}
+
+void TableEscapeAnalysis::visit(NumberExpr* node) {}
+
+void TableEscapeAnalysis::visit(StringExpr* node) {}
+
+void TableEscapeAnalysis::visit(NilExpr* node) {}
+
+// 字段访问之外对本地变量的任何引用都可能让表逃逸
+void TableEscapeAnalysis::visit(VarExpr* node) {
+    if (node->getBinding() == Binding::LOCAL) {
+        escaped.insert(node->getSlot());
+    }
+}
+
+void TableEscapeAnalysis::visit(CallExpr* node) {
+    for (const auto& arg : node->getArguments()) {
+        arg->accept(*this);
+    }
+}
+
+void TableEscapeAnalysis::visit(PrintExpr* node) {
+    node->getExpr()->accept(*this);
+}
+
+void TableEscapeAnalysis::visit(LocalVarDecl* node) {
+    if (node->getInitializer()) {
+        node->getInitializer()->accept(*this);
+    }
+    if (isCandidate(node)) {
+        candidates[node->getSlot()] = node;
+    }
+}
+
+void TableEscapeAnalysis::visit(AssignStmt* node) {
+    node->getValue()->accept(*this);
+    if (node->getBinding() == Binding::LOCAL) {
+        escaped.insert(node->getSlot());
+    }
+}
+
+void TableEscapeAnalysis::visit(IndexExpr* node) {
+    auto* object = dynamic_cast<VarExpr*>(node->getObject());
+    std::string identity, label;
+    if (object && object->getBinding() == Binding::LOCAL && getKey(node->getKey(), identity, label)) {
+        accesses.push_back({object->getSlot(), identity, label, node});
+        return;
+    }
+    node->getObject()->accept(*this);
+    node->getKey()->accept(*this);
+}
+
+void TableEscapeAnalysis::visit(TableExpr* node) {
+    if (node->getSize()) {
+        node->getSize()->accept(*this);
+    }
+    for (const auto& field : node->getFields()) {
+        field.key->accept(*this);
+        field.value->accept(*this);
+    }
+}
+
+void TableEscapeAnalysis::visit(IndexAssignStmt* node) {
+    node->getValue()->accept(*this);
+    node->getTarget()->accept(*this);
+}
@@ -0,0 +1,110 @@
+#include "JITSession.h"
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Support/TargetSelect.h>
+#include <stdexcept>
+#include "Lexer.h"
+
+
+std::unique_ptr<llvm::orc::LLJIT> createLuaJIT(bool perfEvents) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    // 使用 RuntimeDyld 链接层，以便挂上 GDB 和 perf 的 JIT 事件监听器
+    auto createLinkingLayer = [perfEvents](llvm::orc::ExecutionSession& session, const llvm::Triple&)
+        -> llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>> {
+        auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+            session, [](auto&&...) { return std::make_unique<llvm::SectionMemoryManager>(); });
+        layer->registerJITEventListener(*llvm::JITEventListener::createGDBRegistrationListener());
+        // perf 支持需要 LLVM 以 LLVM_USE_PERF 构建，否则返回空
+        if (perfEvents) {
+            if (llvm::JITEventListener* perf = llvm::JITEventListener::createPerfJITEventListener()) {
+                layer->registerJITEventListener(*perf);
+            }
+        }
+        return std::move(layer);
+    };
+    auto created = llvm::orc::LLJITBuilder()
+        .setObjectLinkingLayerCreator(std::move(createLinkingLayer))
+        .create();
+    if (!created) {
+        throw std::runtime_error("Failed to create JIT: " + llvm::toString(created.takeError()));
+    }
+    std::unique_ptr<llvm::orc::LLJIT> jit = std::move(*created);
+
+    // 运行时库由宿主进程导出（luac 以 ENABLE_EXPORTS 链接）
+    auto generator = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        jit->getDataLayout().getGlobalPrefix());
+    if (!generator) {
+        throw std::runtime_error("Failed to load process symbols: " +
+                                 llvm::toString(generator.takeError()));
+    }
+    jit->getMainJITDylib().addGenerator(std::move(*generator));
+    return jit;
+}
+
+JITSession::JITSession(unsigned optLevel, bool debugInfo)
+    : jit(createLuaJIT(debugInfo)), optLevel(optLevel), debugInfo(debugInfo) {
+}
+
+JITSession::~JITSession() = default;
+
+int JITSession::runChunk(BlockStmt* chunk, const std::string& sourceName) {
+    std::string entry = "chunk." + std::to_string(chunks.size() + 1);
+
+    CodeGenerator codegen;
+    codegen.setOptimizationLevel(optLevel);
+    codegen.setPreemption(preemption);
+    if (debugInfo) {
+        codegen.enableDebugInfo(sourceName);
+    }
+    if (allocationProfiling) {
+        codegen.enableAllocationProfiling(sourceName);
+    }
+    codegen.setEntryName(entry);
+    codegen.importSymbols(symbols);
+    codegen.generateCode(chunk);
+
+    ChunkSymbols defined = symbols;
+    codegen.exportSymbols(defined);
+    auto compiled = codegen.releaseModule();
+
+    // 先查本 chunk，再从新到旧查之前的 chunk，最后查宿主进程
+    llvm::orc::JITDylib& dylib = jit->getExecutionSession().createBareJITDylib(entry);
+    llvm::orc::JITDylibSearchOrder order;
+    for (auto it = chunks.rbegin(); it != chunks.rend(); ++it) {
+        order.push_back({*it, llvm::orc::JITDylibLookupFlags::MatchExportedSymbolsOnly});
+    }
+    order.push_back({&jit->getMainJITDylib(), llvm::orc::JITDylibLookupFlags::MatchExportedSymbolsOnly});
+    dylib.setLinkOrder(std::move(order));
+
+    llvm::orc::ThreadSafeModule module(std::move(compiled.second), std::move(compiled.first));
+    if (llvm::Error error = jit->addIRModule(dylib, std::move(module))) {
+        throw std::runtime_error("Failed to add chunk: " + llvm::toString(std::move(error)));
+    }
+    chunks.push_back(&dylib);
+    symbols = std::move(defined);
+
+    auto address = jit->lookup(dylib, entry);
+    if (!address) {
+        throw std::runtime_error("Failed to get chunk entry: " + llvm::toString(address.takeError()));
+    }
+    return address->toPtr<int (*)()>()();
+}
+
+int JITSession::runFile(const std::string& path) {
+    SourceFile source(path);
+    return runSource(source.text(), path);
+}
+
+int JITSession::runString(const std::string& source) {
+    return runSource(source, "stdin");
+}
+
+int JITSession::runSource(std::string_view source, const std::string& sourceName) {
+    std::unique_ptr<BlockStmt> chunk = parseSource(source);
+    return runChunk(chunk.get(), sourceName);
+}
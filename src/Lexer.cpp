@@ -0,0 +1,365 @@
+#include "Lexer.h"
+#include <cstdlib>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+SourceFile::SourceFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open input file: " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not stat input file: " + path);
+    }
+    size = static_cast<size_t>(info.st_size);
+
+    // 空文件不能映射，保持 data 为空
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Could not map input file: " + path);
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapped);
+    }
+    close(fd);
+}
+
+SourceFile::~SourceFile() {
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+namespace {
+
+// 一次比较 16 个字节，比较结果压缩成位掩码：SSE2 每字节 1 位，NEON 每字节 4 位
+#if defined(__SSE2__)
+#define LUA_LEXER_SIMD 1
+using Bytes = __m128i;
+constexpr unsigned MASK_BITS = 1;
+
+inline Bytes load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline Bytes equal(Bytes v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+inline Bytes either(Bytes a, Bytes b) { return _mm_or_si128(a, b); }
+inline uint64_t toMask(Bytes v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+constexpr uint64_t FULL_MASK = 0xFFFF;
+#elif defined(__ARM_NEON)
+#define LUA_LEXER_SIMD 1
+using Bytes = uint8x16_t;
+constexpr unsigned MASK_BITS = 4;
+
+inline Bytes load(const char* p) { return vld1q_u8(reinterpret_cast<const uint8_t*>(p)); }
+inline Bytes equal(Bytes v, char c) { return vceqq_u8(v, vdupq_n_u8(static_cast<uint8_t>(c))); }
+inline Bytes either(Bytes a, Bytes b) { return vorrq_u8(a, b); }
+inline uint64_t toMask(Bytes v) {
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(v), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+constexpr uint64_t FULL_MASK = ~uint64_t(0);
+#endif
+
+#ifdef LUA_LEXER_SIMD
+// 记录 [p, p+16) 中由 mask 标出的换行
+inline void countNewlines(const char* p, uint64_t mask, uint32_t& line, const char*& lineStart) {
+    if (mask) {
+        line += static_cast<uint32_t>(__builtin_popcountll(mask) / MASK_BITS);
+        lineStart = p + (63 - __builtin_clzll(mask)) / MASK_BITS + 1;
+    }
+}
+#endif
+
+inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+
+// 跳过空白字符，返回第一个非空白字符的位置
+const char* skipBlanks(const char* p, const char* end, uint32_t& line, const char*& lineStart) {
+#ifdef LUA_LEXER_SIMD
+    while (end - p >= 16) {
+        Bytes chunk = load(p);
+        Bytes newline = equal(chunk, '\n');
+        Bytes blank = either(either(equal(chunk, ' '), equal(chunk, '\t')),
+                             either(equal(chunk, '\r'), newline));
+        uint64_t stop = ~toMask(blank) & FULL_MASK;
+        uint64_t newlines = toMask(newline);
+        if (stop) {
+            unsigned index = __builtin_ctzll(stop) / MASK_BITS;
+            countNewlines(p, newlines & ((uint64_t(1) << (index * MASK_BITS)) - 1), line, lineStart);
+            return p + index;
+        }
+        countNewlines(p, newlines, line, lineStart);
+        p += 16;
+    }
+#endif
+    for (; p < end && isBlank(*p); ++p) {
+        if (*p == '\n') {
+            ++line;
+            lineStart = p + 1;
+        }
+    }
+    return p;
+}
+
+// 返回第一个等于 a 或 b 的位置，找不到时返回 end
+const char* findEither(const char* p, const char* end, char a, char b) {
+#ifdef LUA_LEXER_SIMD
+    while (end - p >= 16) {
+        Bytes chunk = load(p);
+        uint64_t found = toMask(either(equal(chunk, a), equal(chunk, b)));
+        if (found) {
+            return p + __builtin_ctzll(found) / MASK_BITS;
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != a && *p != b) {
+        ++p;
+    }
+    return p;
+}
+
+// 关键字的完美哈希：首字符、末字符和长度在 32 个槽中互不冲突
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr Keyword KEYWORDS[] = {
+    {"and", TokenType::TOKEN_AND},           {"do", TokenType::TOKEN_DO},
+    {"else", TokenType::TOKEN_ELSE},         {"elseif", TokenType::TOKEN_ELSEIF},
+    {"end", TokenType::TOKEN_END},           {"function", TokenType::TOKEN_FUNCTION},
+    {"if", TokenType::TOKEN_IF},             {"local", TokenType::TOKEN_LOCAL},
+    {"nil", TokenType::TOKEN_NIL},           {"not", TokenType::TOKEN_NOT},
+    {"or", TokenType::TOKEN_OR},             {"repeat", TokenType::TOKEN_REPEAT},
+    {"return", TokenType::TOKEN_RETURN},     {"then", TokenType::TOKEN_THEN},
+    {"until", TokenType::TOKEN_UNTIL},       {"while", TokenType::TOKEN_WHILE},
+};
+
+constexpr size_t KEYWORD_SLOTS = 32;
+constexpr size_t KEYWORD_MIN_LENGTH = 2;
+constexpr size_t KEYWORD_MAX_LENGTH = 8;
+
+constexpr size_t keywordHash(std::string_view text) {
+    return (static_cast<unsigned char>(text.front()) + static_cast<unsigned char>(text.back()) +
+            8 * text.size()) % KEYWORD_SLOTS;
+}
+
+struct KeywordTable {
+    Keyword slots[KEYWORD_SLOTS];
+};
+
+constexpr KeywordTable buildKeywordTable() {
+    KeywordTable table{};
+    for (const Keyword& keyword : KEYWORDS) {
+        Keyword& slot = table.slots[keywordHash(keyword.text)];
+        if (!slot.text.empty()) {
+            throw std::logic_error("keyword hash collision");
+        }
+        slot = keyword;
+    }
+    return table;
+}
+
+constexpr KeywordTable KEYWORD_TABLE = buildKeywordTable();
+
+TokenType lookupKeyword(std::string_view text) {
+    if (text.size() < KEYWORD_MIN_LENGTH || text.size() > KEYWORD_MAX_LENGTH) {
+        return TokenType::TOKEN_IDENTIFIER;
+    }
+    const Keyword& slot = KEYWORD_TABLE.slots[keywordHash(text)];
+    return slot.text == text ? slot.type : TokenType::TOKEN_IDENTIFIER;
+}
+
+} // namespace
+
+Lexer::Lexer(std::string_view source)
+    : end(source.data() + source.size()), current(source.data()), lineStart(source.data()) {}
+
+char Lexer::peek(size_t offset) const {
+    return static_cast<size_t>(end - current) > offset ? current[offset] : '\0';
+}
+
+// 空白和 "--" 注释交替出现时一起跳过
+void Lexer::skipWhitespace() {
+    for (;;) {
+        current = skipBlanks(current, end, line, lineStart);
+        if (peek() == '-' && peek(1) == '-') {
+            skipComment();
+            continue;
+        }
+        return;
+    }
+}
+
+// 注释到行尾为止，换行符留给 skipBlanks 计数
+void Lexer::skipComment() {
+    current = findEither(current + 2, end, '\n', '\r');
+}
+
+Token Lexer::makeToken(TokenType type, const char* tokenStart, size_t length, double value) const {
+    return Token(type, std::string_view(tokenStart, length), line,
+                 static_cast<uint32_t>(tokenStart - lineStart + 1), value);
+}
+
+Token Lexer::errorToken(const char* tokenStart, const char* message) const {
+    return Token(TokenType::TOKEN_ERROR, message, line,
+                 static_cast<uint32_t>(tokenStart - lineStart + 1));
+}
+
+// 数字：整数部分、可选的小数部分和指数；不超过 15 位的整数不经过 strtod
+Token Lexer::number(const char* tokenStart) {
+    uint64_t integer = static_cast<uint64_t>(tokenStart[0] - '0');
+    while (!isAtEnd() && isDigit(*current)) {
+        integer = integer * 10 + static_cast<uint64_t>(*current - '0');
+        ++current;
+    }
+    bool exact = current - tokenStart <= 15;
+
+    if (peek() == '.' && isDigit(peek(1))) {
+        exact = false;
+        current += 2;
+        while (!isAtEnd() && isDigit(*current)) {
+            ++current;
+        }
+    }
+    if ((peek() == 'e' || peek() == 'E') &&
+        (isDigit(peek(1)) || ((peek(1) == '+' || peek(1) == '-') && isDigit(peek(2))))) {
+        exact = false;
+        current += 2;
+        while (!isAtEnd() && isDigit(*current)) {
+            ++current;
+        }
+    }
+
+    size_t length = static_cast<size_t>(current - tokenStart);
+    if (exact) {
+        return makeToken(TokenType::TOKEN_NUMBER, tokenStart, length, static_cast<double>(integer));
+    }
+    // 源码不以 '\0' 结尾，strtod 需要一份拷贝
+    std::string text(tokenStart, length);
+    return makeToken(TokenType::TOKEN_NUMBER, tokenStart, length, std::strtod(text.c_str(), nullptr));
+}
+
+Token Lexer::identifier(const char* tokenStart) {
+    while (!isAtEnd() && (isAlpha(*current) || isDigit(*current))) {
+        ++current;
+    }
+    size_t length = static_cast<size_t>(current - tokenStart);
+    return makeToken(lookupKeyword(std::string_view(tokenStart, length)), tokenStart, length);
+}
+
+// 字符串没有转义序列，可以跨行；token 的值不含引号
+Token Lexer::string(const char* tokenStart) {
+    char quote = *tokenStart;
+    uint32_t startLine = line;
+    const char* startLineStart = lineStart;
+    const char* bodyEnd = findEither(current, end, quote, '\n');
+    while (bodyEnd < end && *bodyEnd == '\n') {
+        ++line;
+        lineStart = bodyEnd + 1;
+        bodyEnd = findEither(bodyEnd + 1, end, quote, '\n');
+    }
+    uint32_t column = static_cast<uint32_t>(tokenStart - startLineStart + 1);
+    if (bodyEnd >= end) {
+        current = end;
+        return Token(TokenType::TOKEN_ERROR, "Unterminated string", startLine, column);
+    }
+
+    const char* body = current;
+    current = bodyEnd + 1;
+    return Token(TokenType::TOKEN_STRING, std::string_view(body, static_cast<size_t>(bodyEnd - body)),
+                 startLine, column);
+}
+
+Token Lexer::getNextToken() {
+    skipWhitespace();
+    if (isAtEnd()) {
+        return makeToken(TokenType::TOKEN_EOF, current, 0);
+    }
+
+    const char* tokenStart = current;
+    char c = *current++;
+    if (isDigit(c)) {
+        return number(tokenStart);
+    }
+    if (isAlpha(c)) {
+        return identifier(tokenStart);
+    }
+
+    switch (c) {
+        case '"':
+        case '\'':
+            return string(tokenStart);
+        case '~':
+            if (peek() == '=') {
+                ++current;
+                return makeToken(TokenType::TOKEN_NE, tokenStart, 2);
+            }
+            break;
+        case '<':
+            if (peek() == '=') {
+                ++current;
+                return makeToken(TokenType::TOKEN_LE, tokenStart, 2);
+            }
+            return makeToken(TokenType::TOKEN_LT, tokenStart, 1);
+        case '>':
+            if (peek() == '=') {
+                ++current;
+                return makeToken(TokenType::TOKEN_GE, tokenStart, 2);
+            }
+            return makeToken(TokenType::TOKEN_GT, tokenStart, 1);
+        case '.':
+            if (peek() == '.') {
+                ++current;
+                return makeToken(TokenType::TOKEN_CONCAT, tokenStart, 2);
+            }
+            return makeToken(TokenType::TOKEN_DOT, tokenStart, 1);
+        case '+': return makeToken(TokenType::TOKEN_PLUS, tokenStart, 1);
+        case '-': return makeToken(TokenType::TOKEN_MINUS, tokenStart, 1);
+        case '*': return makeToken(TokenType::TOKEN_MULT, tokenStart, 1);
+        case '/': return makeToken(TokenType::TOKEN_DIV, tokenStart, 1);
+        case '%': return makeToken(TokenType::TOKEN_MOD, tokenStart, 1);
+        case '^': return makeToken(TokenType::TOKEN_POW, tokenStart, 1);
+        case '=':
+            if (peek() == '=') {
+                ++current;
+                return makeToken(TokenType::TOKEN_EQ, tokenStart, 2);
+            }
+            return makeToken(TokenType::TOKEN_ASSIGN, tokenStart, 1);
+        case ',': return makeToken(TokenType::TOKEN_COMMA, tokenStart, 1);
+        case ';': return makeToken(TokenType::TOKEN_SEMICOLON, tokenStart, 1);
+        case '(': return makeToken(TokenType::TOKEN_LPAREN, tokenStart, 1);
+        case ')': return makeToken(TokenType::TOKEN_RPAREN, tokenStart, 1);
+        case '{': return makeToken(TokenType::TOKEN_LBRACE, tokenStart, 1);
+        case '}': return makeToken(TokenType::TOKEN_RBRACE, tokenStart, 1);
+        case '[': return makeToken(TokenType::TOKEN_LBRACKET, tokenStart, 1);
+        case ']': return makeToken(TokenType::TOKEN_RBRACKET, tokenStart, 1);
+        case '@': return makeToken(TokenType::TOKEN_AT, tokenStart, 1);
+        default:
+            break;
+    }
+    return errorToken(tokenStart, "Unknown character");
+}
+
+std::vector<Token> Lexer::scanTokens() {
+    std::vector<Token> tokens;
+    for (;;) {
+        tokens.push_back(getNextToken());
+        if (tokens.back().getType() == TokenType::TOKEN_EOF) {
+            return tokens;
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include "AST.h"
+#include "Lexer.h"
+#include "parser.tab.h"
+
+// yyerror 使用的当前 token 位置
+int line_number = 1;
+int column_number = 1;
+
+extern std::unique_ptr<BlockStmt> root;
+
+namespace {
+std::unique_ptr<Lexer> lexer;
+
+// bison 生成的语法分析器使用全局状态，同一时刻只能有一个线程在解析
+std::mutex parserMutex;
+}
+
+void setParserInput(std::string_view source) {
+    lexer = std::make_unique<Lexer>(source);
+    line_number = 1;
+    column_number = 1;
+}
+
+std::unique_ptr<BlockStmt> parseSource(std::string_view source) {
+    std::lock_guard<std::mutex> lock(parserMutex);
+    setParserInput(source);
+    int status = yyparse();
+    lexer.reset();
+    if (status != 0) {
+        root.reset();
+        throw std::runtime_error("Parsing failed");
+    }
+    return std::move(root);
+}
+
+// bison 调用的词法分析接口：把 Lexer 的 token 转换成语法分析器的 token 编号
+int yylex() {
+    if (!lexer) {
+        return 0;
+    }
+    Token token = lexer->getNextToken();
+    line_number = static_cast<int>(token.getLine());
+    column_number = static_cast<int>(token.getColumn());
+    std::string_view value = token.getValue();
+    
+    // 语法规则通过 @n 取得 token 的位置，写入 AST 节点后用于生成调试信息
+    yylloc.first_line = yylloc.last_line = line_number;
+    yylloc.first_column = column_number;
+    yylloc.last_column = column_number + static_cast<int>(value.size());
+
+    switch (token.getType()) {
+        case TokenType::TOKEN_EOF:      return 0;
+        case TokenType::TOKEN_NUMBER:
+            yylval.number = token.getNumber();
+            return NUMBER;
+        case TokenType::TOKEN_STRING:
+            yylval.string = {value.data(), value.size()};
+            return STRING;
+        case TokenType::TOKEN_IDENTIFIER:
+            yylval.string = {value.data(), value.size()};
+            return IDENTIFIER;
+        case TokenType::TOKEN_LOCAL:    return LOCAL;
+        case TokenType::TOKEN_IF:       return IF;
+        case TokenType::TOKEN_THEN:     return THEN;
+        case TokenType::TOKEN_ELSE:     return ELSE;
+        case TokenType::TOKEN_ELSEIF:   return ELSEIF;
+        case TokenType::TOKEN_WHILE:    return WHILE;
+        case TokenType::TOKEN_DO:       return DO;
+        case TokenType::TOKEN_REPEAT:   return REPEAT;
+        case TokenType::TOKEN_UNTIL:    return UNTIL;
+        case TokenType::TOKEN_FUNCTION: return FUNCTION;
+        case TokenType::TOKEN_END:      return END;
+        case TokenType::TOKEN_RETURN:   return RETURN;
+        case TokenType::TOKEN_NIL:      return NIL;
+        case TokenType::TOKEN_AND:      return AND;
+        case TokenType::TOKEN_OR:       return OR;
+        case TokenType::TOKEN_NOT:      return NOT;
+        case TokenType::TOKEN_EQ:       return EQ;
+        case TokenType::TOKEN_NE:       return NE;
+        case TokenType::TOKEN_LE:       return LE;
+        case TokenType::TOKEN_GE:       return GE;
+        case TokenType::TOKEN_CONCAT:   return CONC;
+        case TokenType::TOKEN_ERROR:
+            // 返回语法中不存在的字符，让 yyparse 报告语法错误
+            fprintf(stderr, "Error at line %d, column %d: %.*s\n", line_number, column_number,
+                    static_cast<int>(value.size()), value.data());
+            return 1;
+        default:
+            // 单字符 token 直接使用字符本身
+            return static_cast<unsigned char>(value[0]);
+    }
+}
@@ -0,0 +1,107 @@
+#include "LuaEngine.h"
+#include <cstring>
+#include <stdexcept>
+#include "CodeGen.h"
+#include "JITSession.h"
+#include "Lexer.h"
+
+int LuaScript::globalSlot(const std::string& name) const {
+    auto it = slots.find("global." + name);
+    return it == slots.end() ? -1 : static_cast<int>(it->second);
+}
+
+LuaEngine::LuaEngine(unsigned optLevel) : jit(createLuaJIT(false)), optLevel(optLevel) {
+}
+
+LuaEngine::~LuaEngine() = default;
+
+std::shared_ptr<const LuaScript> LuaEngine::compileFile(const std::string& path) {
+    SourceFile source(path);
+    return compileString(source.text());
+}
+
+std::shared_ptr<const LuaScript> LuaEngine::compileString(std::string_view source) {
+    std::unique_ptr<BlockStmt> chunk = parseSource(source);
+
+    std::string entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry = "script." + std::to_string(++scripts);
+    }
+
+    CodeGenerator codegen;
+    codegen.setOptimizationLevel(optLevel);
+    codegen.setReentrant(true);
+    codegen.setEntryName(entry);
+    codegen.generateCode(chunk.get());
+
+    auto script = std::make_shared<LuaScript>();
+    script->jit = jit;
+    script->slots = codegen.getStateSlots();
+    auto compiled = codegen.releaseModule();
+
+    // 每个脚本放进自己的 JITDylib，同名的顶层函数互不影响
+    llvm::orc::JITDylib& dylib = jit->getExecutionSession().createBareJITDylib(entry);
+    dylib.addToLinkOrder(jit->getMainJITDylib(), llvm::orc::JITDylibLookupFlags::MatchExportedSymbolsOnly);
+    llvm::orc::ThreadSafeModule module(std::move(compiled.second), std::move(compiled.first));
+    if (llvm::Error error = jit->addIRModule(dylib, std::move(module))) {
+        throw std::runtime_error("Failed to add script: " + llvm::toString(std::move(error)));
+    }
+    auto address = jit->lookup(dylib, entry);
+    if (!address) {
+        throw std::runtime_error("Failed to get script entry: " + llvm::toString(address.takeError()));
+    }
+    script->entry = address->toPtr<int (*)()>();
+    return script;
+}
+
+LuaState::LuaState(std::shared_ptr<const LuaScript> script)
+    : script(std::move(script)),
+      slots(new uint64_t[this->script->slotCount()]()) {
+    execution.slots = slots.get();
+    execution.heap = lua_heap_new();
+}
+
+LuaState::~LuaState() {
+    lua_heap_delete(execution.heap);
+}
+
+namespace {
+
+// 离开 run 时（包括异常）恢复之前挂在当前线程上的执行
+struct ExecutionScope {
+    LuaExecution* previous;
+    explicit ExecutionScope(LuaExecution* execution) : previous(lua_set_execution(execution)) {}
+    ~ExecutionScope() { lua_set_execution(previous); }
+};
+
+} // namespace
+
+int LuaState::run() {
+    // 执行期间挂在当前线程上，可以嵌套（例如在调度函数中执行另一个 LuaState）
+    ExecutionScope scope(&execution);
+    lastError = 0;
+    try {
+        return script->entry();
+    } catch (const LuaError& e) {
+        lastError = e.value;
+        return LUA_STATE_ERROR;
+    }
+}
+
+double LuaState::getGlobal(const std::string& name) const {
+    int slot = script->globalSlot(name);
+    double value = 0;
+    if (slot >= 0) {
+        memcpy(&value, &slots[slot], sizeof(value));
+    }
+    return value;
+}
+
+void LuaState::setGlobal(const std::string& name, double value) {
+    int slot = script->globalSlot(name);
+    if (slot < 0) {
+        throw std::runtime_error("Unknown global variable: " + name);
+    }
+    memcpy(&slots[slot], &value, sizeof(value));
+}
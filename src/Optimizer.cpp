@@ -0,0 +1,833 @@
+#include "Optimizer.h"
+#include "Runtime.h"
+
+void ASTOptimizer::run(BlockStmt* root) {
+    // 第一遍折叠常量、删除死代码，之后才能看出哪些调用的实参是常量
+    foldStatements(root->getStatementsRef());
+
+    collectFunctions(root->getStatements());
+    findPureFunctions();
+    if (!pureFunctions.empty()) {
+        evaluateCalls = true;
+        foldStatements(root->getStatementsRef());
+        evaluateCalls = false;
+    }
+}
+
+void ASTOptimizer::foldExpr(std::unique_ptr<Expr>& expr) {
+    if (!expr) {
+        return;
+    }
+    replacement.reset();
+    expr->accept(*this);
+    if (replacement) {
+        expr = std::move(replacement);
+    }
+}
+
+// 被删除的分支或循环体换成空块，保持父节点的结构
+void ASTOptimizer::foldStmt(std::unique_ptr<Stmt>& stmt) {
+    if (!stmt) {
+        return;
+    }
+    stmtReplacement.reset();
+    removeStmt = false;
+    stmt->accept(*this);
+    if (stmtReplacement) {
+        stmt = std::move(stmtReplacement);
+    } else if (removeStmt) {
+        stmt = std::make_unique<BlockStmt>(std::vector<std::unique_ptr<Stmt>>());
+    }
+    removeStmt = false;
+}
+
+void ASTOptimizer::foldStatements(std::vector<std::unique_ptr<Stmt>>& statements) {
+    std::vector<std::unique_ptr<Stmt>> result;
+    bool reachable = true;
+    for (auto& stmt : statements) {
+        if (!reachable) {
+            // return 之后的语句不可达，但其中的函数声明会被提升
+            if (containsFunction(stmt.get())) {
+                foldStmt(stmt);
+                result.push_back(std::move(stmt));
+            }
+            continue;
+        }
+        stmtReplacement.reset();
+        removeStmt = false;
+        stmt->accept(*this);
+        if (stmtReplacement) {
+            stmt = std::move(stmtReplacement);
+        } else if (removeStmt) {
+            removeStmt = false;
+            continue;
+        }
+        reachable = !alwaysReturns(stmt.get());
+        result.push_back(std::move(stmt));
+    }
+    statements = std::move(result);
+}
+
+bool ASTOptimizer::toConstant(Expr* expr, Constant& value) {
+    if (auto* number = dynamic_cast<NumberExpr*>(expr)) {
+        value.kind = Constant::NUMBER;
+        value.number = number->getValue();
+        return true;
+    }
+    if (auto* string = dynamic_cast<StringExpr*>(expr)) {
+        value.kind = Constant::STRING;
+        value.string = string->getValue();
+        return true;
+    }
+    if (dynamic_cast<NilExpr*>(expr)) {
+        value.kind = Constant::NIL;
+        return true;
+    }
+    return false;
+}
+
+std::unique_ptr<Expr> ASTOptimizer::makeExpr(const Constant& value) {
+    switch (value.kind) {
+    case Constant::NUMBER:
+        return std::make_unique<NumberExpr>(value.number);
+    case Constant::STRING:
+        return std::make_unique<StringExpr>(value.string);
+    case Constant::NIL:
+        break;
+    }
+    return std::make_unique<NilExpr>();
+}
+
+// 与生成的代码一致：nil 和 0 为假，其他值（包括 NaN 和字符串）为真
+bool ASTOptimizer::toTruth(const Constant& value, bool& truth) {
+    truth = value.kind == Constant::STRING || (value.kind == Constant::NUMBER && value.number != 0);
+    return true;
+}
+
+bool ASTOptimizer::isConstantCondition(Expr* expr, bool& truth) {
+    Constant value;
+    return toConstant(expr, value) && toTruth(value, truth);
+}
+
+bool ASTOptimizer::alwaysReturns(Stmt* stmt) {
+    if (dynamic_cast<ReturnStmt*>(stmt)) {
+        return true;
+    }
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
+        for (const auto& inner : block->getStatements()) {
+            if (alwaysReturns(inner.get())) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        return ifStmt->getElseBranch() && alwaysReturns(ifStmt->getThenBranch()) &&
+               alwaysReturns(ifStmt->getElseBranch());
+    }
+    if (auto* repeat = dynamic_cast<RepeatStmt*>(stmt)) {
+        return alwaysReturns(repeat->getBody());
+    }
+    return false;
+}
+
+bool ASTOptimizer::containsFunction(Stmt* stmt) {
+    if (!stmt) {
+        return false;
+    }
+    if (dynamic_cast<FunctionDecl*>(stmt)) {
+        return true;
+    }
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
+        for (const auto& inner : block->getStatements()) {
+            if (containsFunction(inner.get())) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        return containsFunction(ifStmt->getThenBranch()) || containsFunction(ifStmt->getElseBranch());
+    }
+    if (auto* loop = dynamic_cast<WhileStmt*>(stmt)) {
+        return containsFunction(loop->getBody());
+    }
+    if (auto* repeat = dynamic_cast<RepeatStmt*>(stmt)) {
+        return containsFunction(repeat->getBody());
+    }
+    return false;
+}
+
+// 与 CodeGenerator::hasMultipleReturns 相同的判断，决定函数返回一个值还是两个值
+bool ASTOptimizer::hasMultipleReturns(FunctionDecl* decl) {
+    for (const auto& stmt : decl->getBody()) {
+        if (auto* ret = dynamic_cast<ReturnStmt*>(stmt.get())) {
+            if (ret->getValues().size() > 1) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool ASTOptimizer::applyBinary(BinaryOp op, const Constant& left, const Constant& right, Constant& result) {
+    if (op == BinaryOp::CONCAT) {
+        std::string text[2];
+        const Constant* operands[2] = {&left, &right};
+        for (int i = 0; i < 2; ++i) {
+            if (operands[i]->kind == Constant::STRING) {
+                text[i] = operands[i]->string;
+            } else if (operands[i]->kind == Constant::NUMBER) {
+                char buffer[LUA_NUMBER_BUFFER];
+                text[i].assign(buffer, lua_format_number(buffer, operands[i]->number));
+            } else {
+                return false;
+            }
+        }
+        result.kind = Constant::STRING;
+        result.string = text[0] + text[1];
+        return true;
+    }
+
+    if (isComparison(op)) {
+        return compare(op, left, right, result);
+    }
+
+    if (left.kind != Constant::NUMBER || right.kind != Constant::NUMBER) {
+        return false;
+    }
+    result.kind = Constant::NUMBER;
+    switch (op) {
+    case BinaryOp::ADD:
+        result.number = left.number + right.number;
+        return true;
+    case BinaryOp::SUB:
+        result.number = left.number - right.number;
+        return true;
+    case BinaryOp::MUL:
+        result.number = left.number * right.number;
+        return true;
+    case BinaryOp::DIV:
+        result.number = left.number / right.number;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool ASTOptimizer::isComparison(BinaryOp op) {
+    switch (op) {
+    case BinaryOp::EQ:
+    case BinaryOp::NEQ:
+    case BinaryOp::LT:
+    case BinaryOp::LT_EQ:
+    case BinaryOp::GT:
+    case BinaryOp::GT_EQ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 比较的结果：真为 1，假为 nil
+ASTOptimizer::Constant ASTOptimizer::makeBoolean(bool value) {
+    Constant result;
+    if (value) {
+        result.kind = Constant::NUMBER;
+        result.number = 1;
+    }
+    return result;
+}
+
+// 与 lua_compare 一致：nil 按 0 比较，字符串按字节比较；数值与字符串比较大小是运行时错误，不折叠
+bool ASTOptimizer::compare(BinaryOp op, const Constant& left, const Constant& right, Constant& result) {
+    bool leftString = left.kind == Constant::STRING;
+    bool rightString = right.kind == Constant::STRING;
+    double a = left.kind == Constant::NUMBER ? left.number : 0;
+    double b = right.kind == Constant::NUMBER ? right.number : 0;
+    int order = leftString && rightString ? left.string.compare(right.string) : 0;
+    if (op == BinaryOp::EQ || op == BinaryOp::NEQ) {
+        bool equal = leftString || rightString ? leftString && rightString && order == 0 : a == b;
+        result = makeBoolean(equal == (op == BinaryOp::EQ));
+        return true;
+    }
+    if (leftString != rightString) {
+        return false;
+    }
+    switch (op) {
+    case BinaryOp::LT:
+        result = makeBoolean(leftString ? order < 0 : a < b);
+        return true;
+    case BinaryOp::LT_EQ:
+        result = makeBoolean(leftString ? order <= 0 : a <= b);
+        return true;
+    case BinaryOp::GT:
+        result = makeBoolean(leftString ? order > 0 : a > b);
+        return true;
+    default:
+        result = makeBoolean(leftString ? order >= 0 : a >= b);
+        return true;
+    }
+}
+
+void ASTOptimizer::collectFunctions(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    for (const auto& stmt : statements) {
+        if (auto* decl = dynamic_cast<FunctionDecl*>(stmt.get())) {
+            functions[decl->getName()].push_back(decl);
+            collectFunctions(decl->getBody());
+        } else if (auto* block = dynamic_cast<BlockStmt*>(stmt.get())) {
+            collectFunctions(block->getStatements());
+        } else if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt.get())) {
+            for (Stmt* branch : {ifStmt->getThenBranch(), ifStmt->getElseBranch()}) {
+                if (auto* block = dynamic_cast<BlockStmt*>(branch)) {
+                    collectFunctions(block->getStatements());
+                }
+            }
+        } else if (auto* loop = dynamic_cast<WhileStmt*>(stmt.get())) {
+            if (auto* block = dynamic_cast<BlockStmt*>(loop->getBody())) {
+                collectFunctions(block->getStatements());
+            }
+        } else if (auto* repeat = dynamic_cast<RepeatStmt*>(stmt.get())) {
+            if (auto* block = dynamic_cast<BlockStmt*>(repeat->getBody())) {
+                collectFunctions(block->getStatements());
+            }
+        }
+    }
+}
+
+// 纯函数：只有一个定义，函数体只读写参数和局部变量，调用的函数也都是纯函数
+void ASTOptimizer::findPureFunctions() {
+    std::map<std::string, std::set<std::string>> callees;
+    for (const auto& entry : functions) {
+        if (entry.second.size() != 1) {
+            continue;
+        }
+        FunctionDecl* decl = entry.second.front();
+        std::vector<std::set<std::string>> scopes(1);
+        scopes[0].insert(decl->getParams().begin(), decl->getParams().end());
+        bool pure = true;
+        for (const auto& stmt : decl->getBody()) {
+            if (!isPureStmt(stmt.get(), scopes, callees[entry.first])) {
+                pure = false;
+                break;
+            }
+        }
+        if (pure) {
+            pureFunctions.insert(entry.first);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = pureFunctions.begin(); it != pureFunctions.end();) {
+            bool pure = true;
+            for (const auto& callee : callees[*it]) {
+                if (!pureFunctions.count(callee)) {
+                    pure = false;
+                    break;
+                }
+            }
+            if (pure) {
+                ++it;
+            } else {
+                it = pureFunctions.erase(it);
+                changed = true;
+            }
+        }
+    }
+}
+
+bool ASTOptimizer::isPureStmt(Stmt* stmt, std::vector<std::set<std::string>>& scopes,
+                              std::set<std::string>& callees) {
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
+        scopes.emplace_back();
+        bool pure = true;
+        for (const auto& inner : block->getStatements()) {
+            if (!isPureStmt(inner.get(), scopes, callees)) {
+                pure = false;
+                break;
+            }
+        }
+        scopes.pop_back();
+        return pure;
+    }
+    if (auto* local = dynamic_cast<LocalVarDecl*>(stmt)) {
+        if (local->getInitializer() && !isPureExpr(local->getInitializer(), scopes, callees)) {
+            return false;
+        }
+        scopes.back().insert(local->getName());
+        return true;
+    }
+    if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) {
+        bool local = false;
+        for (const auto& scope : scopes) {
+            local = local || scope.count(assign->getName());
+        }
+        return local && isPureExpr(assign->getValue(), scopes, callees);
+    }
+    if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        return isPureExpr(ifStmt->getCondition(), scopes, callees) &&
+               isPureStmt(ifStmt->getThenBranch(), scopes, callees) &&
+               (!ifStmt->getElseBranch() || isPureStmt(ifStmt->getElseBranch(), scopes, callees));
+    }
+    if (auto* loop = dynamic_cast<WhileStmt*>(stmt)) {
+        return isPureExpr(loop->getCondition(), scopes, callees) &&
+               isPureStmt(loop->getBody(), scopes, callees);
+    }
+    if (auto* repeat = dynamic_cast<RepeatStmt*>(stmt)) {
+        // until 条件可以引用循环体内的 local
+        auto* body = dynamic_cast<BlockStmt*>(repeat->getBody());
+        if (!body) {
+            return isPureStmt(repeat->getBody(), scopes, callees) &&
+                   isPureExpr(repeat->getCondition(), scopes, callees);
+        }
+        scopes.emplace_back();
+        bool pure = true;
+        for (const auto& inner : body->getStatements()) {
+            if (!isPureStmt(inner.get(), scopes, callees)) {
+                pure = false;
+                break;
+            }
+        }
+        pure = pure && isPureExpr(repeat->getCondition(), scopes, callees);
+        scopes.pop_back();
+        return pure;
+    }
+    if (auto* ret = dynamic_cast<ReturnStmt*>(stmt)) {
+        for (const auto& value : ret->getValues()) {
+            if (!isPureExpr(value.get(), scopes, callees)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (auto* exprStmt = dynamic_cast<ExprStmt*>(stmt)) {
+        return !exprStmt->getExpr() || isPureExpr(exprStmt->getExpr(), scopes, callees);
+    }
+    return false;
+}
+
+bool ASTOptimizer::isPureExpr(Expr* expr, const std::vector<std::set<std::string>>& scopes,
+                              std::set<std::string>& callees) {
+    Constant value;
+    if (toConstant(expr, value)) {
+        return true;
+    }
+    if (auto* var = dynamic_cast<VarExpr*>(expr)) {
+        for (const auto& scope : scopes) {
+            if (scope.count(var->getName())) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (auto* binary = dynamic_cast<BinaryExpr*>(expr)) {
+        switch (binary->getOp()) {
+        case BinaryOp::ADD:
+        case BinaryOp::SUB:
+        case BinaryOp::MUL:
+        case BinaryOp::DIV:
+        case BinaryOp::CONCAT:
+        case BinaryOp::EQ:
+        case BinaryOp::NEQ:
+        case BinaryOp::LT:
+        case BinaryOp::LT_EQ:
+        case BinaryOp::GT:
+        case BinaryOp::GT_EQ:
+        case BinaryOp::AND_OP:
+        case BinaryOp::OR_OP:
+            return isPureExpr(binary->getLeft(), scopes, callees) &&
+                   isPureExpr(binary->getRight(), scopes, callees);
+        default:
+            return false;
+        }
+    }
+    if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+        return (unary->getOp() == UnaryOp::NEG || unary->getOp() == UnaryOp::NOT_OP) &&
+               isPureExpr(unary->getExpr(), scopes, callees);
+    }
+    if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        callees.insert(call->getCallee());
+        for (const auto& arg : call->getArguments()) {
+            if (!isPureExpr(arg.get(), scopes, callees)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+// 调用纯函数：实参的展开和返回值的个数与生成的代码一致——多返回值的实参在被调函数
+// 有一个参数时取第一个值、有两个参数时展开为两个值；多返回值函数总是返回两个值
+bool ASTOptimizer::call(const std::string& name, CallExpr* site, Scopes& scopes,
+                        std::vector<Constant>& results, int depth) {
+    if (!pureFunctions.count(name) || depth >= MAX_DEPTH) {
+        return false;
+    }
+    FunctionDecl* decl = functions[name].front();
+    size_t arity = decl->getParams().size();
+
+    std::vector<Constant> args;
+    for (const auto& arg : site->getArguments()) {
+        std::vector<Constant> values;
+        if (!evaluate(arg.get(), scopes, values, depth)) {
+            return false;
+        }
+        if (values.size() > 1 && arity == 2) {
+            args.insert(args.end(), values.begin(), values.end());
+        } else if (values.size() > 1 && arity != 1) {
+            return false;
+        } else {
+            args.push_back(values.front());
+        }
+    }
+    if (args.size() != arity) {
+        return false;
+    }
+
+    Scopes frame(1);
+    for (size_t i = 0; i < arity; ++i) {
+        frame[0][decl->getParams()[i]] = args[i];
+    }
+    std::vector<Constant> returned;
+    for (const auto& stmt : decl->getBody()) {
+        Flow flow = execute(stmt.get(), frame, returned, depth + 1);
+        if (flow == Flow::FAIL) {
+            return false;
+        }
+        if (flow == Flow::RETURN) {
+            break;
+        }
+    }
+    returned.resize(hasMultipleReturns(decl) ? 2 : 1);
+    results = std::move(returned);
+    return true;
+}
+
+ASTOptimizer::Flow ASTOptimizer::execute(Stmt* stmt, Scopes& scopes,
+                                         std::vector<Constant>& results, int depth) {
+    if (++steps > MAX_STEPS) {
+        return Flow::FAIL;
+    }
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
+        scopes.emplace_back();
+        for (const auto& inner : block->getStatements()) {
+            Flow flow = execute(inner.get(), scopes, results, depth);
+            if (flow != Flow::NORMAL) {
+                scopes.pop_back();
+                return flow;
+            }
+        }
+        scopes.pop_back();
+        return Flow::NORMAL;
+    }
+    if (auto* local = dynamic_cast<LocalVarDecl*>(stmt)) {
+        Constant value;
+        if (local->getInitializer() && !evaluateValue(local->getInitializer(), scopes, value, depth)) {
+            return Flow::FAIL;
+        }
+        scopes.back()[local->getName()] = value;
+        return Flow::NORMAL;
+    }
+    if (auto* assign = dynamic_cast<AssignStmt*>(stmt)) {
+        Constant value;
+        if (!evaluateValue(assign->getValue(), scopes, value, depth)) {
+            return Flow::FAIL;
+        }
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            auto it = scope->find(assign->getName());
+            if (it != scope->end()) {
+                it->second = value;
+                return Flow::NORMAL;
+            }
+        }
+        return Flow::FAIL;
+    }
+    if (auto* ret = dynamic_cast<ReturnStmt*>(stmt)) {
+        results.clear();
+        for (const auto& valueExpr : ret->getValues()) {
+            Constant value;
+            if (!evaluateValue(valueExpr.get(), scopes, value, depth)) {
+                return Flow::FAIL;
+            }
+            results.push_back(value);
+        }
+        return Flow::RETURN;
+    }
+    if (auto* exprStmt = dynamic_cast<ExprStmt*>(stmt)) {
+        std::vector<Constant> values;
+        if (exprStmt->getExpr() && !evaluate(exprStmt->getExpr(), scopes, values, depth)) {
+            return Flow::FAIL;
+        }
+        return Flow::NORMAL;
+    }
+
+    // 条件语句和循环：条件的值必须是数值或 nil
+    auto test = [&](Expr* condition, bool& truth) {
+        Constant value;
+        return evaluateValue(condition, scopes, value, depth) && toTruth(value, truth);
+    };
+    bool truth = false;
+    if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt)) {
+        if (!test(ifStmt->getCondition(), truth)) {
+            return Flow::FAIL;
+        }
+        Stmt* branch = truth ? ifStmt->getThenBranch() : ifStmt->getElseBranch();
+        return branch ? execute(branch, scopes, results, depth) : Flow::NORMAL;
+    }
+    if (auto* loop = dynamic_cast<WhileStmt*>(stmt)) {
+        while (true) {
+            if (!test(loop->getCondition(), truth)) {
+                return Flow::FAIL;
+            }
+            if (!truth) {
+                return Flow::NORMAL;
+            }
+            Flow flow = execute(loop->getBody(), scopes, results, depth);
+            if (flow != Flow::NORMAL) {
+                return flow;
+            }
+        }
+    }
+    if (auto* repeat = dynamic_cast<RepeatStmt*>(stmt)) {
+        while (true) {
+            Flow flow = execute(repeat->getBody(), scopes, results, depth);
+            if (flow != Flow::NORMAL) {
+                return flow;
+            }
+            if (!test(repeat->getCondition(), truth)) {
+                return Flow::FAIL;
+            }
+            if (truth) {
+                return Flow::NORMAL;
+            }
+        }
+    }
+    return Flow::FAIL;
+}
+
+bool ASTOptimizer::evaluate(Expr* expr, Scopes& scopes, std::vector<Constant>& values, int depth) {
+    if (++steps > MAX_STEPS) {
+        return false;
+    }
+    Constant value;
+    if (toConstant(expr, value)) {
+        values.assign(1, value);
+        return true;
+    }
+    if (auto* var = dynamic_cast<VarExpr*>(expr)) {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            auto it = scope->find(var->getName());
+            if (it != scope->end()) {
+                values.assign(1, it->second);
+                return true;
+            }
+        }
+        return false;
+    }
+    if (auto* binary = dynamic_cast<BinaryExpr*>(expr)) {
+        Constant left, right;
+        if (binary->getOp() == BinaryOp::AND_OP || binary->getOp() == BinaryOp::OR_OP) {
+            bool truth;
+            if (!evaluateValue(binary->getLeft(), scopes, left, depth) || !toTruth(left, truth)) {
+                return false;
+            }
+            if (truth != (binary->getOp() == BinaryOp::AND_OP)) {
+                values.assign(1, left);
+                return true;
+            }
+            return evaluate(binary->getRight(), scopes, values, depth);
+        }
+        if (!evaluateValue(binary->getLeft(), scopes, left, depth) ||
+            !evaluateValue(binary->getRight(), scopes, right, depth) ||
+            !applyBinary(binary->getOp(), left, right, value)) {
+            return false;
+        }
+        values.assign(1, value);
+        return true;
+    }
+    if (auto* unary = dynamic_cast<UnaryExpr*>(expr)) {
+        bool truth;
+        if (unary->getOp() == UnaryOp::NOT_OP) {
+            if (!evaluateValue(unary->getExpr(), scopes, value, depth) || !toTruth(value, truth)) {
+                return false;
+            }
+            values.assign(1, makeBoolean(!truth));
+            return true;
+        }
+        if (unary->getOp() != UnaryOp::NEG || !evaluateValue(unary->getExpr(), scopes, value, depth) ||
+            value.kind != Constant::NUMBER) {
+            return false;
+        }
+        value.number = -value.number;
+        values.assign(1, value);
+        return true;
+    }
+    if (auto* callExpr = dynamic_cast<CallExpr*>(expr)) {
+        return call(callExpr->getCallee(), callExpr, scopes, values, depth);
+    }
+    return false;
+}
+
+bool ASTOptimizer::evaluateValue(Expr* expr, Scopes& scopes, Constant& value, int depth) {
+    std::vector<Constant> values;
+    if (!evaluate(expr, scopes, values, depth)) {
+        return false;
+    }
+    value = values.front();
+    return true;
+}
+
+void ASTOptimizer::visit(BlockStmt* node) {
+    foldStatements(node->getStatementsRef());
+}
+
+void ASTOptimizer::visit(FunctionDecl* node) {
+    foldStatements(node->getBodyRef());
+}
+
+void ASTOptimizer::visit(ReturnStmt* node) {
+    for (auto& value : node->getValuesRef()) {
+        foldExpr(value);
+    }
+}
+
+void ASTOptimizer::visit(IfStmt* node) {
+    foldExpr(node->getConditionRef());
+    foldStmt(node->getThenBranchRef());
+    foldStmt(node->getElseBranchRef());
+
+    bool truth;
+    if (!isConstantCondition(node->getCondition(), truth)) {
+        return;
+    }
+    std::unique_ptr<Stmt>& taken = truth ? node->getThenBranchRef() : node->getElseBranchRef();
+    std::unique_ptr<Stmt>& dropped = truth ? node->getElseBranchRef() : node->getThenBranchRef();
+    if (containsFunction(dropped.get())) {
+        return;
+    }
+    if (!taken) {
+        removeStmt = true;
+        return;
+    }
+    taken->setLocation(node->getLine(), node->getColumn());
+    stmtReplacement = std::move(taken);
+}
+
+void ASTOptimizer::visit(WhileStmt* node) {
+    foldExpr(node->getConditionRef());
+    foldStmt(node->getBodyRef());
+
+    bool truth;
+    if (isConstantCondition(node->getCondition(), truth) && !truth && !containsFunction(node->getBody())) {
+        removeStmt = true;
+    }
+}
+
+void ASTOptimizer::visit(RepeatStmt* node) {
+    foldStmt(node->getBodyRef());
+    foldExpr(node->getConditionRef());
+
+    // until 的条件恒为真：循环体只执行一次
+    bool truth;
+    if (isConstantCondition(node->getCondition(), truth) && truth) {
+        node->getBodyRef()->setLocation(node->getLine(), node->getColumn());
+        stmtReplacement = std::move(node->getBodyRef());
+    }
+}
+
+void ASTOptimizer::visit(ExprStmt* node) {
+    foldExpr(node->getExprRef());
+    Constant value;
+    if (!node->getExpr() || toConstant(node->getExpr(), value)) {
+        removeStmt = true;
+    }
+}
+
+void ASTOptimizer::visit(BinaryExpr* node) {
+    foldExpr(node->getLeftRef());
+    foldExpr(node->getRightRef());
+    Constant left, right, result;
+    // a and b、a or b：a 是常量时结果就是 a 或 b
+    bool truth;
+    if ((node->getOp() == BinaryOp::AND_OP || node->getOp() == BinaryOp::OR_OP) &&
+        isConstantCondition(node->getLeft(), truth)) {
+        bool takeRight = truth == (node->getOp() == BinaryOp::AND_OP);
+        replacement = std::move(takeRight ? node->getRightRef() : node->getLeftRef());
+        return;
+    }
+    if (toConstant(node->getLeft(), left) && toConstant(node->getRight(), right) &&
+        applyBinary(node->getOp(), left, right, result)) {
+        replacement = makeExpr(result);
+    }
+}
+
+void ASTOptimizer::visit(UnaryExpr* node) {
+    foldExpr(node->getExprRef());
+    auto* number = dynamic_cast<NumberExpr*>(node->getExpr());
+    if (node->getOp() == UnaryOp::NEG && number) {
+        replacement = std::make_unique<NumberExpr>(-number->getValue());
+    }
+    bool truth;
+    if (node->getOp() == UnaryOp::NOT_OP && isConstantCondition(node->getExpr(), truth)) {
+        replacement = makeExpr(makeBoolean(!truth));
+    }
+}
+
+void ASTOptimizer::visit(NumberExpr* node) {}
+
+void ASTOptimizer::visit(StringExpr* node) {}
+
+void ASTOptimizer::visit(NilExpr* node) {}
+
+void ASTOptimizer::visit(VarExpr* node) {}
+
+// 第二遍时，以常量实参调用单返回值纯函数的表达式替换为返回值
+void ASTOptimizer::visit(CallExpr* node) {
+    for (auto& arg : node->getArgumentsRef()) {
+        foldExpr(arg);
+    }
+    const std::string& name = node->getCallee();
+    if (!evaluateCalls || !pureFunctions.count(name) || hasMultipleReturns(functions[name].front())) {
+        return;
+    }
+    steps = 0;
+    Scopes scopes(1);
+    std::vector<Constant> results;
+    if (call(name, node, scopes, results, 0)) {
+        replacement = makeExpr(results.front());
+    }
+}
+
+void ASTOptimizer::visit(PrintExpr* node) {
+    foldExpr(node->getExprRef());
+}
+
+void ASTOptimizer::visit(LocalVarDecl* node) {
+    foldExpr(node->getInitializerRef());
+}
+
+void ASTOptimizer::visit(AssignStmt* node) {
+    foldExpr(node->getValueRef());
+}
+
+void ASTOptimizer::visit(IndexExpr* node) {
+    foldExpr(node->getObjectRef());
+    foldExpr(node->getKeyRef());
+}
+
+void ASTOptimizer::visit(TableExpr* node) {
+    for (auto& field : node->getFieldsRef()) {
+        foldExpr(field.key);
+        foldExpr(field.value);
+    }
+    foldExpr(node->getSizeRef());
+}
+
+void ASTOptimizer::visit(IndexAssignStmt* node) {
+    foldExpr(node->getTarget()->getObjectRef());
+    foldExpr(node->getTarget()->getKeyRef());
+    foldExpr(node->getValueRef());
+}
@@ -1,40 +1,137 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
 #include "CodeGen.h"
+#include "JITSession.h"
+#include "Lexer.h"
 
-extern int yyparse();
-extern FILE* yyin;
-extern std::unique_ptr<BlockStmt> root;
+// 交互模式：先依次加载命令行给出的文件，然后逐个读取 chunk（以空行结束）执行，
+// 所有 chunk 共享同一个 JIT 会话
+static int runInteractive(unsigned optLevel, bool debugInfo, bool preemption, bool profileAlloc,
+                          const std::vector<const char*>& files) {
+    JITSession session(optLevel, debugInfo);
+    session.setPreemption(preemption);
+    session.setAllocationProfiling(profileAlloc);
+    for (const char* file : files) {
+        try {
+            session.runFile(file);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << file << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <input.lua>" << std::endl;
-        return 1;
+    std::string chunk;
+    std::string line;
+    std::cout << "> " << std::flush;
+    while (std::getline(std::cin, line)) {
+        if (!line.empty()) {
+            chunk += line + "\n";
+            std::cout << ">> " << std::flush;
+            continue;
+        }
+        if (!chunk.empty()) {
+            try {
+                session.runString(chunk);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+            }
+            chunk.clear();
+        }
+        std::cout << "> " << std::flush;
+    }
+    if (!chunk.empty()) {
+        try {
+            session.runString(chunk);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
     }
+    return 0;
+}
 
-    // 打开输入文件
-    FILE* input = fopen(argv[1], "r");
-    if (!input) {
-        std::cerr << "Error: Could not open input file: " << argv[1] << std::endl;
+int main(int argc, char* argv[]) {
+    // 解析命令行：[-O0|-O1|-O2|-O3] [-g] [-preempt] [-profile-alloc] [--shared] <input.lua>
+    // 或 [选项] -i [chunk.lua ...]
+    unsigned optLevel = 0;
+    bool shared = false;
+    bool debugInfo = false;
+    bool preemption = false;
+    bool profileAlloc = false;
+    bool interactive = false;
+    std::vector<const char*> inputFiles;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3') {
+            optLevel = arg[2] - '0';
+        } else if (arg == "-O") {
+            optLevel = 2;
+        } else if (arg == "-g") {
+            debugInfo = true;
+        } else if (arg == "-preempt") {
+            preemption = true;
+        } else if (arg == "-profile-alloc") {
+            profileAlloc = true;
+        } else if (arg == "--shared") {
+            shared = true;
+        } else if (arg == "-i") {
+            interactive = true;
+        } else if (arg[0] != '-') {
+            inputFiles.push_back(argv[i]);
+        } else {
+            inputFiles.clear();
+            interactive = false;
+            break;
+        }
+    }
+    if (interactive) {
+        return runInteractive(optLevel, debugInfo, preemption, profileAlloc, inputFiles);
+    }
+    if (inputFiles.size() != 1) {
+        std::cerr << "Usage: " << argv[0] << " [-O0|-O1|-O2|-O3] [-g] [-preempt] [-profile-alloc] [--shared] <input.lua>" << std::endl;
+        std::cerr << "       " << argv[0] << " [-O0|-O1|-O2|-O3] [-g] [-preempt] [-profile-alloc] -i [chunk.lua ...]" << std::endl;
         return 1;
     }
-    yyin = input;
+    const char* inputFile = inputFiles[0];
 
     try {
-        // 解析输入文件
-        if (yyparse() != 0) {
-            std::cerr << "Error: Parsing failed" << std::endl;
-            return 1;
-        }
+        // 映射输入文件并解析，AST 构造完成前源码必须保持映射
+        SourceFile source(inputFile);
+        std::unique_ptr<BlockStmt> root = parseSource(source.text());
 
         // 生成代码
         CodeGenerator codegen;
+        codegen.setOptimizationLevel(optLevel);
+        codegen.setPreemption(preemption);
+        codegen.setSharedLibrary(shared);
+        if (shared) {
+            // 入口不能叫 main，否则优化器会假定它在进程中只执行一次
+            codegen.setEntryName("lua_chunk_main");
+        }
+        if (debugInfo) {
+            codegen.enableDebugInfo(inputFile);
+        }
+        if (profileAlloc) {
+            codegen.enableAllocationProfiling(inputFile);
+        }
         codegen.generateCode(root.get());
 
         // 获取输入文件的目录
-        std::string inputPath(argv[1]);
+        std::string inputPath(inputFile);
         size_t lastSlash = inputPath.find_last_of("/\\");
+
+        // 共享库与输入文件同名：dir/name.lua -> dir/name.so
+        if (shared) {
+            size_t dot = inputPath.find_last_of('.');
+            bool hasExtension = dot != std::string::npos && (lastSlash == std::string::npos || dot > lastSlash);
+            std::string libraryPath = (hasExtension ? inputPath.substr(0, dot) : inputPath) + ".so";
+            codegen.emitSharedLibrary(libraryPath);
+            std::cout << "Successfully generated shared library: " << libraryPath << std::endl;
+            return 0;
+        }
+
         std::string outputPath;
         if (lastSlash != std::string::npos) {
             outputPath = inputPath.substr(0, lastSlash + 1) + "output.ll";
@@ -3,13 +3,31 @@
 #include <string>
 #include <vector>
 #include "AST.h"
+#include "Token.h"
 
 extern int yylex();
 extern int line_number;
+extern int column_number;
 void yyerror(const char *s);
 
 std::unique_ptr<BlockStmt> root;
 
+// 被调用的名字：f(...) 调用函数 f，lib.f(...) 调用库函数 "lib.f"，其余不能调用
+static bool getCalleeName(Expr* callee, std::string& name) {
+    if (auto* var = dynamic_cast<VarExpr*>(callee)) {
+        name = var->getName();
+        return true;
+    }
+    auto* index = dynamic_cast<IndexExpr*>(callee);
+    auto* lib = index ? dynamic_cast<VarExpr*>(index->getObject()) : nullptr;
+    auto* field = index ? dynamic_cast<StringExpr*>(index->getKey()) : nullptr;
+    if (lib && field) {
+        name = lib->getName() + "." + field->getValue();
+        return true;
+    }
+    return false;
+}
+
 // 辅助函数，将操作符转换为 BinaryOp
 BinaryOp tokenToBinaryOp(int token) {
     switch (token) {
@@ -22,6 +40,8 @@ BinaryOp tokenToBinaryOp(int token) {
         case '>': return BinaryOp::GT;
         case LE: return BinaryOp::LT_EQ;
         case GE: return BinaryOp::GT_EQ;
+        case EQ: return BinaryOp::EQ;
+        case NE: return BinaryOp::NEQ;
         case AND: return BinaryOp::AND_OP;
         case OR: return BinaryOp::OR_OP;
         case CONC: return BinaryOp::CONCAT;
@@ -40,31 +60,36 @@ UnaryOp tokenToUnaryOp(int token) {
 }
 %}
 
+%locations
+
 %union {
     double number;
-    char* string;
+    TokenText string;
     Expr* expr;
     Stmt* stmt;
     std::vector<std::unique_ptr<Stmt>>* stmtList;
     std::vector<std::string>* identList;
     std::vector<std::unique_ptr<Expr>>* exprList;
+    std::vector<TableExpr::Field>* fieldList;
 }
 
 %token <number> NUMBER
 %token <string> STRING IDENTIFIER
 %token LOCAL IF THEN ELSE ELSEIF WHILE DO REPEAT UNTIL FUNCTION END RETURN NIL
-%token AND OR NOT NE LE GE CONC
+%token AND OR NOT EQ NE LE GE CONC
 
-%type <expr> expr primary_expr
+%type <expr> expr primary_expr var table_constructor
 %type <stmt> stmt function_decl return_stmt if_stmt while_stmt repeat_stmt
+%type <stmt> local_decl assign_stmt
 %type <stmtList> stmt_list
 %type <identList> param_list
 %type <exprList> expr_list arg_list
+%type <fieldList> field_list fields
 
 %left OR
 %left AND
-%left '<' LE '>' GE '=' NE
-%left CONC
+%left '<' LE '>' GE '=' EQ NE
+%right CONC
 %left '+' '-'
 %left '*' '/' '%'
 %right NOT
@@ -87,12 +112,14 @@ stmt_list   : stmt
     {
         $$ = new std::vector<std::unique_ptr<Stmt>>();
         if ($1) {
+            $1->setLocation(@1.first_line, @1.first_column);
             $$->push_back(std::unique_ptr<Stmt>($1));
         }
     }
     | stmt_list stmt
     {
         if ($2) {
+            $2->setLocation(@2.first_line, @2.first_column);
             $1->push_back(std::unique_ptr<Stmt>($2));
         }
         $$ = $1;
@@ -105,6 +132,8 @@ stmt        : ';'                         { $$ = nullptr; }
             | if_stmt                     { $$ = $1; }
             | while_stmt                  { $$ = $1; }
             | repeat_stmt                 { $$ = $1; }
+            | local_decl                  { $$ = $1; }
+            | assign_stmt                 { $$ = $1; }
             | expr                        { $$ = new ExprStmt(std::unique_ptr<Expr>($1)); }
             ;
 
@@ -114,7 +143,7 @@ function_decl: FUNCTION IDENTIFIER '(' param_list ')' stmt_list END
         for (auto& stmt : *$6) {
             body.push_back(std::move(stmt));
         }
-        $$ = new FunctionDecl($2, *$4, std::move(body));
+        $$ = new FunctionDecl($2.str(), *$4, std::move(body));
         delete $4;
         delete $6;
     }
@@ -122,8 +151,8 @@ function_decl: FUNCTION IDENTIFIER '(' param_list ')' stmt_list END
 
 param_list  : /* empty */                { $$ = new std::vector<std::string>(); }
             | IDENTIFIER                  { $$ = new std::vector<std::string>();
-                                          $$->push_back($1); }
-            | param_list ',' IDENTIFIER   { $1->push_back($3); $$ = $1; }
+                                          $$->push_back($1.str()); }
+            | param_list ',' IDENTIFIER   { $1->push_back($3.str()); $$ = $1; }
             ;
 
 return_stmt : RETURN expr_list
@@ -191,6 +220,28 @@ repeat_stmt : REPEAT stmt_list UNTIL expr
     }
     ;
 
+local_decl  : LOCAL IDENTIFIER
+    {
+        $$ = new LocalVarDecl($2.str());
+    }
+    | LOCAL IDENTIFIER '=' expr
+    {
+        $$ = new LocalVarDecl($2.str(), std::unique_ptr<Expr>($4));
+    }
+    ;
+
+assign_stmt : var '=' expr
+    {
+        if (auto* var = dynamic_cast<VarExpr*>($1)) {
+            $$ = new AssignStmt(var->getName(), std::unique_ptr<Expr>($3));
+            delete var;
+        } else {
+            $$ = new IndexAssignStmt(std::unique_ptr<IndexExpr>(static_cast<IndexExpr*>($1)),
+                                     std::unique_ptr<Expr>($3));
+        }
+    }
+    ;
+
 expr_list   : expr
     {
         $$ = new std::vector<std::unique_ptr<Expr>>();
@@ -216,6 +267,33 @@ expr        : primary_expr               { $$ = $1; }
             | expr '/' expr              { $$ = new BinaryExpr(BinaryOp::DIV,
                                                              std::unique_ptr<Expr>($1),
                                                              std::unique_ptr<Expr>($3)); }
+            | expr CONC expr             { $$ = new BinaryExpr(BinaryOp::CONCAT,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
+            | expr '<' expr              { $$ = new BinaryExpr(BinaryOp::LT,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
+            | expr LE expr               { $$ = new BinaryExpr(BinaryOp::LT_EQ,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
+            | expr '>' expr              { $$ = new BinaryExpr(BinaryOp::GT,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
+            | expr GE expr               { $$ = new BinaryExpr(BinaryOp::GT_EQ,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
+            | expr EQ expr               { $$ = new BinaryExpr(BinaryOp::EQ,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
+            | expr NE expr               { $$ = new BinaryExpr(BinaryOp::NEQ,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
+            | expr AND expr              { $$ = new BinaryExpr(BinaryOp::AND_OP,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
+            | expr OR expr               { $$ = new BinaryExpr(BinaryOp::OR_OP,
+                                                             std::unique_ptr<Expr>($1),
+                                                             std::unique_ptr<Expr>($3)); }
             | '-' expr %prec NOT         { $$ = new UnaryExpr(UnaryOp::NEG,
                                                              std::unique_ptr<Expr>($2)); }
             | NOT expr
@@ -225,21 +303,95 @@ expr        : primary_expr               { $$ = $1; }
             ;
 
 primary_expr: NUMBER                     { $$ = new NumberExpr($1); }
-            | STRING                     { $$ = new StringExpr($1); }
+            | STRING                     { $$ = new StringExpr($1.str()); }
             | NIL                        { $$ = new NilExpr(); }
-            | IDENTIFIER                 { $$ = new VarExpr($1); }
-            | IDENTIFIER '(' arg_list ')'
+            | var                        { $$ = $1; }
+            | var '(' arg_list ')'
             {
+                std::string name;
+                bool callable = getCalleeName($1, name);
+                delete $1;
+                if (!callable) {
+                    delete $3;
+                    yyerror("only named functions can be called");
+                    YYERROR;
+                }
                 std::vector<std::unique_ptr<Expr>> args;
                 for (auto& arg : *$3) {
                     args.push_back(std::move(arg));
                 }
-                $$ = new CallExpr($1, std::move(args));
+                $$ = new CallExpr(name, std::move(args));
                 delete $3;
             }
+            | table_constructor          { $$ = $1; }
             | '(' expr ')'               { $$ = $2; }
             ;
 
+var         : IDENTIFIER                 { $$ = new VarExpr($1.str()); }
+            | var '[' expr ']'
+            {
+                $$ = new IndexExpr(std::unique_ptr<Expr>($1), std::unique_ptr<Expr>($3));
+            }
+            | var '.' IDENTIFIER
+            {
+                $$ = new IndexExpr(std::unique_ptr<Expr>($1), std::make_unique<StringExpr>($3.str()));
+            }
+            ;
+
+table_constructor
+            : '@' '(' ')'                { $$ = new TableExpr({}); }
+            | '@' '(' expr ')'           { $$ = new TableExpr({}, std::unique_ptr<Expr>($3)); }
+            | '@' '[' arg_list ']'
+            {
+                // 列表元素从 1 开始编号
+                std::vector<TableExpr::Field> fields;
+                for (auto& value : *$3) {
+                    fields.push_back({std::make_unique<NumberExpr>(fields.size() + 1), std::move(value)});
+                }
+                $$ = new TableExpr(std::move(fields));
+                delete $3;
+            }
+            | '@' '{' field_list '}'
+            {
+                $$ = new TableExpr(std::move(*$3));
+                delete $3;
+            }
+            | '@' IDENTIFIER '{' field_list '}'
+            {
+                auto* table = new TableExpr(std::move(*$4));
+                table->setConstructor($2.str());
+                $$ = table;
+                delete $4;
+            }
+            ;
+
+field_list  : /* empty */                { $$ = new std::vector<TableExpr::Field>(); }
+            | fields                     { $$ = $1; }
+            | fields ','                 { $$ = $1; }
+            ;
+
+fields      : IDENTIFIER '=' expr
+            {
+                $$ = new std::vector<TableExpr::Field>();
+                $$->push_back({std::make_unique<StringExpr>($1.str()), std::unique_ptr<Expr>($3)});
+            }
+            | '[' expr ']' '=' expr
+            {
+                $$ = new std::vector<TableExpr::Field>();
+                $$->push_back({std::unique_ptr<Expr>($2), std::unique_ptr<Expr>($5)});
+            }
+            | fields ',' IDENTIFIER '=' expr
+            {
+                $1->push_back({std::make_unique<StringExpr>($3.str()), std::unique_ptr<Expr>($5)});
+                $$ = $1;
+            }
+            | fields ',' '[' expr ']' '=' expr
+            {
+                $1->push_back({std::unique_ptr<Expr>($4), std::unique_ptr<Expr>($7)});
+                $$ = $1;
+            }
+            ;
+
 arg_list    : /* empty */               { $$ = new std::vector<std::unique_ptr<Expr>>(); }
             | expr_list                  { $$ = $1; }
             ;
@@ -247,5 +399,5 @@ arg_list    : /* empty */               { $$ = new std::vector<std::unique_ptr<E
 %%
 
 void yyerror(const char *s) {
-    fprintf(stderr, "Error at line %d: %s\n", line_number, s);
+    fprintf(stderr, "Error at line %d, column %d: %s\n", line_number, column_number, s);
 } 
\ No newline at end of file
@@ -0,0 +1,294 @@
+#include "Runtime.h"
+#include <algorithm>
+#include <cstring>
+
+// 数组部分上的向量操作。用 GCC/clang 的向量扩展一次处理 2 个 double（x86-64 的 SSE2 和
+// AArch64 的 NEON 都有 128 位向量）；求和与点积用两个累加器隐藏加法的延迟
+
+namespace {
+
+typedef double Vector __attribute__((vector_size(2 * sizeof(double))));
+typedef uint64_t Bits __attribute__((vector_size(2 * sizeof(uint64_t))));
+constexpr uint32_t LANES = 2;
+
+// 装箱的对象（标签不小于 LUA_TAG_STRING）按无符号数比较都不小于 BOXED
+constexpr uint64_t BOXED = LUA_TAG_STRING << LUA_TAG_SHIFT;
+
+inline uint64_t toBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double fromBits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline bool isNumber(double value) {
+    return toBits(value) < BOXED;
+}
+
+inline bool isString(double value) {
+    return (toBits(value) >> LUA_TAG_SHIFT) == LUA_TAG_STRING;
+}
+
+inline const char* toString(double value) {
+    return reinterpret_cast<const char*>(toBits(value) & LUA_PAYLOAD_MASK);
+}
+
+inline Vector load(const double* p) {
+    Vector v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void store(double* p, Vector v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+inline Vector splat(double value) {
+    return Vector{value, value};
+}
+
+// 每个分量是否是装箱的对象（全 1 或 0）
+inline Bits boxedLanes(Vector v) {
+    Bits limit = {BOXED, BOXED};
+    return (Bits)((Bits)v >= limit);
+}
+
+inline bool anyLane(Bits bits) {
+    return (bits[0] | bits[1]) != 0;
+}
+
+LuaTable* toTable(double value, const char* message) {
+    uint64_t bits = toBits(value);
+    if ((bits >> LUA_TAG_SHIFT) != LUA_TAG_TABLE) {
+        lua_runtime_error(message);
+    }
+    return reinterpret_cast<LuaTable*>(bits & LUA_PAYLOAD_MASK);
+}
+
+double boxTable(LuaTable* table) {
+    return fromBits(reinterpret_cast<uint64_t>(table) | (LUA_TAG_TABLE << LUA_TAG_SHIFT));
+}
+
+[[noreturn]] void arithmeticError() {
+    lua_runtime_error("attempt to perform arithmetic on a non-number value");
+}
+
+// 最小值和最大值共用：better(a, b) 为真时取 a
+template <bool Min>
+double extremum(double value, const char* message) {
+    LuaTable* table = toTable(value, message);
+    uint32_t n = lua_table_dense(table);
+    if (n == 0) {
+        return 0;
+    }
+    const double* a = table->array;
+    double result = a[0];
+    uint32_t i = 0;
+    if (n >= LANES) {
+        Vector best = load(a);
+        Bits boxed = boxedLanes(best);
+        for (i = LANES; i + LANES <= n; i += LANES) {
+            Vector v = load(a + i);
+            boxed |= boxedLanes(v);
+            best = Min ? (v < best ? v : best) : (v > best ? v : best);
+        }
+        if (anyLane(boxed)) {
+            arithmeticError();
+        }
+        for (uint32_t lane = 0; lane < LANES; ++lane) {
+            result = Min ? std::min(result, best[lane]) : std::max(result, best[lane]);
+        }
+    }
+    for (; i < n; ++i) {
+        if (!isNumber(a[i])) {
+            arithmeticError();
+        }
+        result = Min ? std::min(result, a[i]) : std::max(result, a[i]);
+    }
+    return result;
+}
+
+// table.sort 的顺序：数值升序（NaN 排在最后），字符串按字节序
+bool numberLess(double a, double b) {
+    return a < b || (a == a && b != b);
+}
+
+bool stringLess(double a, double b) {
+    return strcmp(toString(a), toString(b)) < 0;
+}
+
+} // namespace
+
+double lua_array_sum(double value) {
+    LuaTable* table = toTable(value, "bad argument #1 to 'table.sum' (table expected)");
+    uint32_t n = lua_table_dense(table);
+    const double* a = table->array;
+    Vector sum0 = splat(0);
+    Vector sum1 = splat(0);
+    Bits boxed = {0, 0};
+    uint32_t i = 0;
+    for (; i + 2 * LANES <= n; i += 2 * LANES) {
+        Vector v0 = load(a + i);
+        Vector v1 = load(a + i + LANES);
+        boxed |= boxedLanes(v0) | boxedLanes(v1);
+        sum0 += v0;
+        sum1 += v1;
+    }
+    Vector sum = sum0 + sum1;
+    double result = sum[0] + sum[1];
+    for (; i < n; ++i) {
+        if (!isNumber(a[i])) {
+            arithmeticError();
+        }
+        result += a[i];
+    }
+    if (anyLane(boxed)) {
+        arithmeticError();
+    }
+    return result;
+}
+
+double lua_array_min(double value) {
+    return extremum<true>(value, "bad argument #1 to 'table.min' (table expected)");
+}
+
+double lua_array_max(double value) {
+    return extremum<false>(value, "bad argument #1 to 'table.max' (table expected)");
+}
+
+double lua_array_dot(double left, double right) {
+    LuaTable* x = toTable(left, "bad argument #1 to 'table.dot' (table expected)");
+    LuaTable* y = toTable(right, "bad argument #2 to 'table.dot' (table expected)");
+    uint32_t n = lua_table_dense(x);
+    if (lua_table_dense(y) != n) {
+        lua_runtime_error("table.dot: arrays have different lengths");
+    }
+    const double* a = x->array;
+    const double* b = y->array;
+    Vector sum0 = splat(0);
+    Vector sum1 = splat(0);
+    Bits boxed = {0, 0};
+    uint32_t i = 0;
+    for (; i + 2 * LANES <= n; i += 2 * LANES) {
+        Vector u0 = load(a + i);
+        Vector u1 = load(a + i + LANES);
+        Vector v0 = load(b + i);
+        Vector v1 = load(b + i + LANES);
+        boxed |= boxedLanes(u0) | boxedLanes(u1) | boxedLanes(v0) | boxedLanes(v1);
+        sum0 += u0 * v0;
+        sum1 += u1 * v1;
+    }
+    Vector sum = sum0 + sum1;
+    double result = sum[0] + sum[1];
+    for (; i < n; ++i) {
+        if (!isNumber(a[i]) || !isNumber(b[i])) {
+            arithmeticError();
+        }
+        result += a[i] * b[i];
+    }
+    if (anyLane(boxed)) {
+        arithmeticError();
+    }
+    return result;
+}
+
+// 原地乘以 factor，返回表本身；遇到非数值时报错（错误会终止程序，不必回滚）
+double lua_array_scale(double value, double factor) {
+    LuaTable* table = toTable(value, "bad argument #1 to 'table.scale' (table expected)");
+    if (!isNumber(factor)) {
+        arithmeticError();
+    }
+    uint32_t n = lua_table_dense(table);
+    double* a = table->array;
+    Vector k = splat(factor);
+    uint32_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        Vector v = load(a + i);
+        if (anyLane(boxedLanes(v))) {
+            arithmeticError();
+        }
+        store(a + i, v * k);
+    }
+    for (; i < n; ++i) {
+        if (!isNumber(a[i])) {
+            arithmeticError();
+        }
+        a[i] *= factor;
+    }
+    return value;
+}
+
+// 把键 1..count 都置为 fill，count 为 nil 时使用数组部分当前的长度，返回表本身
+double lua_array_fill(double value, double fill, double count) {
+    LuaTable* table = toTable(value, "bad argument #1 to 'table.fill' (table expected)");
+    uint32_t size = lua_table_dense(table);
+    uint32_t n = size;
+    if (count != 0) {
+        if (!(count >= 0 && count <= UINT32_MAX) || count != static_cast<uint32_t>(count)) {
+            lua_runtime_error("bad argument #3 to 'table.fill' (non-negative integer expected)");
+        }
+        n = static_cast<uint32_t>(count);
+    }
+    // 原来在哈希部分中的键由 lua_table_set 逐个追加到数组部分（同时删除哈希部分中的键），
+    // 哈希部分为空后剩下的直接在下面填充。填充 nil 也一样：数组部分可以存放 0
+    lua_table_reserve(table, n);
+    for (uint32_t key = size + 1; table->count && key <= n; ++key) {
+        lua_table_set(table, key, fill);
+    }
+    double* a = table->array;
+    Vector v = splat(fill);
+    uint32_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        store(a + i, v);
+    }
+    for (; i < n; ++i) {
+        a[i] = fill;
+    }
+    // 追加时可能已经从哈希部分移入了 n 之后的键，数组部分不能因此缩短
+    if (n > table->arraySize) {
+        table->arraySize = n;
+        lua_table_dense(table);
+    }
+    return value;
+}
+
+// 复制数组部分到新表
+double lua_array_copy(double value) {
+    LuaTable* table = toTable(value, "bad argument #1 to 'table.copy' (table expected)");
+    uint32_t n = lua_table_dense(table);
+    LuaTable* copy = lua_table_new(0);
+    lua_table_reserve(copy, n);
+    if (n) {
+        memcpy(copy->array, table->array, n * sizeof(double));
+    }
+    copy->arraySize = n;
+    return boxTable(copy);
+}
+
+// 在数组部分上原地排序（std::sort 是 introsort）。元素必须都是数值或都是字符串
+double lua_array_sort(double value) {
+    LuaTable* table = toTable(value, "bad argument #1 to 'table.sort' (table expected)");
+    uint32_t n = lua_table_dense(table);
+    double* a = table->array;
+    uint32_t strings = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (isString(a[i])) {
+            strings++;
+        } else if (!isNumber(a[i])) {
+            lua_runtime_error("attempt to compare two table values");
+        }
+    }
+    if (strings == 0) {
+        std::sort(a, a + n, numberLess);
+    } else if (strings == n) {
+        std::sort(a, a + n, stringLess);
+    } else {
+        lua_runtime_error("attempt to compare number with string");
+    }
+    return 0;
+}
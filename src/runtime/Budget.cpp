@@ -0,0 +1,40 @@
+#include "Runtime.h"
+
+namespace {
+
+// 每个工作线程各自计数，同一线程上轮流执行的脚本共用一个时间片
+thread_local int64_t budget = LUA_DEFAULT_BUDGET;
+thread_local int64_t quantum = LUA_DEFAULT_BUDGET;
+thread_local LuaPreemptHandler preemptHandler = nullptr;
+thread_local void* preemptData = nullptr;
+thread_local int deferred = 0;
+
+}
+
+int64_t* lua_budget_counter() {
+    return &budget;
+}
+
+void lua_set_budget(int64_t slice) {
+    quantum = slice > 0 ? slice : 1;
+    budget = quantum;
+}
+
+void lua_set_preempt_handler(LuaPreemptHandler handler, void* data) {
+    preemptHandler = handler;
+    preemptData = data;
+}
+
+void lua_defer_preempt(int defer) {
+    deferred += defer ? 1 : -1;
+}
+
+// 调度函数可以切换到其他脚本（例如切换 ucontext 或纤程），切换回来时脚本
+// 从检查点继续执行，重新获得一个完整的时间片；没有调度函数时只重新开始计数
+int64_t lua_preempt() {
+    if (preemptHandler && !deferred) {
+        preemptHandler(preemptData);
+    }
+    budget = quantum;
+    return budget;
+}
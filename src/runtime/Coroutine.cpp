@@ -0,0 +1,15 @@
+#include "Runtime.h"
+#include <cstring>
+
+// 协程对象和表一样从 lua_alloc 分配，协程帧在协程结束或出错时由 resume 释放
+LuaCoroutine* lua_coroutine_new() {
+    auto* co = static_cast<LuaCoroutine*>(lua_alloc(sizeof(LuaCoroutine)));
+    memset(co, 0, sizeof(LuaCoroutine));
+    co->status = LUA_COROUTINE_SUSPENDED;
+    return co;
+}
+
+// 协程是无栈的，只能在协程体本身中 yield
+void lua_coroutine_yield_outside() {
+    lua_runtime_error("attempt to yield from outside a coroutine body");
+}
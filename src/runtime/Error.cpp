@@ -0,0 +1,42 @@
+#include "Runtime.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+
+void lua_error(double value) {
+    throw LuaError{value};
+}
+
+// 消息是静态字符串，直接装箱
+void lua_runtime_error(const char* message) {
+    uint64_t bits = reinterpret_cast<uint64_t>(message) | (LUA_TAG_STRING << LUA_TAG_SHIFT);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    lua_error(value);
+}
+
+double lua_catch_error(void* exception) {
+    double value = static_cast<LuaError*>(abi::__cxa_begin_catch(exception))->value;
+    abi::__cxa_end_catch();
+    return value;
+}
+
+void lua_uncaught_error(void* exception) {
+    double value = lua_catch_error(exception);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t tag = bits >> LUA_TAG_SHIFT;
+    
+    lua_flush();
+    if (tag == LUA_TAG_STRING) {
+        fprintf(stderr, "lua: %s\n", reinterpret_cast<const char*>(bits & LUA_PAYLOAD_MASK));
+    } else if (tag < LUA_TAG_STRING) {
+        char buffer[LUA_NUMBER_BUFFER + 1];
+        *lua_format_number(buffer, value) = '\0';
+        fprintf(stderr, "lua: %s\n", buffer);
+    } else {
+        fprintf(stderr, "lua: (error object is not a string)\n");
+    }
+    abort();
+}
@@ -0,0 +1,261 @@
+#include "Runtime.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// __index/__newindex 链的最大长度，与 Lua 一致
+constexpr int MAX_META_CHAIN = 100;
+
+const char* const eventNames[LUA_EVENT_COUNT] = {
+    "__index", "__newindex", "__add", "__sub", "__mul", "__div", "__unm", "__concat",
+    "__eq", "__lt", "__le",
+};
+
+inline uint64_t toBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double box(const void* pointer, uint64_t tag) {
+    uint64_t bits = reinterpret_cast<uint64_t>(pointer) | (tag << LUA_TAG_SHIFT);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline uint64_t tagOf(double value) {
+    return toBits(value) >> LUA_TAG_SHIFT;
+}
+
+inline LuaTable* toTable(double value) {
+    return tagOf(value) == LUA_TAG_TABLE
+        ? reinterpret_cast<LuaTable*>(toBits(value) & LUA_PAYLOAD_MASK) : nullptr;
+}
+
+// 元表中事件的元方法，没有时记入 flags，下次只检查一位
+double findMetamethod(LuaTable* metatable, int event) {
+    uint32_t bit = 1u << event;
+    if (metatable->flags & bit) {
+        return 0;
+    }
+    double handler = lua_table_get(metatable, box(eventNames[event], LUA_TAG_STRING));
+    if (handler == 0) {
+        metatable->flags |= bit;
+    }
+    return handler;
+}
+
+// 字符串按 Lua 的规则转换成数值：去掉首尾空白后必须整体是一个数
+bool toNumber(double value, double& number) {
+    uint64_t tag = tagOf(value);
+    if (tag < LUA_TAG_STRING) {
+        number = value;
+        return true;
+    }
+    if (tag != LUA_TAG_STRING) {
+        return false;
+    }
+    const char* text = reinterpret_cast<const char*>(toBits(value) & LUA_PAYLOAD_MASK);
+    char* end;
+    number = strtod(text, &end);
+    if (end == text) {
+        return false;
+    }
+    while (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r') {
+        ++end;
+    }
+    return *end == '\0';
+}
+
+[[noreturn]] void arithmeticError(double value) {
+    switch (tagOf(value)) {
+    case LUA_TAG_STRING:
+        lua_runtime_error("attempt to perform arithmetic on a string value");
+    case LUA_TAG_TABLE:
+        lua_runtime_error("attempt to perform arithmetic on a table value");
+    case LUA_TAG_FUNCTION:
+        lua_runtime_error("attempt to perform arithmetic on a function value");
+    default:
+        lua_runtime_error("attempt to perform arithmetic on a coroutine value");
+    }
+}
+
+const char* typeName(double value) {
+    switch (tagOf(value)) {
+    case LUA_TAG_STRING: return "string";
+    case LUA_TAG_TABLE: return "table";
+    case LUA_TAG_FUNCTION: return "function";
+    case LUA_TAG_COROUTINE: return "thread";
+    default: return value == 0 ? "nil" : "number";
+    }
+}
+
+// 错误值是指向消息的字符串，消息从 lua_alloc 分配
+[[noreturn]] void compareError(double left, double right) {
+    constexpr size_t MESSAGE_SIZE = 64;
+    auto* message = static_cast<char*>(lua_alloc(MESSAGE_SIZE));
+    const char* a = typeName(left);
+    const char* b = typeName(right);
+    if (strcmp(a, b) == 0) {
+        snprintf(message, MESSAGE_SIZE, "attempt to compare two %s values", a);
+    } else {
+        snprintf(message, MESSAGE_SIZE, "attempt to compare %s with %s", a, b);
+    }
+    lua_runtime_error(message);
+}
+
+inline const char* toString(double value) {
+    return reinterpret_cast<const char*>(toBits(value) & LUA_PAYLOAD_MASK);
+}
+
+} // namespace
+
+double lua_metamethod(double value, int32_t event) {
+    LuaTable* table = toTable(value);
+    if (!table || !table->metatable) {
+        return 0;
+    }
+    return findMetamethod(table->metatable, event);
+}
+
+double lua_call_value(double function, double a, double b, double c) {
+    if (tagOf(function) != LUA_TAG_FUNCTION) {
+        lua_runtime_error("attempt to call a non-function value");
+    }
+    auto* target = reinterpret_cast<LuaFunction>(toBits(function) & LUA_PAYLOAD_MASK);
+    return target(a, b, c);
+}
+
+// 设置元表时探测全部事件，快速路径从第一次访问起就只检查一位
+double lua_setmetatable(double table, double metatable) {
+    LuaTable* target = toTable(table);
+    if (!target) {
+        lua_runtime_error("bad argument #1 to 'setmetatable' (table expected)");
+    }
+    LuaTable* meta = toTable(metatable);
+    if (!meta && metatable != 0) {
+        lua_runtime_error("bad argument #2 to 'setmetatable' (nil or table expected)");
+    }
+    target->metatable = meta;
+    if (meta) {
+        meta->flags = 0;
+        for (int event = 0; event < LUA_EVENT_COUNT; ++event) {
+            findMetamethod(meta, event);
+        }
+    }
+    return table;
+}
+
+double lua_getmetatable(double table) {
+    LuaTable* target = toTable(table);
+    if (!target || !target->metatable) {
+        return 0;
+    }
+    return box(target->metatable, LUA_TAG_TABLE);
+}
+
+double lua_arith(int32_t event, double left, double right) {
+    double a, b;
+    if (toNumber(left, a) && toNumber(right, b)) {
+        switch (event) {
+        case LUA_EVENT_ADD: return a + b;
+        case LUA_EVENT_SUB: return a - b;
+        case LUA_EVENT_MUL: return a * b;
+        case LUA_EVENT_DIV: return a / b;
+        default: return -a;
+        }
+    }
+    double handler = lua_metamethod(left, event);
+    if (handler == 0) {
+        handler = lua_metamethod(right, event);
+    }
+    if (handler == 0) {
+        arithmeticError(toNumber(left, a) ? right : left);
+    }
+    return lua_call_value(handler, left, right, 0);
+}
+
+// 生成的代码已经处理了两个操作数都是数值的情形（只剩 NaN）。nil 的位模式是 0.0，按数值比较
+int32_t lua_compare(int32_t event, double left, double right) {
+    uint64_t leftTag = tagOf(left);
+    uint64_t rightTag = tagOf(right);
+    if (leftTag < LUA_TAG_STRING && rightTag < LUA_TAG_STRING) {
+        switch (event) {
+        case LUA_EVENT_EQ: return left == right;
+        case LUA_EVENT_LT: return left < right;
+        default: return left <= right;
+        }
+    }
+    if (leftTag == LUA_TAG_STRING && rightTag == LUA_TAG_STRING) {
+        int order = strcmp(toString(left), toString(right));
+        switch (event) {
+        case LUA_EVENT_EQ: return order == 0;
+        case LUA_EVENT_LT: return order < 0;
+        default: return order <= 0;
+        }
+    }
+    if (event == LUA_EVENT_EQ) {
+        // 类型不同或者是同一个对象时不查找元方法
+        if (leftTag != rightTag || toBits(left) == toBits(right)) {
+            return toBits(left) == toBits(right);
+        }
+        if (leftTag != LUA_TAG_TABLE) {
+            return 0;
+        }
+    }
+    double handler = lua_metamethod(left, event);
+    if (handler == 0) {
+        handler = lua_metamethod(right, event);
+    }
+    if (handler == 0) {
+        if (event == LUA_EVENT_EQ) {
+            return 0;
+        }
+        compareError(left, right);
+    }
+    return lua_call_value(handler, left, right, 0) != 0;
+}
+
+// 原始值为 nil：沿 __index 链查找，元方法是函数时以 (t, k) 调用
+double lua_index_slow(LuaTable* table, double key) {
+    for (int depth = 0; depth < MAX_META_CHAIN; ++depth) {
+        double handler = findMetamethod(table->metatable, LUA_EVENT_INDEX);
+        if (handler == 0) {
+            return 0;
+        }
+        LuaTable* next = toTable(handler);
+        if (!next) {
+            return lua_call_value(handler, box(table, LUA_TAG_TABLE), key, 0);
+        }
+        double value = lua_table_get(next, key);
+        if (value != 0 || !next->metatable) {
+            return value;
+        }
+        table = next;
+    }
+    lua_runtime_error("'__index' chain too long; possible loop");
+}
+
+// 原始值不是 nil 时直接写入；否则沿 __newindex 链写入，元方法是函数时以 (t, k, v) 调用
+void lua_setindex_slow(LuaTable* table, double key, double value) {
+    for (int depth = 0; depth < MAX_META_CHAIN; ++depth) {
+        double handler = 0;
+        if (table->metatable && lua_table_get(table, key) == 0) {
+            handler = findMetamethod(table->metatable, LUA_EVENT_NEWINDEX);
+        }
+        if (handler == 0) {
+            lua_table_set(table, key, value);
+            return;
+        }
+        LuaTable* next = toTable(handler);
+        if (!next) {
+            lua_call_value(handler, box(table, LUA_TAG_TABLE), key, value);
+            return;
+        }
+        table = next;
+    }
+    lua_runtime_error("'__newindex' chain too long; possible loop");
+}
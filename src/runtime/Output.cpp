@@ -0,0 +1,96 @@
+#include "Runtime.h"
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+// 每个线程一个输出缓冲区，写满或程序结束时才调用一次 write
+constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+
+// 单个值格式化后的最大长度（%.14g 或带前缀的指针）
+constexpr size_t MAX_VALUE_LENGTH = 64;
+
+struct OutputBuffer {
+    char data[OUTPUT_BUFFER_SIZE];
+    size_t length = 0;
+
+    ~OutputBuffer() { flush(); }
+
+    void flush() {
+        size_t written = 0;
+        while (written < length) {
+            ssize_t n = write(STDOUT_FILENO, data + written, length - written);
+            if (n <= 0) {
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+        length = 0;
+    }
+
+    char* reserve(size_t size) {
+        if (length + size > OUTPUT_BUFFER_SIZE) {
+            flush();
+        }
+        return data + length;
+    }
+};
+
+thread_local OutputBuffer output;
+
+char* formatPointer(char* out, const char* prefix, uint64_t address) {
+    size_t prefixLength = strlen(prefix);
+    memcpy(out, prefix, prefixLength);
+    out += prefixLength;
+    *out++ = '0';
+    *out++ = 'x';
+    return std::to_chars(out, out + 16, address, 16).ptr;
+}
+
+} // namespace
+
+void lua_print_value(double value, int terminator) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t tag = bits >> LUA_TAG_SHIFT;
+    if (tag == LUA_TAG_STRING) {
+        lua_print_string(reinterpret_cast<const char*>(bits & LUA_PAYLOAD_MASK), terminator);
+        return;
+    }
+    char* out = output.reserve(MAX_VALUE_LENGTH + 1);
+    if (tag == LUA_TAG_TABLE) {
+        out = formatPointer(out, "table: ", bits & LUA_PAYLOAD_MASK);
+    } else if (tag == LUA_TAG_FUNCTION) {
+        out = formatPointer(out, "function: ", bits & LUA_PAYLOAD_MASK);
+    } else if (tag == LUA_TAG_COROUTINE) {
+        out = formatPointer(out, "coroutine: ", bits & LUA_PAYLOAD_MASK);
+    } else {
+        out = lua_format_number(out, value);
+    }
+    *out++ = static_cast<char>(terminator);
+    output.length = out - output.data;
+}
+
+void lua_print_string(const char* value, int terminator) {
+    size_t length = strlen(value);
+    if (length + 1 > OUTPUT_BUFFER_SIZE) {
+        output.flush();
+        ssize_t unused = write(STDOUT_FILENO, value, length);
+        (void)unused;
+        length = 0;
+    }
+    char* out = output.reserve(length + 1);
+    memcpy(out, value, length);
+    out[length] = static_cast<char>(terminator);
+    output.length += length + 1;
+}
+
+void lua_print_newline() {
+    *output.reserve(1) = '\n';
+    output.length += 1;
+}
+
+void lua_flush() {
+    output.flush();
+}
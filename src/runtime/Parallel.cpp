@@ -0,0 +1,292 @@
+#include "Runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// parallel.map/parallel.for：在进程内的线程池上并行调用纯函数（由编译器检查）。
+// 调用者线程也参与计算。每个线程开始时分到一段连续的下标，从自己那段的前端按块取，
+// 取完后从其他线程那段的后端偷走一半（work stealing），负载不均时也能让所有线程忙碌。
+// 每个下标的结果写到结果数组的不同位置，不需要同步。
+//
+// 工作线程在任务期间借用调用者的执行状态，字符串等分配在调用者 LuaState 的堆上
+// （堆在任务期间加锁），随 LuaState 一起释放。调用者持有线程池期间推迟抢占：调度函数
+// 切换到的脚本如果也调用 parallel，会在同一个线程上再次请求线程池而死锁。
+// LUA_PARALLEL_THREADS 设置线程数（包括调用者），默认是 CPU 核数
+
+namespace {
+
+// 元素少于这个数时在调用者线程上直接计算
+constexpr uint32_t MIN_PARALLEL = 64;
+
+inline uint64_t toBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double fromBits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// 每个线程的下标区间 [begin, end)：所有者从前端取，窃取者从后端取
+struct Range {
+    std::mutex lock;
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+struct Job {
+    LuaExecution* execution;    // 调用者的执行状态，没有 LuaState 时为空
+    LuaFunction function;
+    const double* input;    // parallel.map 的输入数组，parallel.for 为 nullptr
+    double first;           // parallel.for 的起始值
+    double* output;
+    uint32_t grain;
+    std::vector<Range> ranges;
+
+    std::atomic<bool> failed{false};
+    std::mutex errorLock;
+    double error = 0;
+
+    explicit Job(size_t threads) : ranges(threads) {}
+};
+
+// 从自己的区间前端取一块，取不到时返回 false
+bool takeFront(Range& range, uint32_t grain, uint32_t& begin, uint32_t& end) {
+    std::lock_guard<std::mutex> lock(range.lock);
+    if (range.begin >= range.end) {
+        return false;
+    }
+    begin = range.begin;
+    end = std::min(range.end, begin + grain);
+    range.begin = end;
+    return true;
+}
+
+// 从其他线程的区间后端偷走一半，放进自己的区间
+bool steal(Job& job, size_t self) {
+    size_t count = job.ranges.size();
+    for (size_t k = 1; k < count; ++k) {
+        Range& victim = job.ranges[(self + k) % count];
+        uint32_t begin, end;
+        {
+            std::lock_guard<std::mutex> lock(victim.lock);
+            uint32_t left = victim.end > victim.begin ? victim.end - victim.begin : 0;
+            if (left == 0) {
+                continue;
+            }
+            begin = victim.end - (left + 1) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+        Range& own = job.ranges[self];
+        std::lock_guard<std::mutex> lock(own.lock);
+        own.begin = begin;
+        own.end = end;
+        return true;
+    }
+    return false;
+}
+
+// 在线程上临时挂上另一个执行状态，离开作用域时恢复
+struct ExecutionScope {
+    LuaExecution* previous;
+    explicit ExecutionScope(LuaExecution* execution) : previous(lua_set_execution(execution)) {}
+    ~ExecutionScope() { lua_set_execution(previous); }
+};
+
+void work(Job& job, size_t self) {
+    ExecutionScope scope(job.execution);
+    Range& own = job.ranges[self];
+    for (;;) {
+        uint32_t begin, end;
+        if (!takeFront(own, job.grain, begin, end)) {
+            if (!steal(job, self)) {
+                return;
+            }
+            continue;
+        }
+        // 出错后不再调用函数，只把剩下的区间取完
+        if (job.failed.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        try {
+            for (uint32_t i = begin; i < end; ++i) {
+                double argument = job.input ? job.input[i] : job.first + i;
+                job.output[i] = job.function(argument, 0, 0);
+            }
+        } catch (const LuaError& e) {
+            std::lock_guard<std::mutex> lock(job.errorLock);
+            if (!job.failed.exchange(true)) {
+                job.error = e.value;
+            }
+        }
+    }
+}
+
+// 常驻的工作线程，进程退出时不回收（线程分离，池对象不析构）
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads) {
+        for (size_t i = 1; i < threads; ++i) {
+            std::thread(&ThreadPool::loop, this, i).detach();
+        }
+        size = threads;
+    }
+
+    size_t threads() const { return size; }
+
+    // 同一时刻只执行一个任务，其他线程的调用等待
+    void run(Job& job) {
+        std::lock_guard<std::mutex> running(runLock);
+        lua_defer_preempt(1);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &job;
+            active = size - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        work(job, 0);
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return active == 0; });
+        current = nullptr;
+        lua_defer_preempt(0);
+    }
+
+private:
+    std::mutex runLock;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    Job* current = nullptr;
+    uint64_t generation = 0;
+    size_t active = 0;
+    size_t size = 1;
+
+    void loop(size_t self) {
+        uint64_t seen = 0;
+        for (;;) {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return generation != seen; });
+                seen = generation;
+                job = current;
+            }
+            work(*job, self);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--active == 0) {
+                idle.notify_one();
+            }
+        }
+    }
+};
+
+ThreadPool& pool() {
+    static ThreadPool* instance = [] {
+        size_t threads = std::thread::hardware_concurrency();
+        if (const char* value = getenv("LUA_PARALLEL_THREADS")) {
+            threads = strtoul(value, nullptr, 10);
+        }
+        return new ThreadPool(std::max<size_t>(threads, 1));
+    }();
+    return *instance;
+}
+
+LuaFunction toFunction(double value, const char* message) {
+    uint64_t bits = toBits(value);
+    if ((bits >> LUA_TAG_SHIFT) != LUA_TAG_FUNCTION) {
+        lua_runtime_error(message);
+    }
+    return reinterpret_cast<LuaFunction>(bits & LUA_PAYLOAD_MASK);
+}
+
+// 计算 output[0..n)，线程池只有一个线程或元素很少时直接在调用者线程上计算
+void dispatch(LuaFunction function, const double* input, double first, double* output, uint32_t n) {
+    if (n < MIN_PARALLEL || pool().threads() == 1) {
+        for (uint32_t i = 0; i < n; ++i) {
+            output[i] = function(input ? input[i] : first + i, 0, 0);
+        }
+        return;
+    }
+
+    ThreadPool& threads = pool();
+    size_t count = threads.threads();
+    Job job(count);
+    job.execution = lua_get_execution();
+    job.function = function;
+    job.input = input;
+    job.first = first;
+    job.output = output;
+    // 每块足够大以摊薄加锁的开销，又足够小以便窃取
+    job.grain = std::max<uint32_t>(1, std::min<uint32_t>(256, n / static_cast<uint32_t>(count * 16)));
+    for (size_t i = 0; i < count; ++i) {
+        job.ranges[i].begin = static_cast<uint32_t>(n * i / count);
+        job.ranges[i].end = static_cast<uint32_t>(n * (i + 1) / count);
+    }
+    LuaHeap* heap = job.execution ? job.execution->heap : nullptr;
+    lua_heap_share(heap, 1);
+    threads.run(job);
+    lua_heap_share(heap, 0);
+    if (job.failed) {
+        lua_error(job.error);
+    }
+}
+
+// 结果数组的长度是 n，返回 nil 或 0 的元素也留在数组部分中
+double finish(LuaTable* result, uint32_t n) {
+    result->arraySize = n;
+    return fromBits(reinterpret_cast<uint64_t>(result) | (LUA_TAG_TABLE << LUA_TAG_SHIFT));
+}
+
+} // namespace
+
+// 输入只能是数值和字符串：表可能带有元表，元方法会在工作线程上运行任意代码
+double lua_parallel_map(double function, double table) {
+    LuaFunction f = toFunction(function, "bad argument #1 to 'parallel.map' (function expected)");
+    uint64_t bits = toBits(table);
+    if ((bits >> LUA_TAG_SHIFT) != LUA_TAG_TABLE) {
+        lua_runtime_error("bad argument #2 to 'parallel.map' (table expected)");
+    }
+    LuaTable* input = reinterpret_cast<LuaTable*>(bits & LUA_PAYLOAD_MASK);
+    uint32_t n = lua_table_dense(input);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint64_t tag = toBits(input->array[i]) >> LUA_TAG_SHIFT;
+        if (tag > LUA_TAG_STRING) {
+            lua_runtime_error("bad argument #2 to 'parallel.map' (array of numbers or strings expected)");
+        }
+    }
+
+    LuaTable* result = lua_table_new(0);
+    lua_table_reserve(result, n);
+    dispatch(f, input->array, 0, result->array, n);
+    return finish(result, n);
+}
+
+double lua_parallel_for(double function, double first, double last) {
+    LuaFunction f = toFunction(function, "bad argument #1 to 'parallel.for' (function expected)");
+    if (toBits(first) >= (LUA_TAG_STRING << LUA_TAG_SHIFT) || toBits(last) >= (LUA_TAG_STRING << LUA_TAG_SHIFT)) {
+        lua_runtime_error("bad argument to 'parallel.for' (number expected)");
+    }
+    double span = std::floor(last - first) + 1;
+    if (!(span > 0)) {
+        return finish(lua_table_new(0), 0);
+    }
+    if (span > UINT32_MAX) {
+        lua_runtime_error("bad argument to 'parallel.for' (range too large)");
+    }
+    uint32_t n = static_cast<uint32_t>(span);
+    LuaTable* result = lua_table_new(0);
+    lua_table_reserve(result, n);
+    dispatch(f, nullptr, first, result->array, n);
+    return finish(result, n);
+}
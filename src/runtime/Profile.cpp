@@ -0,0 +1,205 @@
+#include "Runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 分配分析：按 tcmalloc 的方式抽样，相邻两次抽样之间的字节数服从均值为 interval 的指数分布，
+// 大小为 size 的分配被抽中的概率是 1 - exp(-size / interval)，抽中时按 size 除以这个概率计入，
+// 统计量是无偏估计。只记录抽中的分配，释放时（lua_free 或 LuaState 的堆整体释放）从存活量中减去。
+// 没有 GC，存活量就是到报告时还没有释放的字节数
+//
+// LUA_PROFILE_INTERVAL 设置平均抽样间隔（字节，默认 64 KiB，0 表示记录每次分配），
+// LUA_PROFILE_OUTPUT 设置 JSON 报告的路径（默认 lua-alloc.json）
+
+std::atomic<int> lua_profiling{0};
+
+namespace {
+
+constexpr double DEFAULT_INTERVAL = 64 * 1024;
+
+// 分配点的描述在第一次抽中时复制：JIT 执行的代码卸载后报告仍然可以输出
+struct SiteStats {
+    std::string source;
+    int32_t line = 0;
+    int32_t kind = -1;
+    double allocations = 0;
+    double bytes = 0;
+    double liveBytes = 0;
+};
+
+struct Sample {
+    const LuaAllocSite* site;
+    double weight;
+    LuaHeap* heap;
+};
+
+// 没有登记分配点的分配（例如宿主直接调用运行时函数）
+const LuaAllocSite unknownSite = {"?", 0, -1};
+
+std::mutex mutex;
+std::unordered_map<const LuaAllocSite*, SiteStats> sites;
+std::unordered_map<void*, Sample> samples;
+double interval = DEFAULT_INTERVAL;
+std::atomic<bool> dumpRequested{false};
+
+thread_local const LuaAllocSite* currentSite = &unknownSite;
+thread_local double untilSample = -1;
+thread_local std::mt19937_64 generator;
+
+double nextSample() {
+    if (interval <= 0) {
+        return 0;
+    }
+    return std::exponential_distribution<double>(1 / interval)(generator);
+}
+
+const char* kindName(int32_t kind) {
+    switch (kind) {
+    case LUA_ALLOC_TABLE: return "table";
+    case LUA_ALLOC_CONCAT: return "concat";
+    case LUA_ALLOC_SETINDEX: return "table growth";
+    case LUA_ALLOC_CLOSURE: return "closure";
+    case LUA_ALLOC_BUILTIN: return "builtin";
+    default: return "unknown";
+    }
+}
+
+void writeJsonString(FILE* out, const char* text) {
+    fputc('"', out);
+    for (; *text; ++text) {
+        unsigned char c = static_cast<unsigned char>(*text);
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void onSignal(int) {
+    dumpRequested.store(true, std::memory_order_relaxed);
+}
+
+} // namespace
+
+void lua_profile_start() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        if (const char* value = getenv("LUA_PROFILE_INTERVAL")) {
+            interval = strtod(value, nullptr);
+        }
+        // 抽样间隔等设置好之后再打开，其他线程看到非零时也能看到这些设置
+        lua_profiling.store(1, std::memory_order_release);
+        atexit(lua_profile_report);
+        signal(SIGUSR2, onSignal);
+    });
+}
+
+// 生成的代码在分配点之前调用，调用返回后以 nullptr 再调用一次，之后的分配（例如宿主直接
+// 调用运行时函数）不会算到上一个分配点上。收到信号后在这里（而不是信号处理函数中）输出报告
+void lua_profile_site(const LuaAllocSite* site) {
+    currentSite = site ? site : &unknownSite;
+    if (dumpRequested.load(std::memory_order_relaxed) && dumpRequested.exchange(false)) {
+        lua_profile_report();
+    }
+}
+
+void lua_profile_alloc(void* memory, size_t size, LuaHeap* heap) {
+    if (untilSample < 0) {
+        untilSample = nextSample();
+    }
+    untilSample -= static_cast<double>(size);
+    if (untilSample > 0) {
+        return;
+    }
+    untilSample = nextSample();
+
+    double weight = static_cast<double>(size);
+    if (interval > 0 && size > 0) {
+        weight /= -std::expm1(-static_cast<double>(size) / interval);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    SiteStats& stats = sites[currentSite];
+    if (stats.source.empty()) {
+        stats.source = currentSite->source;
+        stats.line = currentSite->line;
+        stats.kind = currentSite->kind;
+    }
+    stats.allocations += size ? weight / static_cast<double>(size) : 1;
+    stats.bytes += weight;
+    stats.liveBytes += weight;
+    samples[memory] = {currentSite, weight, heap};
+}
+
+void lua_profile_free(void* memory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = samples.find(memory);
+    if (it == samples.end()) {
+        return;
+    }
+    sites[it->second.site].liveBytes -= it->second.weight;
+    samples.erase(it);
+}
+
+void lua_profile_release(LuaHeap* heap) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = samples.begin(); it != samples.end();) {
+        if (it->second.heap == heap) {
+            sites[it->second.site].liveBytes -= it->second.weight;
+            it = samples.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// 文本报告写到 stderr，按分配的字节数从大到小排列；JSON 报告写到 LUA_PROFILE_OUTPUT
+void lua_profile_report() {
+    std::vector<SiteStats> sorted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& entry : sites) {
+            sorted.push_back(entry.second);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const SiteStats& a, const SiteStats& b) {
+        return a.bytes > b.bytes;
+    });
+
+    lua_flush();
+    fprintf(stderr, "lua: allocation profile (sampling interval %.0f bytes)\n", interval);
+    fprintf(stderr, "%14s %12s %14s %7s  %s\n", "bytes", "allocs", "live bytes", "live%", "site");
+    for (const SiteStats& stats : sorted) {
+        double live = std::max(stats.liveBytes, 0.0);
+        fprintf(stderr, "%14.0f %12.0f %14.0f %6.1f%%  %s:%d %s\n", stats.bytes, stats.allocations, live,
+                stats.bytes > 0 ? 100 * live / stats.bytes : 0.0,
+                stats.source.c_str(), stats.line, kindName(stats.kind));
+    }
+
+    const char* path = getenv("LUA_PROFILE_OUTPUT");
+    FILE* out = fopen(path ? path : "lua-alloc.json", "w");
+    if (!out) {
+        return;
+    }
+    fprintf(out, "{\"interval\": %.0f, \"sites\": [", interval);
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const SiteStats& stats = sorted[i];
+        fprintf(out, "%s\n  {\"source\": ", i ? "," : "");
+        writeJsonString(out, stats.source.c_str());
+        fprintf(out, ", \"line\": %d, \"kind\": \"%s\", \"allocations\": %.0f, \"bytes\": %.0f, \"liveBytes\": %.0f}",
+                stats.line, kindName(stats.kind), stats.allocations, stats.bytes, std::max(stats.liveBytes, 0.0));
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+}
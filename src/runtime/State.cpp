@@ -0,0 +1,147 @@
+#include "Runtime.h"
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+// 脚本的堆：按块分配的指针碰撞分配器，释放时整体归还。
+// 共享期间（parallel 的工作线程也在分配）加锁
+struct LuaHeap {
+    struct Block {
+        Block* next;
+    };
+    Block* blocks = nullptr;
+    char* cursor = nullptr;
+    size_t left = 0;
+    bool shared = false;
+    std::mutex lock;
+};
+
+namespace {
+
+constexpr size_t HEAP_BLOCK_SIZE = 1 << 16;
+constexpr size_t HEAP_ALIGNMENT = 8;
+constexpr size_t HEAP_HEADER = (sizeof(LuaHeap::Block) + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
+
+// 每次分配前面有一个字的标记，lua_free 据此区分堆内存和 malloc 分配的内存，
+// 不需要知道分配时挂在线程上的是哪个执行状态，也不需要全局的数据结构
+constexpr size_t TAG_SIZE = sizeof(uint64_t);
+constexpr uint64_t TAG_MALLOC = 0;
+constexpr uint64_t TAG_HEAP = 1;
+
+thread_local LuaExecution* current = nullptr;
+
+void* checked(void* memory) {
+    if (!memory) {
+        lua_runtime_error("not enough memory");
+    }
+    return memory;
+}
+
+// 分配一个新块挂到链表上，返回块头之后的可用空间
+char* addBlock(LuaHeap* heap, size_t size) {
+    auto* block = static_cast<LuaHeap::Block*>(checked(malloc(HEAP_HEADER + size)));
+    block->next = heap->blocks;
+    heap->blocks = block;
+    return reinterpret_cast<char*>(block) + HEAP_HEADER;
+}
+
+// 指针碰撞分配
+void* bump(LuaHeap* heap, size_t size) {
+    size = (size + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
+    // 大对象单独占一个块，不浪费当前块的剩余空间
+    if (size > HEAP_BLOCK_SIZE / 4) {
+        return addBlock(heap, size);
+    }
+    if (size > heap->left) {
+        heap->cursor = addBlock(heap, HEAP_BLOCK_SIZE);
+        heap->left = HEAP_BLOCK_SIZE;
+    }
+    void* memory = heap->cursor;
+    heap->cursor += size;
+    heap->left -= size;
+    return memory;
+}
+
+// 有堆时从堆中分配，否则使用 malloc，返回标记之后的可用空间
+void* allocate(LuaHeap* heap, size_t size) {
+    uint64_t* tagged;
+    if (!heap) {
+        tagged = static_cast<uint64_t*>(checked(malloc(TAG_SIZE + size)));
+        *tagged = TAG_MALLOC;
+    } else if (heap->shared) {
+        std::lock_guard<std::mutex> lock(heap->lock);
+        tagged = static_cast<uint64_t*>(bump(heap, TAG_SIZE + size));
+        *tagged = TAG_HEAP;
+    } else {
+        tagged = static_cast<uint64_t*>(bump(heap, TAG_SIZE + size));
+        *tagged = TAG_HEAP;
+    }
+    return tagged + 1;
+}
+
+} // namespace
+
+LuaExecution* lua_set_execution(LuaExecution* execution) {
+    LuaExecution* previous = current;
+    current = execution;
+    return previous;
+}
+
+LuaExecution* lua_get_execution() {
+    return current;
+}
+
+uint64_t* lua_state_slots() {
+    if (!current) {
+        lua_runtime_error("no Lua state is running on this thread");
+    }
+    return current->slots;
+}
+
+LuaHeap* lua_heap_new() {
+    return new LuaHeap();
+}
+
+void lua_heap_delete(LuaHeap* heap) {
+    if (!heap) {
+        return;
+    }
+    if (lua_profiling.load(std::memory_order_acquire)) {
+        lua_profile_release(heap);
+    }
+    while (heap->blocks) {
+        LuaHeap::Block* next = heap->blocks->next;
+        free(heap->blocks);
+        heap->blocks = next;
+    }
+    delete heap;
+}
+
+void lua_heap_share(LuaHeap* heap, int shared) {
+    if (heap) {
+        heap->shared = shared != 0;
+    }
+}
+
+void* lua_alloc(size_t size) {
+    LuaHeap* heap = current ? current->heap : nullptr;
+    void* memory = allocate(heap, size);
+    if (lua_profiling.load(std::memory_order_acquire)) {
+        lua_profile_alloc(memory, size, heap);
+    }
+    return memory;
+}
+
+// 只归还 malloc 分配的内存：堆中的内存随堆整体释放，与调用时有没有执行状态无关
+void lua_free(void* memory) {
+    if (!memory) {
+        return;
+    }
+    if (lua_profiling.load(std::memory_order_acquire)) {
+        lua_profile_free(memory);
+    }
+    uint64_t* tagged = static_cast<uint64_t*>(memory) - 1;
+    if (*tagged == TAG_MALLOC) {
+        free(tagged);
+    }
+}
@@ -0,0 +1,57 @@
+#include "Runtime.h"
+#include <cstring>
+
+namespace {
+
+inline uint64_t toBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// 字符串原样返回，数值格式化到 buffer 中，其余类型返回 nullptr
+const char* toText(double value, char* buffer, size_t& length) {
+    uint64_t bits = toBits(value);
+    uint64_t tag = bits >> LUA_TAG_SHIFT;
+    if (tag == LUA_TAG_STRING) {
+        const char* text = reinterpret_cast<const char*>(bits & LUA_PAYLOAD_MASK);
+        length = strlen(text);
+        return text;
+    }
+    if (tag >= LUA_TAG_STRING) {
+        return nullptr;
+    }
+    length = lua_format_number(buffer, value) - buffer;
+    return buffer;
+}
+
+} // namespace
+
+double lua_concat(double left, double right) {
+    char leftBuffer[LUA_NUMBER_BUFFER];
+    char rightBuffer[LUA_NUMBER_BUFFER];
+    size_t leftLength = 0;
+    size_t rightLength = 0;
+    const char* a = toText(left, leftBuffer, leftLength);
+    const char* b = toText(right, rightBuffer, rightLength);
+    if (!a || !b) {
+        double handler = lua_metamethod(left, LUA_EVENT_CONCAT);
+        if (handler == 0) {
+            handler = lua_metamethod(right, LUA_EVENT_CONCAT);
+        }
+        if (handler == 0) {
+            lua_runtime_error("attempt to concatenate a non-string value");
+        }
+        return lua_call_value(handler, left, right, 0);
+    }
+
+    char* result = static_cast<char*>(lua_alloc(leftLength + rightLength + 1));
+    memcpy(result, a, leftLength);
+    memcpy(result + leftLength, b, rightLength);
+    result[leftLength + rightLength] = '\0';
+
+    uint64_t bits = reinterpret_cast<uint64_t>(result) | (LUA_TAG_STRING << LUA_TAG_SHIFT);
+    double boxed;
+    memcpy(&boxed, &bits, sizeof(boxed));
+    return boxed;
+}
@@ -0,0 +1,272 @@
+#include "Runtime.h"
+#include <cstring>
+
+namespace {
+
+inline uint64_t toBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline bool isString(uint64_t bits) {
+    return (bits >> LUA_TAG_SHIFT) == LUA_TAG_STRING;
+}
+
+inline const char* toString(uint64_t bits) {
+    return reinterpret_cast<const char*>(bits & LUA_PAYLOAD_MASK);
+}
+
+// -0.0 与 0.0 是同一个键
+inline uint64_t keyBits(double key) {
+    return key == 0 ? 0 : toBits(key);
+}
+
+inline uint64_t hashKey(uint64_t bits) {
+    return isString(bits) ? lua_hash_string(toString(bits)) : lua_hash_bits(bits);
+}
+
+// 字符串按内容比较，其余按位模式比较
+inline bool sameKey(uint64_t a, uint64_t b) {
+    if (a == b) {
+        return true;
+    }
+    return isString(a) && isString(b) && strcmp(toString(a), toString(b)) == 0;
+}
+
+LuaTableEntry* allocateEntries(uint32_t capacity) {
+    auto* entries = static_cast<LuaTableEntry*>(lua_alloc(capacity * sizeof(LuaTableEntry)));
+    uint64_t empty = LUA_EMPTY_KEY;
+    for (uint32_t i = 0; i < capacity; ++i) {
+        memcpy(&entries[i].key, &empty, sizeof(empty));
+        entries[i].value = 0;
+    }
+    return entries;
+}
+
+// 键所在的槽，不存在时返回应插入的空槽；墓碑不等于任何键，探测越过它继续
+uint32_t findSlot(const LuaTable* table, uint64_t key) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t slot = static_cast<uint32_t>(hashKey(key)) & mask;
+    for (;;) {
+        uint64_t current = toBits(table->entries[slot].key);
+        if (current == LUA_EMPTY_KEY || sameKey(current, key)) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+// 扩容时丢弃墓碑；值为 nil 的键照常保留，存入的 0 和不存在的键不能混为一谈
+void rehash(LuaTable* table, uint32_t capacity) {
+    LuaTableEntry* old = table->entries;
+    uint32_t oldCapacity = table->capacity;
+    bool wasShared = table->shared;
+
+    table->entries = allocateEntries(capacity);
+    table->capacity = capacity;
+    table->count = 0;
+    table->shared = 0;
+    for (uint32_t i = 0; i < oldCapacity; ++i) {
+        uint64_t key = toBits(old[i].key);
+        if (key == LUA_EMPTY_KEY || key == LUA_DELETED_KEY) {
+            continue;
+        }
+        uint32_t slot = findSlot(table, key);
+        table->entries[slot] = old[i];
+        table->count++;
+    }
+    if (!wasShared) {
+        lua_free(old);
+    }
+}
+
+// 取出哈希部分中的键（值可以是 nil），在原来的槽留下墓碑；键不存在时返回 false。
+// 只读的常量数据先复制
+bool takeHashValue(LuaTable* table, double key, double& value) {
+    if (table->count == 0) {
+        return false;
+    }
+    uint64_t bits = keyBits(key);
+    uint32_t slot = findSlot(table, bits);
+    if (toBits(table->entries[slot].key) == LUA_EMPTY_KEY) {
+        return false;
+    }
+    if (table->shared) {
+        rehash(table, table->capacity);
+        slot = findSlot(table, bits);
+    }
+    uint64_t deleted = LUA_DELETED_KEY;
+    value = table->entries[slot].value;
+    memcpy(&table->entries[slot].key, &deleted, sizeof(deleted));
+    table->entries[slot].value = 0;
+    return true;
+}
+
+void appendArray(LuaTable* table, double value) {
+    if (table->arraySize == table->arrayCapacity) {
+        lua_table_reserve(table, table->arraySize + 1);
+    }
+    table->array[table->arraySize++] = value;
+}
+
+// 数组部分中键 key 的下标，不在数组部分（包括紧接着的 arraySize + 1）时返回 false
+inline bool arrayIndex(double key, uint32_t limit, uint32_t& index) {
+    double offset = key - 1;
+    if (!(offset >= 0 && offset < limit)) {
+        return false;
+    }
+    index = static_cast<uint32_t>(offset);
+    return index == offset;
+}
+
+} // namespace
+
+LuaTable* lua_table_new(uint32_t sizeHint) {
+    auto* table = static_cast<LuaTable*>(lua_alloc(sizeof(LuaTable)));
+    table->capacity = lua_table_capacity(sizeHint);
+    table->entries = allocateEntries(table->capacity);
+    table->count = 0;
+    table->shared = 0;
+    table->flags = 0;
+    table->arraySize = 0;
+    table->arrayCapacity = 0;
+    table->array = nullptr;
+    table->metatable = nullptr;
+    return table;
+}
+
+LuaTable* lua_table_sized(double size) {
+    if (!(size >= 0 && size <= UINT32_MAX) || size != static_cast<uint32_t>(size)) {
+        lua_runtime_error("bad size in table constructor (non-negative integer expected)");
+    }
+    uint32_t n = static_cast<uint32_t>(size);
+    LuaTable* table = lua_table_new(0);
+    lua_table_reserve(table, n < LUA_TABLE_MAX_HINT ? n : LUA_TABLE_MAX_HINT);
+    return table;
+}
+
+// 常量构造器：entries 已经按哈希布局，表头之外不需要任何复制
+LuaTable* lua_table_constant(const LuaTableEntry* entries, uint32_t capacity, uint32_t count) {
+    auto* table = static_cast<LuaTable*>(lua_alloc(sizeof(LuaTable)));
+    table->entries = const_cast<LuaTableEntry*>(entries);
+    table->capacity = capacity;
+    table->count = count;
+    table->shared = 1;
+    table->flags = 0;
+    table->arraySize = 0;
+    table->arrayCapacity = 0;
+    table->array = nullptr;
+    table->metatable = nullptr;
+    return table;
+}
+
+double lua_table_get(LuaTable* table, double key) {
+    uint32_t index;
+    if (arrayIndex(key, table->arraySize, index)) {
+        return table->array[index];
+    }
+    return table->entries[findSlot(table, keyBits(key))].value;
+}
+
+void lua_table_set(LuaTable* table, double key, double value) {
+    uint32_t index;
+    if (arrayIndex(key, table->arraySize, index)) {
+        table->array[index] = value;
+        return;
+    }
+    // nil 和 0 的编码相同，不能据此缩短数组部分：数值 0 同样可以存放和追加在数组部分中
+    if (arrayIndex(key, table->arraySize + 1, index)) {
+        double previous;
+        takeHashValue(table, key, previous);
+        appendArray(table, value);
+        lua_table_dense(table);
+        return;
+    }
+    
+    uint64_t bits = keyBits(key);
+    // 这个表可能是元表：元方法改变后缓存的“没有元方法”标志失效
+    if (isString(bits) && toString(bits)[0] == '_' && toString(bits)[1] == '_') {
+        table->flags = 0;
+    }
+    uint32_t slot = findSlot(table, bits);
+    if (toBits(table->entries[slot].key) == LUA_EMPTY_KEY) {
+        if ((table->count + 1) * 4ULL > table->capacity * 3ULL) {
+            rehash(table, table->capacity * 2);
+            slot = findSlot(table, bits);
+        }
+    }
+    if (table->shared) {
+        rehash(table, table->capacity);
+        slot = findSlot(table, bits);
+    }
+    if (toBits(table->entries[slot].key) == LUA_EMPTY_KEY) {
+        memcpy(&table->entries[slot].key, &bits, sizeof(bits));
+        table->count++;
+    }
+    table->entries[slot].value = value;
+}
+
+// 容量按 2 的倍数增长，追加的均摊开销是常数
+void lua_table_reserve(LuaTable* table, uint32_t size) {
+    if (size <= table->arrayCapacity) {
+        return;
+    }
+    uint64_t capacity = table->arrayCapacity ? table->arrayCapacity : 4;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    capacity = capacity > UINT32_MAX ? UINT32_MAX : capacity;
+    auto* array = static_cast<double*>(lua_alloc(capacity * sizeof(double)));
+    if (table->arraySize) {
+        memcpy(array, table->array, table->arraySize * sizeof(double));
+    }
+    lua_free(table->array);
+    table->array = array;
+    table->arrayCapacity = static_cast<uint32_t>(capacity);
+}
+
+uint32_t lua_table_dense(LuaTable* table) {
+    double value;
+    while (takeHashValue(table, table->arraySize + 1.0, value)) {
+        appendArray(table, value);
+    }
+    return table->arraySize;
+}
+
+// 运行时没有垃圾回收：LuaState 的堆中的表随堆一起释放（lua_free 不会归还堆中的内存），
+// 宿主在没有执行状态时创建或取得的表由它自己调用 lua_table_free 释放
+void lua_table_free(LuaTable* table) {
+    if (!table->shared) {
+        lua_free(table->entries);
+    }
+    lua_free(table->array);
+    lua_free(table);
+}
+
+// 快速路径：值不是 nil、没有元表或元表确定没有 __index 时不查找元方法
+double lua_index(double table, double key) {
+    uint64_t bits = toBits(table);
+    if ((bits >> LUA_TAG_SHIFT) != LUA_TAG_TABLE) {
+        lua_runtime_error("attempt to index a non-table value");
+    }
+    auto* t = reinterpret_cast<LuaTable*>(bits & LUA_PAYLOAD_MASK);
+    double value = lua_table_get(t, key);
+    if (value != 0 || !t->metatable || (t->metatable->flags & (1u << LUA_EVENT_INDEX))) {
+        return value;
+    }
+    return lua_index_slow(t, key);
+}
+
+void lua_setindex(double table, double key, double value) {
+    uint64_t bits = toBits(table);
+    if ((bits >> LUA_TAG_SHIFT) != LUA_TAG_TABLE) {
+        lua_runtime_error("attempt to index a non-table value");
+    }
+    auto* t = reinterpret_cast<LuaTable*>(bits & LUA_PAYLOAD_MASK);
+    if (!t->metatable || (t->metatable->flags & (1u << LUA_EVENT_NEWINDEX))) {
+        lua_table_set(t, key, value);
+        return;
+    }
+    lua_setindex_slow(t, key, value);
+}